@@ -114,6 +114,7 @@ Emissions * create_poisson_emissions(int n_states, double lambda) {
 
   for (int i = 0; i < n_states; ++i)
     result->insert(new Poisson(i, 0, lambda));
+  result->commitGroups();
 
   return result;
 }
@@ -123,6 +124,7 @@ Emissions * create_poisson_covar_emissions(int n_states, int covar_slot) {
   
   for (int i = 0; i < n_states; ++i)
     result->insert(new PoissonCovar(i, 0, covar_slot));
+  result->commitGroups();
   
   return result;
 }
@@ -137,6 +139,7 @@ MultiEmissions * create_poisson_both_emissions(int n_states, double lambda, int
     
     result->insert(funcs);
   }
+  result->commitGroups();
   
   return result;
 }
@@ -173,7 +176,23 @@ void run_test(Iter & iter, TransTableT * transitions, EmissionTableT * emissions
   cout << "T" << test_number << ":A\t" << loglik/repeats << "\t" << (end - start)*1000.0/CLOCKS_PER_SEC << endl;
   
   delete hmm_auto;
-  
+
+  //
+  // HMM with scaled (linear space) forward
+  //
+  HMM * hmm_scaled = HMM::create(transitions, emissions, init_log_probs, true);
+
+  loglik = 0;
+  start = clock();
+  for (int r = 0; r < repeats; ++r)
+    loglik += hmm_scaled->forward(iter, fwd);
+
+  end = clock();
+
+  cout << "T" << test_number << ":C\t" << loglik/repeats << "\t" << (end - start)*1000.0/CLOCKS_PER_SEC << endl;
+
+  delete hmm_scaled;
+
   if (try_sparse) {
     //
     // HMM with explicit sparse mode
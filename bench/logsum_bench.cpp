@@ -76,6 +76,19 @@ int main(int argc, char ** argv) {
     run_test(lg, repeats, size, fraction, "LogSum");
     delete lg;
   }
+
+  /* vectorized versions */
+  {
+    LogSum * lg = LogSum::createType(3, size, true);
+    run_test(lg, repeats, size, fraction, "LogSumVec(opt)");
+    delete lg;
+  }
+
+  {
+    LogSum * lg = LogSum::createType(3, size, false);
+    run_test(lg, repeats, size, fraction, "LogSumVec");
+    delete lg;
+  }
   
   return EXIT_SUCCESS;
 }
@@ -22,6 +22,9 @@
 #include <emissions/skew_normal.hpp>
 #include <emissions/gamma.hpp>
 #include <hmm.hpp>
+#include <checkpoint.hpp>
+#include <workspace.hpp>
+#include <track.hpp>
 #include <utils.hpp>
 #include <vector>
 #include <cstring>
@@ -101,12 +104,15 @@ public:
   }
   
   Iter * create_iterator(SEXP emissions, SEXP covars, SEXP missing) {
+    /* track file: holds its own covars & missing data */
+    if (TYPEOF(emissions) == EXTPTRSXP)
+      return create_track_iterator(emissions, covars, missing);
+
     /* check missing data support */
     if (!supports_missing && missing != R_NilValue)
       error("HMM instance does not support missing data!");
 
     /* validate emissions & covars */
-    double * eptr;
     double * cptr = NULL;
     int * mptr = NULL;
     int L, N;
@@ -115,8 +121,6 @@ public:
     if (N != emission_size)
       error("emissions don't match data shape: n.rows = %d, required = %d", N, emission_size);
 
-    eptr = REAL(emissions);
-    
     if (covar_size > 0) {
       int Lc, Nc;
       get_dims(covars, Nc, Lc);
@@ -141,10 +145,41 @@ public:
       mptr = INTEGER(missing);
     }
     
-    return new Iter(L, emission_slots, e_slot_dim, eptr,
+    /* integer emissions (e.g. counts) are used as is */
+    if (TYPEOF(emissions) == INTSXP) {
+      std::vector<int> e_slot_type(emission_slots, Iter::INT32);
+      return new Iter(L, emission_slots, e_slot_dim, &e_slot_type[0], INTEGER(emissions),
+                      covar_slots, c_slot_dim, cptr, mptr);
+    }
+
+    return new Iter(L, emission_slots, e_slot_dim, REAL(emissions),
                     covar_slots, c_slot_dim, cptr, mptr);
   }
   
+  Iter * create_track_iterator(SEXP track_ptr, SEXP covars, SEXP missing) {
+    TrackFile * track = (TrackFile*) R_ExternalPtrAddr(track_ptr);
+
+    if (track == NULL || R_ExternalPtrTag(track_ptr) != install("RQHMM_track"))
+      error("invalid track object");
+    if (covars != R_NilValue || missing != R_NilValue)
+      error("covars and missing data are read from the track file");
+    if (!supports_missing && track->has_missing())
+      error("HMM instance does not support missing data!");
+
+    if (track->emission_slots() != emission_slots || track->covar_slots() != covar_slots)
+      error("track doesn't match data shape: %d emission & %d covar slots, required = %d & %d",
+            track->emission_slots(), track->covar_slots(), emission_slots, covar_slots);
+    for (int i = 0; i < emission_slots; ++i)
+      if (track->e_slot_dim()[i] != e_slot_dim[i])
+        error("track emission slot %d dimension %d doesn't match data shape: %d", i + 1, track->e_slot_dim()[i], e_slot_dim[i]);
+    for (int i = 0; i < covar_slots; ++i)
+      if (track->c_slot_dim()[i] != c_slot_dim[i])
+        error("track covar slot %d dimension %d doesn't match data shape: %d", i + 1, track->c_slot_dim()[i], c_slot_dim[i]);
+
+    /* whole track: decodes covariates and multi-column emissions into memory */
+    return new TrackIter(*track);
+  }
+
   void fill_iterator_list(std::vector<Iter*> & iterators, SEXP emission_list, SEXP covar_list, SEXP missing_list) {
     int len = Rf_length(emission_list);
 
@@ -210,6 +245,7 @@ public:
   double * init_log_probs;
   int n_states;
   bool supports_missing;
+  Workspace workspace; // scratch memory for single threaded calls
 };
 
 FuncEntry * get_entry(std::vector<FuncEntry*> & table, const char * name) {
@@ -270,7 +306,7 @@ void process_transition_groups(TransitionTable * ttable, SEXP groups) {
 }
 
 template<typename EType>
-RQHMMData * _create_hmm_transitions(SEXP data_shape, EType * emissions, SEXP valid_transitions, SEXP transitions, SEXP transition_groups, bool with_missing, bool with_debug) {
+RQHMMData * _create_hmm_transitions(SEXP data_shape, EType * emissions, SEXP valid_transitions, SEXP transitions, SEXP transition_groups, bool with_missing, bool with_debug, bool with_scaling) {
   /* make choice about transition table */
   int n_states = Rf_length(transitions);
   bool needs_covars = false;
@@ -304,7 +340,8 @@ RQHMMData * _create_hmm_transitions(SEXP data_shape, EType * emissions, SEXP val
     
     process_transition_groups(ttable, transition_groups); 
 
-    data->hmm = HMM::create(ttable, emissions, data->init_log_probs);
+    /* scaling is ignored: per position transitions would need an exp per cell */
+    data->hmm = HMM::create(ttable, emissions, data->init_log_probs, false);
   } else {
     HomogeneousTransitions * ttable = new HomogeneousTransitions(n_states);
     
@@ -319,19 +356,20 @@ RQHMMData * _create_hmm_transitions(SEXP data_shape, EType * emissions, SEXP val
     }
     process_transition_groups(ttable, transition_groups);
 
-    data->hmm = HMM::create(ttable, emissions, data->init_log_probs);
+    data->hmm = HMM::create(ttable, emissions, data->init_log_probs, with_scaling);
   }
   
   return data;
 }
 
-RQHMMData * _create_hmm(SEXP data_shape, SEXP valid_transitions, SEXP transitions, SEXP emissions, SEXP transition_groups, SEXP emission_groups, SEXP support_missing, SEXP enable_debug) {
+RQHMMData * _create_hmm(SEXP data_shape, SEXP valid_transitions, SEXP transitions, SEXP emissions, SEXP transition_groups, SEXP emission_groups, SEXP support_missing, SEXP enable_debug, SEXP use_scaling) {
   /* make choice about emission table */
   SEXP emission_shape = VECTOR_ELT(data_shape, 0);
   int n_emissions = Rf_length(emission_shape);
   int n_states = Rf_length(transitions);
   bool with_missing = support_missing != R_NilValue && LOGICAL(support_missing)[0] == TRUE;
   bool with_debug = enable_debug != R_NilValue && LOGICAL(enable_debug)[0] == TRUE;
+  bool with_scaling = use_scaling != R_NilValue && LOGICAL(use_scaling)[0] == TRUE;
   
   if (n_emissions == 1) {
     Emissions * etable = new Emissions(n_states);
@@ -358,7 +396,7 @@ RQHMMData * _create_hmm(SEXP data_shape, SEXP valid_transitions, SEXP transition
     }
     etable->commitGroups(); // turn remaining singletons into unitary groups
     
-    return _create_hmm_transitions(data_shape, etable, valid_transitions, transitions, transition_groups, with_missing, with_debug);
+    return _create_hmm_transitions(data_shape, etable, valid_transitions, transitions, transition_groups, with_missing, with_debug, with_scaling);
   } else {
     MultiEmissions * etable = new MultiEmissions(n_states, n_emissions);
     
@@ -391,7 +429,7 @@ RQHMMData * _create_hmm(SEXP data_shape, SEXP valid_transitions, SEXP transition
     }
     etable->commitGroups(); // turn remaining singletons into unitary groups
     
-    return _create_hmm_transitions(data_shape, etable, valid_transitions, transitions, transition_groups, with_missing, with_debug);
+    return _create_hmm_transitions(data_shape, etable, valid_transitions, transitions, transition_groups, with_missing, with_debug, with_scaling);
   }
 }
 
@@ -617,6 +655,47 @@ static void REprint_exception(QHMMException & e) {
     REprintf("  # %s\n", (*it).c_str());
 }
 
+/* forward & backward for posterior computations:
+   more than two threads => intra-sequence parallel forward and backward,
+   otherwise forward and backward run side by side */
+static double _forward_backward(RQHMMData * data, Iter * iter, Iter * iterCopy, double * fw, double * bk, int n_threads) {
+  double log_lik = 0;
+
+  if (n_threads > 2) {
+    try {
+      data->hmm->forward_parallel((*iter), fw, n_threads);
+      log_lik = data->hmm->backward_parallel((*iterCopy), bk, n_threads);
+    } catch (QHMMException & e) {
+      REprint_exception(e);
+    }
+    return log_lik;
+  }
+
+  #pragma omp parallel shared(log_lik)
+  #pragma omp sections
+  {
+    #pragma omp section
+    {
+      try {
+        data->hmm->forward((*iter), fw);
+      } catch (QHMMException & e) {
+        REprint_exception(e);
+      }
+    }
+    
+    #pragma omp section
+    {
+      try {
+        log_lik = data->hmm->backward((*iterCopy), bk);
+      } catch (QHMMException & e) {
+        REprint_exception(e);
+      }
+    }
+  }
+
+  return log_lik;
+}
+
 extern "C" {
 #ifdef HAVE_VISIBILITY_ATTRIBUTE
 # define attr_hidden __attribute__ ((visibility ("hidden")))
@@ -764,8 +843,8 @@ extern "C" {
   }
   
   // TODO: add support for missing data
-  SEXP rqhmm_create_hmm(SEXP data_shape, SEXP valid_transitions, SEXP transitions, SEXP emissions, SEXP emission_groups, SEXP transition_groups, SEXP support_missing, SEXP enable_debug) {
-    RQHMMData * data = _create_hmm(data_shape, valid_transitions, transitions, emissions, transition_groups, emission_groups, support_missing, enable_debug);
+  SEXP rqhmm_create_hmm(SEXP data_shape, SEXP valid_transitions, SEXP transitions, SEXP emissions, SEXP emission_groups, SEXP transition_groups, SEXP support_missing, SEXP enable_debug, SEXP use_scaling) {
+    RQHMMData * data = _create_hmm(data_shape, valid_transitions, transitions, emissions, transition_groups, emission_groups, support_missing, enable_debug, use_scaling);
     SEXP ans;
     SEXP ptr;
     SEXP n_states;
@@ -792,7 +871,7 @@ extern "C" {
     return ans;
   }
   
-  SEXP rqhmm_forward(SEXP rqhmm, SEXP emissions, SEXP covars, SEXP missing) {
+  SEXP rqhmm_forward(SEXP rqhmm, SEXP emissions, SEXP covars, SEXP missing, SEXP n_threads) {
     SEXP result;
     RQHMMData * data;
     Iter * iter;
@@ -809,10 +888,13 @@ extern "C" {
     iter = data->create_iterator(emissions, covars, missing);
     PROTECT(result = allocMatrix(REALSXP, data->n_states, iter->length()));
     
-    /* invoke forward */
+    /* invoke forward (split across threads if more than one) */
     double log_lik;
     try {
-      log_lik = data->hmm->forward((*iter), REAL(result));
+      if (INTEGER(n_threads)[0] > 1)
+        log_lik = data->hmm->forward_parallel((*iter), REAL(result), INTEGER(n_threads)[0]);
+      else
+        log_lik = data->hmm->forward((*iter), REAL(result), NULL, &data->workspace);
     } catch (QHMMException & e) {
       REprint_exception(e);
     }
@@ -830,7 +912,7 @@ extern "C" {
     return result;
   }
   
-  SEXP rqhmm_backward(SEXP rqhmm, SEXP emissions, SEXP covars, SEXP missing) {
+  SEXP rqhmm_backward(SEXP rqhmm, SEXP emissions, SEXP covars, SEXP missing, SEXP n_threads) {
     SEXP result;
     RQHMMData * data;
     Iter * iter;
@@ -847,10 +929,13 @@ extern "C" {
     iter = data->create_iterator(emissions, covars, missing);
     PROTECT(result = allocMatrix(REALSXP, data->n_states, iter->length()));
     
-    /* invoke backward */
+    /* invoke backward (split across threads if more than one) */
     double log_lik;
     try {
-      log_lik = data->hmm->backward((*iter), REAL(result));
+      if (INTEGER(n_threads)[0] > 1)
+        log_lik = data->hmm->backward_parallel((*iter), REAL(result), INTEGER(n_threads)[0]);
+      else
+        log_lik = data->hmm->backward((*iter), REAL(result), NULL, &data->workspace);
     } catch (QHMMException & e) {
       REprint_exception(e);
     }
@@ -868,7 +953,7 @@ extern "C" {
     return result;
   }
   
-  SEXP rqhmm_viterbi(SEXP rqhmm, SEXP emissions, SEXP covars, SEXP missing) {
+  SEXP rqhmm_viterbi(SEXP rqhmm, SEXP emissions, SEXP covars, SEXP missing, SEXP online) {
     SEXP result;
     RQHMMData * data;
     Iter * iter;
@@ -886,7 +971,10 @@ extern "C" {
     
     /* invoke viterbi */
     try {
-      data->hmm->viterbi((*iter), INTEGER(result));
+      if (LOGICAL(online)[0] == TRUE)
+        data->hmm->viterbi_online((*iter), INTEGER(result), 0, &data->workspace);
+      else
+        data->hmm->viterbi((*iter), INTEGER(result), &data->workspace);
     } catch (QHMMException & e) {
       REprint_exception(e);
     }
@@ -923,7 +1011,7 @@ extern "C" {
     PROTECT(result = NEW_INTEGER(iter->length()));
     
     /* invoke stochastic backtrace (RNG init is done internally, see math.cpp) */
-    data->hmm->stochastic_backtrace((*iter), REAL(fwdmatrix), INTEGER(result));
+    data->hmm->stochastic_backtrace((*iter), REAL(fwdmatrix), INTEGER(result), &data->workspace);
 
     /* clean up */
     delete iter;
@@ -1157,7 +1245,7 @@ extern "C" {
     return result;
   }
   
-  SEXP rqhmm_posterior(SEXP rqhmm, SEXP emissions, SEXP covars, SEXP missing, SEXP n_threads) {
+  SEXP rqhmm_posterior(SEXP rqhmm, SEXP emissions, SEXP covars, SEXP missing, SEXP n_threads, SEXP checkpoint, SEXP rle) {
     SEXP result;
     RQHMMData * data;
     Iter * iter, * iterCopy;
@@ -1179,35 +1267,62 @@ extern "C" {
     /* create data structures */
     iter = data->create_iterator(emissions, covars, missing);
     iterCopy = iter->shallowCopy();
-    fw = (double*) R_alloc(data->n_states * iter->length(), sizeof(double));
-    bk = (double*) R_alloc(data->n_states * iter->length(), sizeof(double));
     PROTECT(result = allocMatrix(REALSXP, iter->length(), data->n_states));
     
-    /* invoke forward, backward and posterior */
     double log_lik = 0;
-    #pragma omp parallel shared(log_lik)
-    #pragma omp sections
-    {
-      #pragma omp section
+    if (LOGICAL(checkpoint)[0] == TRUE) {
+      /* checkpointed forward, backward and posterior */
+      FwBkCheckpoints checkpoints(data->hmm, iter->length());
+      
+      #pragma omp parallel shared(log_lik, checkpoints)
+      #pragma omp sections
       {
-        try {
-          data->hmm->forward((*iter), fw);
-        } catch (QHMMException & e) {
-          REprint_exception(e);
+        #pragma omp section
+        {
+          try {
+            log_lik = checkpoints.forward((*iter));
+          } catch (QHMMException & e) {
+            REprint_exception(e);
+          }
+        }
+        
+        #pragma omp section
+        {
+          try {
+            checkpoints.backward((*iterCopy));
+          } catch (QHMMException & e) {
+            REprint_exception(e);
+          }
         }
       }
       
-      #pragma omp section
-      {
-        try {
-          log_lik = data->hmm->backward((*iterCopy), bk);
-        } catch (QHMMException & e) {
-          REprint_exception(e);
-        }
+      try {
+        checkpoints.state_posterior((*iter), REAL(result));
+      } catch (QHMMException & e) {
+        REprint_exception(e);
+      }
+    } else if (LOGICAL(rle)[0] == TRUE) {
+      /* forward & backward over runs of identical data */
+      RunIter riter(*iter, data->supports_missing);
+      fw = (double*) R_alloc(data->n_states * riter.run_count(), sizeof(double));
+      bk = (double*) R_alloc(data->n_states * riter.run_count(), sizeof(double));
+      
+      try {
+        log_lik = data->hmm->forward_runs(riter, fw, &data->workspace);
+        data->hmm->backward_runs(riter, bk, &data->workspace);
+        data->hmm->state_posterior_runs(riter, fw, bk, REAL(result), &data->workspace);
+      } catch (QHMMException & e) {
+        REprint_exception(e);
       }
+    } else {
+      fw = (double*) R_alloc(data->n_states * iter->length(), sizeof(double));
+      bk = (double*) R_alloc(data->n_states * iter->length(), sizeof(double));
+      
+      /* invoke forward, backward and posterior */
+      log_lik = _forward_backward(data, iter, iterCopy, fw, bk, INTEGER(n_threads)[0]);
+      
+      data->hmm->state_posterior((*iter), fw, bk, REAL(result));
     }
-
-    data->hmm->state_posterior((*iter), fw, bk, REAL(result));
     
     /* clean up */
     delete iter;
@@ -1260,28 +1375,7 @@ extern "C" {
     PROTECT(result = allocMatrix(REALSXP, n_targets, iter->length() - 1));
     
     /* invoke forward, backward and posterior */
-    double log_lik = 0;
-    #pragma omp parallel shared(log_lik)
-    #pragma omp sections
-    {
-      #pragma omp section
-      {
-        try {
-          data->hmm->forward((*iter), fw);
-        } catch (QHMMException & e) {
-          REprint_exception(e);
-        }
-      }
-      
-      #pragma omp section
-      {
-        try {
-          log_lik = data->hmm->backward((*iterCopy), bk);
-        } catch (QHMMException & e) {
-          REprint_exception(e);
-        }
-      }
-    }
+    _forward_backward(data, iter, iterCopy, fw, bk, INTEGER(n_threads)[0]);
 
     /* compute local loglik */
     local_loglik = new double[iter->length()];
@@ -1293,8 +1387,8 @@ extern "C" {
     rptr = REAL(result);
     int i = 1;
     do {
-      data->hmm->transition_posterior(*iter, fw, bk, local_loglik[i],
-				      1, &sID, n_targets, rptr);
+      data->hmm->transition_posterior(*iter, fw + data->n_states * (i - 1), bk + data->n_states * i,
+				      local_loglik[i], 1, &sID, n_targets, rptr);
 
       rptr += n_targets;
       ++i;
@@ -1318,18 +1412,14 @@ extern "C" {
   }
 
   
-  SEXP rqhmm_em(SEXP rqhmm, SEXP emissions, SEXP covars, SEXP missing, SEXP tolerance, SEXP n_threads) {
+  SEXP rqhmm_em(SEXP rqhmm, SEXP emissions, SEXP covars, SEXP missing, SEXP tolerance, SEXP n_threads, SEXP checkpoint, SEXP checkpoint_length, SEXP split_length, SEXP n_batches, SEXP accelerate) {
     SEXP result;
     SEXP res_names;
     SEXP ptr;
     RQHMMData * data;
     std::vector<Iter*> iterators;
     EMResult em_result;
-
-    /* set number of threads */
-    #ifdef _OPENMP
-      omp_set_num_threads(INTEGER(n_threads)[0]);
-    #endif
+    EMOptions options(REAL(tolerance)[0]);
 
     /* retrieve rqhmm pointer */
     PROTECT(ptr = GET_ATTR(rqhmm, install("handle_ptr")));
@@ -1341,8 +1431,14 @@ extern "C" {
     data->fill_iterator_list(iterators, emissions, covars, missing);
 
     /* invoke */
+    options.checkpoint = (LOGICAL(checkpoint)[0] == TRUE);
+    options.checkpoint_length = INTEGER(checkpoint_length)[0];
+    options.n_threads = INTEGER(n_threads)[0];
+    options.split_length = INTEGER(split_length)[0];
+    options.n_batches = INTEGER(n_batches)[0];
+    options.accelerate = (LOGICAL(accelerate)[0] == TRUE);
     try {
-      em_result = data->hmm->em(iterators, REAL(tolerance)[0]);
+      em_result = data->hmm->em(iterators, options);
     } catch (QHMMException & e) {
       REprint_exception(e);
     }
@@ -1352,19 +1448,25 @@ extern "C" {
       delete iterators[i];
 
     /* prepare result */
-    PROTECT(result = NEW_LIST(2));
-    PROTECT(res_names = NEW_CHARACTER(2));
+    PROTECT(result = NEW_LIST(4));
+    PROTECT(res_names = NEW_CHARACTER(4));
 
     SET_VECTOR_ELT(result, 0, convert_dbl_vector(em_result.log_likelihood));
     SET_VECTOR_ELT(result, 1, convert_em_trace(em_result.param_trace));
+    SET_VECTOR_ELT(result, 2, convert_dbl_vector(em_result.estep_time));
+    SET_VECTOR_ELT(result, 3, convert_dbl_vector(em_result.sequence_time));
 
     SET_STRING_ELT(res_names, 0, mkChar("loglik"));
     SET_STRING_ELT(res_names, 1, mkChar("trace"));
+    SET_STRING_ELT(res_names, 2, mkChar("estep.time"));
+    SET_STRING_ELT(res_names, 3, mkChar("seq.time"));
     
     setAttrib(result, R_NamesSymbol, res_names);
 
     /* more clean up */
     delete em_result.log_likelihood;
+    delete em_result.estep_time;
+    delete em_result.sequence_time;
     HMM::delete_records(em_result.param_trace);
 
     UNPROTECT(3);
@@ -1372,6 +1474,76 @@ extern "C" {
     return result;
   }
 
+  void rqhmm_track_finalizer(SEXP ptr) {
+    TrackFile * track;
+    track = (TrackFile*) R_ExternalPtrAddr(ptr);
+    if (!track) return;
+    delete track;
+    R_ClearExternalPtr(ptr);
+  }
+
+  SEXP rqhmm_open_track(SEXP path) {
+    TrackFile * track;
+    SEXP ptr;
+
+    track = TrackFile::open(CHAR(STRING_ELT(path, 0)));
+    if (track == NULL)
+      error("failed to open track file: %s", CHAR(STRING_ELT(path, 0)));
+
+    PROTECT(ptr = R_MakeExternalPtr(track, install("RQHMM_track"), R_NilValue));
+    R_RegisterCFinalizerEx(ptr, rqhmm_track_finalizer, (Rboolean) TRUE);
+    setAttrib(ptr, R_ClassSymbol, mkString("qhmm.track"));
+
+    UNPROTECT(1);
+
+    return ptr;
+  }
+
+  SEXP rqhmm_write_track(SEXP rqhmm, SEXP path, SEXP emissions, SEXP covars, SEXP missing, SEXP e_types, SEXP c_types) {
+    RQHMMData * data;
+    Iter * iter;
+    SEXP ptr;
+
+    /* retrieve rqhmm pointer */
+    PROTECT(ptr = GET_ATTR(rqhmm, install("handle_ptr")));
+    if (ptr == R_NilValue)
+      error("invalid rqhmm object");
+    data = (RQHMMData*) R_ExternalPtrAddr(ptr);
+
+    /* validate data shape */
+    iter = data->create_iterator(emissions, covars, missing);
+    int length = iter->length();
+    delete iter;
+
+    /* column types (recycled) */
+    int n_etypes = Rf_length(e_types);
+    int n_ctypes = Rf_length(c_types);
+    if (n_etypes == 0 || (data->covar_size > 0 && n_ctypes == 0))
+      error("missing column types");
+
+    int * etypes = new int[data->emission_size];
+    int * ctypes = new int[data->covar_size];
+    for (int i = 0; i < data->emission_size; ++i)
+      etypes[i] = INTEGER(e_types)[i % n_etypes];
+    for (int i = 0; i < data->covar_size; ++i)
+      ctypes[i] = INTEGER(c_types)[i % n_ctypes];
+
+    bool ok = TrackFile::write(CHAR(STRING_ELT(path, 0)), length,
+                               data->emission_slots, data->e_slot_dim, REAL(emissions), etypes,
+                               data->covar_slots, data->c_slot_dim, (data->covar_size > 0 ? REAL(covars) : NULL), ctypes,
+                               (missing != R_NilValue ? INTEGER(missing) : NULL));
+
+    delete[] etypes;
+    delete[] ctypes;
+
+    if (!ok)
+      error("failed to write track file: %s", CHAR(STRING_ELT(path, 0)));
+
+    UNPROTECT(1);
+
+    return R_NilValue;
+  }
+
   SEXP rqhmm_get_initial_probs(SEXP rqhmm, SEXP probs) {
     RQHMMData * data;
     SEXP ptr;
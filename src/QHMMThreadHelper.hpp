@@ -21,8 +21,14 @@ public:
   }
 
   void rethrow(){
-    if(has_exception)
+    if(has_exception) {
+      has_exception = false; // don't rethrow again on destruction
       throw QHMMException(copy);
+    }
+  }
+
+  bool failed() const {
+    return has_exception;
   }
 
   void captureException(const QHMMException & other) {
@@ -46,6 +46,13 @@ public:
   
   virtual double log_probability(int target) const = 0;
   virtual double log_probability(Iter const & iter, int target) const = 0;
+  
+  // batched version: out[target] = log_probability(iter, target) for all valid targets
+  // (entries of invalid targets are left untouched)
+  virtual void log_probabilities(Iter const & iter, double * out) const {
+    for (int i = 0; i < _n_targets; ++i)
+      out[_targets[i]] = log_probability(iter, _targets[i]);
+  }
 
   int stateID() const { return _stateID; }
   int n_targets() const { return _n_targets; }
@@ -53,6 +60,9 @@ public:
 
   virtual void updateParams(EMSequences * sequences, std::vector<TransitionFunction*> * group) {}
   virtual TransitionFunction * inner() { return this; }
+  // true if updateParams can use the expected transition counts collected
+  // during the backward pass (see EMSequences::transition_counts)
+  virtual bool usesCounts() const { return false; }
 
 protected:
   const int _stateID;
@@ -124,6 +134,10 @@ public:
     return _func; 
   }
 
+  virtual bool usesCounts() const {
+    return _func->usesCounts();
+  }
+
 private:
   TransitionFunction * _func;
 };
@@ -143,17 +157,66 @@ public:
   virtual double log_probability(Iter const & iter) const = 0;
   virtual ~EmissionFunction() {};
 
+  // block version: out[i * stride] = log-probability at position
+  // iter.index() + offset + i, for i < n (iter is not moved)
+  virtual void log_probability_block(Iter const & iter, int offset, int n, double * out, int stride) const {
+    Iter cursor(iter, offset);
+    
+    for (int i = 0; i < n; ++i, cursor.next())
+      out[i * stride] = log_probability(cursor);
+  }
+
+  // batched version for evaluation plans (see EmissionPlan):
+  // out[states[i]] += funcs[i]->log_probability(iter), where all funcs
+  // have the same concrete type as this function
+  // (final types override it with batch_log_probabilities below)
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    for (int i = 0; i < n; ++i)
+      out[states[i]] += funcs[i]->log_probability(iter);
+  }
+
   int stateID() { return _stateID; }
   int slotID() { return _slotID; }
   
   virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {}
   virtual EmissionFunction * inner() { return this; }
 
+  // fused sufficient statistics (see EMSequences::collect_stats)
+  // functions with n_stats() > 0 are updated from statistics accumulated for
+  // all emissions in a single pass over the data, instead of updateParams above
+  virtual int n_stats() const { return 0; }
+  // adds the statistics for the current position, weighted by post, to stats
+  virtual void collect_stats(Iter const & iter, double post, double * stats) const {}
+  // stats: totals over all group members
+  virtual void updateParams(std::vector<EmissionFunction*> * group, const double * stats) {}
+
 protected:
   const int _stateID;
   const int _slotID;
 };
 
+// EmissionFunction::log_probabilities for concrete type T, without virtual
+// calls in the loop
+template<typename T>
+inline void batch_log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) {
+  for (int i = 0; i < n; ++i)
+    out[states[i]] += static_cast<const T*>(funcs[i])->T::log_probability(iter);
+}
+
+// EmissionFunction::log_probability_block for concrete type T: dispatches
+// once per block on the element type of slot, so that
+// T::typed_log_probability_block<E> reads the stored values directly
+template<typename T>
+inline void dispatch_log_probability_block(T const & func, int slot, Iter const & iter, int offset, int n, double * out, int stride) {
+  switch (iter.emission_type(slot)) {
+    case Iter::FLOAT32: func.template typed_log_probability_block<float>(iter, offset, n, out, stride); break;
+    case Iter::INT32: func.template typed_log_probability_block<int32_t>(iter, offset, n, out, stride); break;
+    case Iter::UINT32: func.template typed_log_probability_block<uint32_t>(iter, offset, n, out, stride); break;
+    case Iter::UINT16: func.template typed_log_probability_block<uint16_t>(iter, offset, n, out, stride); break;
+    default: func.template typed_log_probability_block<double>(iter, offset, n, out, stride);
+  }
+}
+
 class MissingEmissionFunction : public EmissionFunction {
   public:
   MissingEmissionFunction(EmissionFunction * func) : EmissionFunction(func->stateID(), func->slotID()), _func(func) {}
@@ -197,6 +260,19 @@ class MissingEmissionFunction : public EmissionFunction {
   
     virtual EmissionFunction * inner() { return _func; }
 
+    virtual int n_stats() const {
+      return _func->n_stats();
+    }
+
+    virtual void collect_stats(Iter const & iter, double post, double * stats) const {
+      if (!iter.is_missing(_slotID))
+        _func->collect_stats(iter, post, stats);
+    }
+
+    virtual void updateParams(std::vector<EmissionFunction*> * group, const double * stats) {
+      _func->updateParams(group, stats);
+    }
+
   private:
     EmissionFunction * _func;
 };
@@ -254,6 +330,26 @@ public:
   }
     
   virtual EmissionFunction * inner() { return _func; }
+
+  virtual int n_stats() const {
+    return _func->n_stats();
+  }
+
+  virtual void collect_stats(Iter const & iter, double post, double * stats) const {
+    _func->collect_stats(iter, post, stats);
+  }
+
+  virtual void updateParams(std::vector<EmissionFunction*> * group, const double * stats) {
+    _func->updateParams(group, stats);
+
+    /* check if params are still valid! */
+    Params * tmp =  _func->getParams();
+    if (tmp->anyNaN() || !_func->validParams(*tmp)) {
+      delete tmp;
+      throw QHMMException("Invalid param update", "updateParams", false, _stateID, _slotID, -1, -1);
+    }
+    delete tmp;
+  }
   
 private:
   EmissionFunction * _func;
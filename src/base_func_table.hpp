@@ -132,6 +132,10 @@ public:
     }
     
     // record valid transitions
+    // (sources are visited in increasing order, so each list is sorted)
+    for (int i = 0; i < _n_states; ++i)
+      lengths[i] = 0;
+    
     for (int i = 0; i < _n_states; ++i) {
       TransitionFunction * f_i = _funcs[i];
       int n = f_i->n_targets();
@@ -139,15 +143,11 @@ public:
       
       for (int j = 0; j < n; ++j) {
         int k = targets[j];
-        --lengths[k];
         previous[k][lengths[k]] = i;
+        ++lengths[k];
       }
     }
     
-    // sort transitions
-    for (int i = 0; i < _n_states; ++i)
-      std::sort(previous[i], previous[i] + lengths[i]);
-    
     return previous;
   }
   
@@ -170,6 +170,36 @@ public:
   
   virtual void refresh() {}
   
+  //
+  // Transition blocks: all transition probabilities at the current position
+  //
+  // log_block returns the target-major block, block[l * n_states + k] = log a_kl,
+  // so that the sources of each target are contiguous (forward/Viterbi);
+  // log_block_rows returns the source-major block, block[k * n_states + l] = log a_kl
+  // (backward). block/block_rows are the corresponding linear space versions.
+  //
+  // Tables that need to compute the block use a buffer of block_buffer_size() values
+  // prepared by init_block_buffer (one per caller/thread), as returned by
+  // new_block_buffer; tables with a cached block ignore it (size 0).
+  //
+  virtual int block_buffer_size() const = 0;
+  virtual void init_block_buffer(double * buffer, bool log_space = true) const = 0;
+  
+  double * new_block_buffer(bool log_space = true) const {
+    const int size = block_buffer_size();
+    if (size == 0)
+      return NULL;
+    
+    double * buffer = new double[size];
+    init_block_buffer(buffer, log_space);
+    return buffer;
+  }
+  
+  virtual const double * log_block(Iter const & iter, double * buffer) const = 0;
+  virtual const double * log_block_rows(Iter const & iter, double * buffer) const = 0;
+  virtual const double * block(Iter const & iter, double * buffer) const = 0;
+  virtual const double * block_rows(Iter const & iter, double * buffer) const = 0;
+  
   virtual int state_target_count(int state) const {
     return _funcs[state]->n_targets();
   }
@@ -0,0 +1,130 @@
+#include "checkpoint.hpp"
+#include "logsum.hpp"
+#include <cmath>
+#include <cstring>
+
+FwBkCheckpoints::FwBkCheckpoints(const HMM * hmm, int length, int segment_length) : _hmm(hmm), _n_states(hmm->state_count()), _length(length) {
+  _segment_length = (segment_length > 0 ? segment_length : default_segment_length(length));
+  if (_segment_length > length)
+    _segment_length = length;
+  _n_segments = (length + _segment_length - 1) / _segment_length;
+
+  _fw_checkpoints = new double[_n_states * _n_segments];
+  _bk_checkpoints = new double[_n_states * _n_segments];
+}
+
+FwBkCheckpoints::~FwBkCheckpoints() {
+  delete[] _fw_checkpoints;
+  delete[] _bk_checkpoints;
+}
+
+int FwBkCheckpoints::default_segment_length(int length) {
+  int result = (int) ceil(sqrt((double) length));
+  return (result > 0 ? result : 1);
+}
+
+double FwBkCheckpoints::forward(Iter & iter) {
+  double * matrix = new double[_n_states * _segment_length];
+  double loglik = 0;
+  Workspace workspace; /* shared by all segments */
+
+  try {
+    for (int seg = 0; seg < _n_segments; ++seg) {
+      const double * fw_prev = (seg > 0 ? forward_checkpoint(seg - 1) : NULL);
+      int last_col = segment_size(seg) - 1;
+
+      loglik = _hmm->forward_segment(iter, segment_start(seg), segment_end(seg), fw_prev, matrix, NULL, &workspace);
+      memcpy(_fw_checkpoints + seg * _n_states, matrix + last_col * _n_states, sizeof(double) * _n_states);
+    }
+  } catch (QHMMException & e) {
+    delete[] matrix;
+    e.stack.push_back("checkpointed forward");
+    throw;
+  }
+
+  delete[] matrix;
+  return loglik;
+}
+
+void FwBkCheckpoints::backward(Iter & iter) {
+  double * matrix = new double[_n_states * _segment_length];
+  Workspace workspace; /* shared by all segments */
+
+  try {
+    for (int seg = _n_segments - 1; seg >= 0; --seg) {
+      const double * bk_next = (seg < _n_segments - 1 ? backward_checkpoint(seg + 1) : NULL);
+
+      _hmm->backward_segment(iter, segment_start(seg), segment_end(seg), bk_next, matrix, NULL, &workspace);
+      memcpy(_bk_checkpoints + seg * _n_states, matrix, sizeof(double) * _n_states);
+    }
+  } catch (QHMMException & e) {
+    delete[] matrix;
+    e.stack.push_back("checkpointed backward");
+    throw;
+  }
+
+  delete[] matrix;
+}
+
+void FwBkCheckpoints::segment_forward(Iter & iter, int seg, double * matrix) const {
+  const double * fw_prev = (seg > 0 ? forward_checkpoint(seg - 1) : NULL);
+  _hmm->forward_segment(iter, segment_start(seg), segment_end(seg), fw_prev, matrix);
+}
+
+void FwBkCheckpoints::segment_backward(Iter & iter, int seg, double * matrix) const {
+  const double * bk_next = (seg < _n_segments - 1 ? backward_checkpoint(seg + 1) : NULL);
+  _hmm->backward_segment(iter, segment_start(seg), segment_end(seg), bk_next, matrix);
+}
+
+void FwBkCheckpoints::segment_posterior(int seg, const double * fw, const double * bk, double * post, double * local_loglik) const {
+  const int size = segment_size(seg);
+  LogSum * logsum = LogSum::create(_n_states);
+
+  for (int i = 0; i < size; ++i) {
+    const double * fw_i = fw + i * _n_states;
+    const double * bk_i = bk + i * _n_states;
+
+    logsum->clear();
+    for (int j = 0; j < _n_states; ++j)
+      logsum->store(fw_i[j] + bk_i[j]);
+    double logPx = logsum->compute();
+
+    if (local_loglik != NULL)
+      local_loglik[i] = logPx;
+    if (post != NULL)
+      for (int j = 0; j < _n_states; ++j)
+        post[j * size + i] = exp(fw_i[j] + bk_i[j] - logPx);
+  }
+
+  delete logsum;
+}
+
+void FwBkCheckpoints::state_posterior(Iter & iter, double * matrix) const {
+  double * fw = new double[_n_states * _segment_length];
+  double * bk = new double[_n_states * _segment_length];
+  double * post = new double[_n_states * _segment_length];
+
+  try {
+    for (int seg = 0; seg < _n_segments; ++seg) {
+      int start = segment_start(seg);
+      int size = segment_size(seg);
+
+      segment_forward(iter, seg, fw);
+      segment_backward(iter, seg, bk);
+      segment_posterior(seg, fw, bk, post);
+
+      for (int j = 0; j < _n_states; ++j)
+        memcpy(matrix + j * _length + start, post + j * size, sizeof(double) * size);
+    }
+  } catch (QHMMException & e) {
+    delete[] fw;
+    delete[] bk;
+    delete[] post;
+    e.stack.push_back("checkpointed posterior");
+    throw;
+  }
+
+  delete[] fw;
+  delete[] bk;
+  delete[] post;
+}
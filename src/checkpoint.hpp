@@ -0,0 +1,69 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "hmm.hpp"
+#include "iter.hpp"
+
+//
+// Checkpointed forward/backward.
+//
+// The sequence is split into segments of segment_length positions and only
+// the forward column at the end of each segment and the backward column at
+// the start of each segment are kept. Full columns for a segment are
+// recomputed on demand from the neighbouring checkpoints, so memory use is
+// O(n_states * (length / segment_length + segment_length)) instead of
+// O(n_states * length), at the cost of one extra forward and backward pass.
+//
+class FwBkCheckpoints {
+public:
+  // segment_length <= 0 selects ceil(sqrt(length))
+  FwBkCheckpoints(const HMM * hmm, int length, int segment_length = 0);
+  ~FwBkCheckpoints();
+
+  static int default_segment_length(int length);
+
+  // full passes, only the checkpoint columns are kept
+  // forward returns the sequence log-likelihood
+  double forward(Iter & iter);
+  void backward(Iter & iter);
+
+  // segment information
+  int segment_length() const { return _segment_length; }
+  int segment_count() const { return _n_segments; }
+  int segment_of(int index) const { return index / _segment_length; }
+  int segment_start(int seg) const { return seg * _segment_length; }
+  int segment_end(int seg) const {
+    int end = (seg + 1) * _segment_length - 1;
+    return (end < _length ? end : _length - 1);
+  }
+  int segment_size(int seg) const { return segment_end(seg) - segment_start(seg) + 1; }
+
+  // forward column at segment_end(seg), backward column at segment_start(seg)
+  const double * forward_checkpoint(int seg) const { return _fw_checkpoints + seg * _n_states; }
+  const double * backward_checkpoint(int seg) const { return _bk_checkpoints + seg * _n_states; }
+
+  // recompute the forward (backward) columns of a segment
+  // (matrix must hold n_states * segment_length values)
+  void segment_forward(Iter & iter, int seg, double * matrix) const;
+  void segment_backward(Iter & iter, int seg, double * matrix) const;
+
+  // posterior for a segment from its forward and backward columns
+  // post (optional) is filled state by state (n_states x segment_size(seg))
+  // local_loglik (optional) receives the log-likelihood at each position
+  void segment_posterior(int seg, const double * fw, const double * bk, double * post, double * local_loglik = NULL) const;
+
+  // full posterior matrix, same layout as HMM::state_posterior
+  void state_posterior(Iter & iter, double * matrix) const;
+
+private:
+  const HMM * _hmm;
+  const int _n_states;
+  const int _length;
+  int _segment_length;
+  int _n_segments;
+
+  double * _fw_checkpoints;
+  double * _bk_checkpoints;
+};
+
+#endif
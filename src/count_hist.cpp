@@ -0,0 +1,48 @@
+#include "count_hist.hpp"
+
+const int CountHistogram::DENSE_LIMIT = 1024;
+
+void CountHistogram::clear() {
+  _dense.clear();
+  _tail.clear();
+  _total = 0;
+  _sum = 0;
+  _values.clear();
+  _weights.clear();
+}
+
+void CountHistogram::merge(CountHistogram const & other) {
+  std::map<int, double>::const_iterator it;
+
+  if (other._dense.size() > _dense.size())
+    _dense.resize(other._dense.size(), 0.0);
+  for (unsigned int x = 0; x < other._dense.size(); ++x)
+    _dense[x] += other._dense[x];
+
+  for (it = other._tail.begin(); it != other._tail.end(); ++it)
+    _tail[it->first] += it->second;
+
+  _total += other._total;
+  _sum += other._sum;
+}
+
+void CountHistogram::compact() {
+  std::map<int, double>::const_iterator it;
+
+  _values.clear();
+  _weights.clear();
+
+  for (unsigned int x = 0; x < _dense.size(); ++x) {
+    if (_dense[x] != 0) {
+      _values.push_back(x);
+      _weights.push_back(_dense[x]);
+    }
+  }
+
+  for (it = _tail.begin(); it != _tail.end(); ++it) {
+    if (it->second != 0) {
+      _values.push_back(it->first);
+      _weights.push_back(it->second);
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef COUNT_HIST_HPP
+#define COUNT_HIST_HPP
+
+#include <map>
+#include <vector>
+
+//
+// Posterior weighted histogram of integer (count) observations.
+//
+// Count emissions take few distinct values, so M-steps that need several
+// passes over the data (e.g. Newton iterations) can collapse the posteriors
+// into one weight per distinct value and iterate over the histogram
+// instead. Values below DENSE_LIMIT are kept in a dense array, larger ones
+// in a sparse tail.
+//
+class CountHistogram {
+public:
+  static const int DENSE_LIMIT;
+
+  CountHistogram() : _total(0), _sum(0) {}
+
+  void clear();
+
+  void add(int x, double weight) {
+    if (x < DENSE_LIMIT) {
+      if (x >= (int) _dense.size())
+        _dense.resize(x + 1, 0.0);
+      _dense[x] += weight;
+    } else
+      _tail[x] += weight;
+    _total += weight;
+    _sum += weight * x;
+  }
+
+  // adds all weights of other
+  void merge(CountHistogram const & other);
+
+  // distinct values with non-zero weight, in increasing order
+  // (valid after compact)
+  void compact();
+  int size() const { return _values.size(); }
+  int value(int i) const { return _values[i]; }
+  double weight(int i) const { return _weights[i]; }
+
+  // sum of weights & sum of weight * x
+  double total() const { return _total; }
+  double weighted_sum() const { return _sum; }
+
+private:
+  std::vector<double> _dense;
+  std::map<int, double> _tail;
+  double _total;
+  double _sum;
+
+  std::vector<int> _values;
+  std::vector<double> _weights;
+};
+
+#endif
@@ -1,21 +1,61 @@
 #include "em_base.hpp"
 #include "em_seq.hpp"
 
+#include <algorithm>
+
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
-EMSequences::EMSequences(HMM * hmm, std::vector<Iter*> & iters) {
+const size_t EMSequences::EMISSION_CACHE_LIMIT = 512 * 1024 * 1024; // 512 MB
+
+/* orders sequence indexes by decreasing length */
+class LongerFirst {
+public:
+  LongerFirst(std::vector<Iter*> & iters) : _iters(iters) {}
+
+  bool operator()(int a, int b) const {
+    return _iters[a]->length() > _iters[b]->length();
+  }
+
+private:
+  std::vector<Iter*> & _iters;
+};
+
+EMSequences::EMSequences(HMM * hmm, std::vector<Iter*> & iters, size_t emission_cache_limit, bool checkpoint, int checkpoint_length, int split_length) {
   std::vector<Iter*>::iterator it;
+  size_t cache_left = emission_cache_limit;
   _unitarySequences = true;
+  _n_states = hmm->state_count();
+  _checkpoint = checkpoint;
+  _with_counts = false;
+  _counts = NULL;
+  _counts_dirty = true;
+  _split_length = (checkpoint ? 0 : split_length);
+  _time = 0;
 
   for (it = iters.begin(); it != iters.end(); ++it) {
-    EMSequence * seq = new EMSequence(hmm, (*it));
+    size_t cache_size = sizeof(double) * hmm->state_count() * (*it)->length();
+    bool cache_emissions = (!checkpoint && cache_size <= cache_left);
+    
+    if (cache_emissions)
+      cache_left -= cache_size;
+
+    EMSequence * seq = new EMSequence(hmm, (*it), cache_emissions, checkpoint, checkpoint_length, (checkpoint ? cache_left : 0));
     _em_seqs.push_back(seq);
+    cache_left -= std::min(cache_left, seq->segment_cache_size());
 
     if ((*it)->length() > 1)
       _unitarySequences = false;
   }
+
+  /* longest sequences first, so a long sequence doesn't start last and
+     leave the other threads idle */
+  for (unsigned int i = 0; i < iters.size(); ++i)
+    _schedule.push_back(i);
+  std::stable_sort(_schedule.begin(), _schedule.end(), LongerFirst(iters));
+
+  set_batches(1);
 }
 
 EMSequences::~EMSequences() {
@@ -23,6 +63,8 @@ EMSequences::~EMSequences() {
   
   for (it = _em_seqs.begin(); it != _em_seqs.end(); ++it)
     delete (*it);
+  if (_counts != NULL)
+    delete[] _counts;
 }
 
 PosteriorIterator * EMSequences::iterator(int state, int slot) {
@@ -33,18 +75,285 @@ TransitionPosteriorIterator * EMSequences::transition_iterator(std::vector<Trans
   return new TransitionPosteriorIterator(group, &_em_seqs);
 }
 
-double EMSequences::updateFwBk() {
-  std::vector<EMSequence*>::iterator it;
+const double * EMSequences::transition_counts() {
+  if (!_with_counts)
+    return NULL;
+
+  if (_counts_dirty) {
+    const int size = _n_states * _n_states;
+
+    if (_counts == NULL)
+      _counts = new double[size];
+    for (int i = 0; i < size; ++i)
+      _counts[i] = 0;
+
+    /* sequence order, so results don't depend on the thread schedule */
+    for (unsigned int s = 0; s < _em_seqs.size(); ++s) {
+      const double * seq_counts = _em_seqs[s]->transition_counts();
+      for (int i = 0; i < size; ++i)
+        _counts[i] += seq_counts[i];
+    }
+    _counts_dirty = false;
+  }
+
+  return _counts;
+}
+
+void EMSequences::reduce(SequenceSum & op, int n, double * result) {
+  const int n_seqs = _em_seqs.size();
+  const int chunk = 64; /* sequences per reduction step */
+  double * partial = new double[chunk * n];
+  QHMMThreadHelper helper;
+
+  for (int i = 0; i < n; ++i)
+    result[i] = 0;
+
+  /* per sequence partial sums are added in sequence order, so results
+     don't depend on the thread schedule */
+  for (int first = 0; first < n_seqs && !helper.failed(); first += chunk) {
+    int last = (first + chunk < n_seqs ? first + chunk : n_seqs);
+
+    for (int i = 0; i < (last - first) * n; ++i)
+      partial[i] = 0;
+
+#ifdef _OPENMP
+    if (omp_in_parallel()) {
+      /* called from a task (concurrent transition updates): a nested
+         parallel region would run on a single thread */
+      for (int i = first; i < last; ++i) {
+        #pragma omp task shared(op, helper, partial) firstprivate(i) untied
+        {
+          try {
+            op.add(i, partial + (i - first) * n);
+          } catch (QHMMException & e) {
+            e.sequence_id = i;
+            helper.captureException(e);
+          }
+        }
+      }
+      #pragma omp taskwait
+    } else
+#endif
+    {
+      #pragma omp parallel for schedule(dynamic, 1) shared(helper)
+      for (int i = first; i < last; ++i) {
+        try {
+          op.add(i, partial + (i - first) * n);
+        } catch (QHMMException & e) {
+          e.sequence_id = i;
+          helper.captureException(e);
+        }
+      }
+    }
+
+    for (int i = 0; i < last - first; ++i)
+      for (int j = 0; j < n; ++j)
+        result[j] += partial[i * n + j];
+  }
+
+  delete[] partial;
+  helper.rethrow();
+}
+
+class EMSequences::StatsStep : public EMSequences::SequenceSum {
+public:
+  StatsStep(std::vector<EMSequence*> & seqs, std::vector<EmissionFunction*> const & funcs, std::vector<int> const & offsets, const PosteriorSum * sum) :
+    _seqs(seqs), _funcs(funcs), _offsets(offsets), _sum(sum) {}
+
+  virtual void add(int seq, double * partial) {
+    _seqs[seq]->collect_stats(_funcs, _offsets, partial, _sum);
+  }
+
+private:
+  std::vector<EMSequence*> & _seqs;
+  std::vector<EmissionFunction*> const & _funcs;
+  std::vector<int> const & _offsets;
+  const PosteriorSum * _sum;
+};
+
+class EMSequences::TransitionStep : public EMSequences::SequenceSum {
+public:
+  TransitionStep(std::vector<EMSequence*> & seqs, std::vector<TransitionFunction*> * group, TransitionPosteriorSum const & sum) :
+    _seqs(seqs), _group(group), _sum(sum) {}
+
+  virtual void add(int seq, double * partial) {
+    /* no transitions in single position sequences */
+    if (_seqs[seq]->iter().length() < 2)
+      return;
+
+    TransitionPosteriorIterator piter(*_group, &_seqs, seq, seq + 1);
+    _sum.add(piter, partial);
+  }
+
+private:
+  std::vector<EMSequence*> & _seqs;
+  std::vector<TransitionFunction*> * _group;
+  TransitionPosteriorSum const & _sum;
+};
+
+/* adds the current position to a histogram (the sums are not used) */
+class HistogramSum : public PosteriorSum {
+public:
+  HistogramSum(CountHistogram * hist, double offset) : _hist(hist), _offset(offset) {}
+
+  virtual void add(EmissionFunction * func, Iter const & iter, double post, double * sums) const {
+    _hist->add((int) (iter.emission(func->slotID()) + _offset), post);
+  }
+
+private:
+  CountHistogram * _hist;
+  double _offset;
+};
+
+class EMSequences::HistogramStep : public EMSequences::SequenceSum {
+public:
+  HistogramStep(std::vector<EMSequence*> & seqs, std::vector<EmissionFunction*> const & funcs, double offset, std::vector<CountHistogram> & hists) :
+    _seqs(seqs), _funcs(funcs), _offsets(funcs.size(), 0), _offset(offset), _hists(hists) {}
+
+  virtual void add(int seq, double * partial) {
+    HistogramSum sum(&_hists[seq], _offset);
+    _seqs[seq]->collect_stats(_funcs, _offsets, partial, &sum);
+  }
+
+private:
+  std::vector<EMSequence*> & _seqs;
+  std::vector<EmissionFunction*> const & _funcs;
+  std::vector<int> _offsets;
+  double _offset;
+  std::vector<CountHistogram> & _hists;
+};
+
+void EMSequences::collect_stats(std::vector<EmissionFunction*> const & funcs, std::vector<int> const & offsets, int n_stats, double * stats) {
+  StatsStep op(_em_seqs, funcs, offsets, NULL);
+  reduce(op, n_stats, stats);
+}
+
+void EMSequences::posterior_sums(std::vector<EmissionFunction*> * group, PosteriorSum const & sum, int n, double * sums) {
+  std::vector<EmissionFunction*> funcs;
+  std::vector<int> offsets(group->size(), 0); /* members share the sums */
+
+  for (unsigned int i = 0; i < group->size(); ++i)
+    funcs.push_back((*group)[i]->inner());
+
+  StatsStep op(_em_seqs, funcs, offsets, &sum);
+  reduce(op, n, sums);
+}
+
+void EMSequences::count_histogram(std::vector<EmissionFunction*> * group, double offset, CountHistogram & hist) {
+  std::vector<EmissionFunction*> funcs;
+  std::vector<CountHistogram> hists(_em_seqs.size());
+
+  for (unsigned int i = 0; i < group->size(); ++i)
+    funcs.push_back((*group)[i]->inner());
+
+  HistogramStep op(_em_seqs, funcs, offset, hists);
+  reduce(op, 0, NULL);
+
+  hist.clear();
+  for (unsigned int i = 0; i < hists.size(); ++i)
+    hist.merge(hists[i]);
+  hist.compact();
+}
+
+void EMSequences::transition_sums(std::vector<TransitionFunction*> * group, TransitionPosteriorSum const & sum, int n, double * sums) {
+  TransitionStep op(_em_seqs, group, sum);
+  reduce(op, n, sums);
+}
+
+void EMSequences::update_local_loglik() {
+  const int n_seqs = _em_seqs.size();
+  QHMMThreadHelper helper;
+
+  #pragma omp parallel for schedule(dynamic, 1) shared(helper)
+  for (int i = 0; i < n_seqs; ++i) {
+    if (_em_seqs[i]->checkpoints() != NULL)
+      continue;
+
+    try {
+      _em_seqs[i]->local_loglik();
+    } catch (QHMMException & e) {
+      e.sequence_id = i;
+      helper.captureException(e);
+    }
+  }
+
+  helper.rethrow();
+}
+
+int EMSequences::set_batches(int n_batches) {
+  if (n_batches > size())
+    n_batches = size();
+  if (n_batches < 1)
+    n_batches = 1;
+  /* stale checkpointed sequences would recompute their segments under the
+     current parameters, from checkpoints computed under older ones */
+  if (n_batches > 1 && _checkpoint)
+    throw QHMMException("incremental EM needs full forward/backward matrices", "set_batches", false, -1, -1, -1, -1);
+  _n_batches = n_batches;
+  _last_batch = -1;
+
+  _batch_of.assign(_em_seqs.size(), 0);
+  for (unsigned int k = 0; k < _schedule.size(); ++k)
+    _batch_of[_schedule[k]] = k % n_batches;
+
+  return n_batches;
+}
+
+double EMSequences::updateFwBk(bool with_counts, int batch) {
   double loglik = 0;
+  double start = EMSequence::wall_time();
+  unsigned int first_task = 0;
   QHMMThreadHelper helper;
 
-  #pragma omp parallel shared(helper, loglik)
+  _with_counts = with_counts && !_checkpoint;
+  _counts_dirty = true;
+  _last_batch = batch;
+
+#ifdef _OPENMP
+  /* sequences above the split length, one at a time using all threads */
+  int n_threads = omp_get_max_threads();
+
+  if (_split_length > 0 && n_threads > 1) {
+    for (; first_task < _schedule.size(); ++first_task) {
+      int i = _schedule[first_task];
+
+      if (_em_seqs[i]->iter().length() <= _split_length)
+        break;
+      if (batch >= 0 && _batch_of[i] != batch)
+        continue;
+
+      try {
+        _em_seqs[i]->updateFwBkSplit(n_threads, _with_counts);
+      } catch (QHMMException & e) {
+        e.sequence_id = i;
+        throw;
+      }
+    }
+  }
+#endif
+
+  #pragma omp parallel shared(helper)
   {
     #pragma omp single
-    for (unsigned int i = 0; i < _em_seqs.size(); ++i)
-      (_em_seqs[i])->updateFwBk(i, helper, loglik);
+    for (unsigned int k = first_task; k < _schedule.size(); ++k) {
+      int i = _schedule[k];
+      if (batch < 0 || _batch_of[i] == batch)
+        (_em_seqs[i])->updateFwBk(i, helper, _with_counts);
+    }
   }
+  helper.rethrow();
+  _time = EMSequence::wall_time() - start;
+
+  /* sequence order, so the sum doesn't depend on the thread schedule
+     (sequences outside the batch contribute their last log-likelihood) */
+  for (unsigned int i = 0; i < _em_seqs.size(); ++i)
+    loglik += _em_seqs[i]->loglik();
 
-  // helper will rethrow exceptions on exit
   return loglik;
 }
+
+double EMSequences::time(int i) const {
+  if (_last_batch >= 0 && _batch_of[i] != _last_batch)
+    return 0;
+  return _em_seqs[i]->time();
+}
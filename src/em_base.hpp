@@ -2,16 +2,43 @@
 #define EM_BASE_HPP
 
 #include <vector>
+#include <cstddef>
 
 class HMM;
 class EMSequence;
 
 #include "post_iter.hpp"
 #include "trans_post_iter.hpp"
+#include "count_hist.hpp"
+
+// Posterior weighted sums for emission updateParams (see EMSequences::posterior_sums)
+class PosteriorSum {
+public:
+  virtual ~PosteriorSum() {}
+  // adds the contribution of the current position of iter (with posterior
+  // post for func's state) to sums
+  virtual void add(EmissionFunction * func, Iter const & iter, double post, double * sums) const = 0;
+};
+
+// Posterior transition sums for transition updateParams (see EMSequences::transition_sums)
+class TransitionPosteriorSum {
+public:
+  virtual ~TransitionPosteriorSum() {}
+  // adds the contribution of all positions of piter (a single sequence) to sums
+  virtual void add(TransitionPosteriorIterator & piter, double * sums) const = 0;
+};
 
 class EMSequences {
 public:
-  EMSequences(HMM * hmm, std::vector<Iter*> & iters);
+  // memory budget (in bytes) for the per sequence emission matrices
+  // (sequences beyond the budget re-evaluate emissions on each pass)
+  static const size_t EMISSION_CACHE_LIMIT;
+
+  // checkpoint: use checkpointed forward/backward (no emission cache, the
+  //             budget holds recomputed segments instead)
+  // split_length: sequences longer than this have their forward/backward
+  //               split across all threads (0 = never, ignored when checkpointed)
+  EMSequences(HMM * hmm, std::vector<Iter*> & iters, size_t emission_cache_limit = EMISSION_CACHE_LIMIT, bool checkpoint = false, int checkpoint_length = 0, int split_length = 0);
   ~EMSequences();
 
   PosteriorIterator * iterator(int state, int slot);
@@ -19,13 +46,88 @@ public:
   TransitionPosteriorIterator * transition_iterator(std::vector<TransitionFunction*> & group);
   
   // returns sequence set log-likelihood
-  double updateFwBk();
+  // with_counts: collect the expected transition counts during the backward pass
+  //              (ignored for checkpointed sequences)
+  // sequences are scheduled longest first
+  // batch: only refresh the sequences in this batch (see set_batches), the
+  //        others keep the forward/backward, log-likelihood and counts of
+  //        their last refresh (-1 = all sequences)
+  double updateFwBk(bool with_counts = false, int batch = -1);
+  
+  // incremental EM: splits the sequences into n_batches batches of similar
+  // total length (round robin over the longest first order)
+  // returns the number of batches (at most size())
+  // stale sequences only keep valid posteriors and transition counts, so
+  // throws for checkpointed sequences (and the transition updates must use
+  // the counts, see HMM::em)
+  int set_batches(int n_batches);
+  int batch_count() const { return _n_batches; }
+  
+  int size() const { return _em_seqs.size(); }
+  // wall time (seconds) of the last updateFwBk
+  double time() const { return _time; }
+  // forward/backward time (seconds) of sequence i in the last updateFwBk
+  // (0 if not refreshed)
+  double time(int i) const;
+  
+  // expected transition counts summed over all sequences (n_states x n_states,
+  // counts[k * n_states + l] for k -> l), NULL if not collected by the last updateFwBk
+  const double * transition_counts();
+  
+  // fused sufficient statistics: a single pass over the posteriors and data of
+  // each sequence (sequences in parallel) adds funcs[i]->collect_stats to
+  // stats + offsets[i] for all positions of funcs[i]'s state & slot
+  // stats holds n_stats values and is overwritten with the totals
+  void collect_stats(std::vector<EmissionFunction*> const & funcs, std::vector<int> const & offsets, int n_stats, double * stats);
+  
+  // parallel posterior scans for updateParams: sum.add is called for all
+  // positions of each group member's state & slot (transition_sums: for each
+  // sequence with at least one transition), sums holds n values and is
+  // overwritten with the totals
+  // (per sequence partial sums are added in sequence order, so results don't
+  //  depend on the number of threads)
+  void posterior_sums(std::vector<EmissionFunction*> * group, PosteriorSum const & sum, int n, double * sums);
+  void transition_sums(std::vector<TransitionFunction*> * group, TransitionPosteriorSum const & sum, int n, double * sums);
+  
+  // posterior weighted histogram of (int) (emission + offset) over all
+  // positions of each group member's state & slot (hist is overwritten and
+  // compacted, per sequence histograms are merged in sequence order)
+  void count_histogram(std::vector<EmissionFunction*> * group, double offset, CountHistogram & hist);
+  
+  // compute the local log-likelihoods used by TransitionPosteriorIterator
+  // ahead of time, so concurrent transition updates only read them
+  void update_local_loglik();
   
   bool unitarySequences() { return _unitarySequences; }
 
 private:
+  // per sequence step of reduce
+  class SequenceSum {
+  public:
+    virtual ~SequenceSum() {}
+    virtual void add(int seq, double * partial) = 0;
+  };
+  
+  class StatsStep;
+  class TransitionStep;
+  class HistogramStep;
+  
+  // sums op over all sequences into result (n values)
+  void reduce(SequenceSum & op, int n, double * result);
+  
   bool _unitarySequences;
   std::vector<EMSequence*> _em_seqs;
+  std::vector<int> _schedule; // sequence indexes, longest first
+  std::vector<int> _batch_of; // batch of each sequence
+  int _n_batches;
+  int _last_batch;
+  int _split_length;
+  double _time;
+  int _n_states;
+  bool _checkpoint;
+  bool _with_counts;
+  double * _counts; // sum over sequences (NULL until needed)
+  bool _counts_dirty;
 };
 
 #endif
@@ -1,31 +1,78 @@
 #include "em_seq.hpp"
+#include "em_base.hpp"
+
+#include <cstring>
+#include <ctime>
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
-EMSequence::EMSequence(HMM * hmm, Iter * iter) {
+double EMSequence::wall_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* doubles per segment cache slot: fw, bk & posterior columns, local log-likelihood */
+static size_t segment_slot_size(int n_states, int segment_length) {
+  return (size_t) (3 * n_states + 1) * segment_length;
+}
+
+EMSequence::EMSequence(HMM * hmm, Iter * iter, bool cache_emissions, bool checkpoint, int checkpoint_length, size_t segment_cache_limit) {
   /* keep pointer to main iterator and HMM */
   _iter = iter;
   _iterCopy = iter->shallowCopy();
   _hmm = hmm;
   
+  /* checkpointed forward/backward */
+  int max_subiter_length = 0;
+  _checkpoints = NULL;
+  _seg_slots = 0;
+  _seg_cached = NULL;
+  _seg_cache = NULL; /* only allocate on first use */
+  if (checkpoint) {
+    _checkpoints = new FwBkCheckpoints(hmm, iter->length(), checkpoint_length);
+    max_subiter_length = _checkpoints->segment_length(); /* sub-iterators can't cross segments */
+    
+    size_t slot_bytes = sizeof(double) * segment_slot_size(hmm->state_count(), _checkpoints->segment_length());
+    size_t slots = segment_cache_limit / slot_bytes;
+    _seg_slots = (slots < 1 ? 1 : (slots < (size_t) _checkpoints->segment_count() ? (int) slots : _checkpoints->segment_count()));
+    _seg_cached = new int[_seg_slots];
+    for (int i = 0; i < _seg_slots; ++i)
+      _seg_cached[i] = -1;
+  }
+  
   /* initialize sub-iterators */
   int n_slots = iter->emission_slot_count();
   
   _slot_subiters = new std::vector<std::vector<Iter>* >();
   for (int i = 0; i < n_slots; ++i)
-    _slot_subiters->push_back(iter->sub_iterators(i));
+    _slot_subiters->push_back(iter->sub_iterators(i, max_subiter_length));
   
   /* allocate space for forward, backward */
   int n_states = hmm->state_count();
-  _forward = new double[n_states * iter->length()];
-  _backward = new double[n_states * iter->length()];
+  if (checkpoint) {
+    _forward = NULL;
+    _backward = NULL;
+    _emissions = NULL;
+  } else {
+    _forward = new double[n_states * iter->length()];
+    _backward = new double[n_states * iter->length()];
+    _emissions = (cache_emissions ? new double[n_states * iter->length()] : NULL);
+  }
   
   _posterior = NULL; /* only allocate posterior on first use */
   _posterior_dirty = true; /* needs update */
   _local_loglik = NULL; /* only allocate on first use */
   _local_loglik_dirty = true; /* needs update */
+  _counts = NULL; /* only allocate on first use */
+  _with_counts = false;
+  _loglik = 0;
+  _fw_time = 0;
+  _bk_time = 0;
 }
 
 EMSequence::~EMSequence() {
@@ -34,34 +81,96 @@ EMSequence::~EMSequence() {
     delete (*_slot_subiters)[i];
   delete _slot_subiters;
   
-  delete[] _forward;
-  delete[] _backward;
+  if (_checkpoints != NULL) {
+    delete _checkpoints;
+    delete[] _seg_cached;
+    if (_seg_cache != NULL)
+      delete[] _seg_cache;
+  }
+  if (_forward != NULL)
+    delete[] _forward;
+  if (_backward != NULL)
+    delete[] _backward;
+  if (_emissions != NULL)
+    delete[] _emissions;
   if (_posterior != NULL)
     delete[] _posterior;
   if (_local_loglik != NULL)
     delete[] _local_loglik;
+  if (_counts != NULL)
+    delete[] _counts;
+}
+
+void EMSequence::updateFwBk(int seq_id, QHMMThreadHelper & helper, bool with_counts) {
+  _fw_time = 0;
+  _bk_time = 0;
+
+  if (_checkpoints != NULL) {
+    for (int i = 0; i < _seg_slots; ++i)
+      _seg_cached[i] = -1;
+    checkpoint_tasks(seq_id, helper);
+    return;
+  }
+
+  _with_counts = with_counts;
+  if (_with_counts && _counts == NULL) {
+    int n_states = _hmm->state_count();
+    _counts = new double[n_states * n_states];
+  }
+
+  if (_emissions == NULL) {
+    fwbk_tasks(seq_id, helper);
+    return;
+  }
+
+  /* emissions are evaluated once and shared by forward & backward */
+  #pragma omp task shared(helper) untied
+  {
+    bool ok = true;
+    double start = wall_time();
+
+    try {
+      _hmm->emission_matrix(*_iter, _emissions);
+    } catch (QHMMException & e) {
+      e.sequence_id = seq_id;
+      helper.captureException(e);
+      ok = false;
+    }
+    _fw_time = wall_time() - start;
+
+    if (ok)
+      fwbk_tasks(seq_id, helper);
+  }
 }
 
-void EMSequence::updateFwBk(int seq_id, QHMMThreadHelper & helper, double & loglik) {
+void EMSequence::fwbk_tasks(int seq_id, QHMMThreadHelper & helper) {
+  if (_with_counts) {
+    counts_task(seq_id, helper);
+    return;
+  }
+
   #pragma omp task shared(helper) untied
   {
+    double start = wall_time();
     try {
-      _hmm->forward(*_iter, _forward);
+      _hmm->forward(*_iter, _forward, _emissions, &_fw_workspace);
     } catch (QHMMException & e) {
       e.sequence_id = seq_id;
       helper.captureException(e);
     }
+    _fw_time += wall_time() - start;
   }
  
-  #pragma omp task shared(helper, loglik) untied
+  #pragma omp task shared(helper) untied
   {
+    double start = wall_time();
     try {
-      #pragma omp critical
-      loglik += _hmm->backward(*_iterCopy, _backward);
+      _loglik = _hmm->backward(*_iterCopy, _backward, _emissions, &_bk_workspace);
     } catch (QHMMException & e) {
       e.sequence_id = seq_id;
       helper.captureException(e);
     }
+    _bk_time = wall_time() - start;
     // ideally should check both logliks are equal
 
     /* we don't update the posterior here just in case all emissions
@@ -72,7 +181,158 @@ void EMSequence::updateFwBk(int seq_id, QHMMThreadHelper & helper, double & logl
   }
 }
 
+void EMSequence::counts_task(int seq_id, QHMMThreadHelper & helper) {
+  /* transition counts need the complete forward matrix during the backward pass */
+  #pragma omp task shared(helper) untied
+  {
+    int n_states = _hmm->state_count();
+    
+    for (int i = 0; i < n_states * n_states; ++i)
+      _counts[i] = 0;
+    
+    double start = wall_time();
+    try {
+      _hmm->forward(*_iter, _forward, _emissions, &_fw_workspace);
+      _fw_time += wall_time() - start;
+      start = wall_time();
+      _loglik = _hmm->backward_counts(*_iterCopy, _forward, _backward, _counts, _emissions, &_bk_workspace);
+      _bk_time = wall_time() - start;
+    } catch (QHMMException & e) {
+      e.sequence_id = seq_id;
+      helper.captureException(e);
+    }
+    
+    _posterior_dirty = true; /* needs update */
+    _local_loglik_dirty = true; /* needs update */
+  }
+}
+
+void EMSequence::checkpoint_tasks(int seq_id, QHMMThreadHelper & helper) {
+  #pragma omp task shared(helper) untied
+  {
+    double start = wall_time();
+    try {
+      _loglik = _checkpoints->forward(*_iter);
+    } catch (QHMMException & e) {
+      e.sequence_id = seq_id;
+      helper.captureException(e);
+    }
+    _fw_time = wall_time() - start;
+  }
+
+  #pragma omp task shared(helper) untied
+  {
+    double start = wall_time();
+    try {
+      _checkpoints->backward(*_iterCopy);
+    } catch (QHMMException & e) {
+      e.sequence_id = seq_id;
+      helper.captureException(e);
+    }
+    _bk_time = wall_time() - start;
+  }
+}
+
+void EMSequence::updateFwBkSplit(int n_threads, bool with_counts) {
+  double start = wall_time();
+
+  _fw_time = 0;
+  _bk_time = 0;
+
+  _with_counts = with_counts;
+  if (_with_counts && _counts == NULL) {
+    int n_states = _hmm->state_count();
+    _counts = new double[n_states * n_states];
+  }
+
+  if (_emissions != NULL)
+    _hmm->emission_matrix(*_iter, _emissions);
+  _hmm->forward_parallel(*_iter, _forward, n_threads, _emissions);
+  _fw_time = wall_time() - start;
+
+  start = wall_time();
+  if (_with_counts) {
+    /* transition counts need the sequential backward pass */
+    int n_states = _hmm->state_count();
+
+    for (int i = 0; i < n_states * n_states; ++i)
+      _counts[i] = 0;
+    _loglik = _hmm->backward_counts(*_iterCopy, _forward, _backward, _counts, _emissions, &_bk_workspace);
+  } else
+    _loglik = _hmm->backward_parallel(*_iterCopy, _backward, n_threads, _emissions);
+  _bk_time = wall_time() - start;
+
+  _posterior_dirty = true; /* needs update */
+  _local_loglik_dirty = true; /* needs update */
+}
+
+size_t EMSequence::segment_cache_size() const {
+  if (_checkpoints == NULL)
+    return 0;
+  return sizeof(double) * _seg_slots * segment_slot_size(_hmm->state_count(), _checkpoints->segment_length());
+}
+
+/* copies the requested parts of a segment cache slot */
+static void copy_segment(const double * slot, int n_states, int seg_length, int size, double * fw, double * bk, double * post, double * local_loglik) {
+  const size_t n = (size_t) n_states * seg_length;
+  
+  if (fw != NULL)
+    memcpy(fw, slot, sizeof(double) * n_states * size);
+  if (bk != NULL)
+    memcpy(bk, slot + n, sizeof(double) * n_states * size);
+  if (post != NULL)
+    memcpy(post, slot + 2 * n, sizeof(double) * n_states * size);
+  if (local_loglik != NULL)
+    memcpy(local_loglik, slot + 3 * n, sizeof(double) * size);
+}
+
+void EMSequence::segment(Iter & iter, int seg, double * fw, double * bk, double * post, double * local_loglik) {
+  const int n_states = _hmm->state_count();
+  const int seg_length = _checkpoints->segment_length();
+  const int size = _checkpoints->segment_size(seg);
+  const size_t slot_size = segment_slot_size(n_states, seg_length);
+  const size_t n = (size_t) n_states * seg_length;
+  const int slot = seg % _seg_slots;
+  bool hit = false;
+  
+  /* concurrent iterators (transition updates) share the cache */
+  #pragma omp critical(qhmm_segment_cache)
+  {
+    if (_seg_cache == NULL)
+      _seg_cache = new double[_seg_slots * slot_size];
+    if (_seg_cached[slot] == seg) {
+      copy_segment(_seg_cache + slot * slot_size, n_states, seg_length, size, fw, bk, post, local_loglik);
+      hit = true;
+    }
+  }
+  if (hit)
+    return;
+  
+  /* recompute outside the lock */
+  double * buffer = new double[slot_size];
+  try {
+    _checkpoints->segment_forward(iter, seg, buffer);
+    _checkpoints->segment_backward(iter, seg, buffer + n);
+    _checkpoints->segment_posterior(seg, buffer, buffer + n, buffer + 2 * n, buffer + 3 * n);
+  } catch (QHMMException & e) {
+    delete[] buffer;
+    throw;
+  }
+  copy_segment(buffer, n_states, seg_length, size, fw, bk, post, local_loglik);
+  
+  #pragma omp critical(qhmm_segment_cache)
+  {
+    memcpy(_seg_cache + slot * slot_size, buffer, sizeof(double) * slot_size);
+    _seg_cached[slot] = seg;
+  }
+  delete[] buffer;
+}
+
 void EMSequence::update_posterior() {
+  /* checkpointed sequences compute posteriors per segment (see PosteriorIterator) */
+  if (_checkpoints != NULL)
+    return;
+
   /* update posterior if needed */
   if (_posterior_dirty) {
     /* allocate posterior if needed */
@@ -97,3 +357,85 @@ const double * EMSequence::local_loglik() {
   
   return _local_loglik;
 }
+
+void EMSequence::collect_stats(std::vector<EmissionFunction*> const & funcs, std::vector<int> const & offsets, double * stats, const PosteriorSum * sum) {
+  const int n_slots = _slot_subiters->size();
+  const int n_states = _hmm->state_count();
+  double * seg_post = NULL;
+  Iter * seg_iter = NULL;
+  int seg = -1, seg_start = 0, seg_size = 0;
+  std::vector<int> slot_funcs;
+
+  update_posterior();
+
+  if (_checkpoints != NULL) {
+    seg_post = new double[n_states * _checkpoints->segment_length()];
+    seg_iter = _iter->shallowCopy();
+  }
+
+  try {
+    for (int slot = 0; slot < n_slots; ++slot) {
+      /* functions on this slot */
+      slot_funcs.clear();
+      for (unsigned int f = 0; f < funcs.size(); ++f)
+        if (funcs[f]->slotID() == slot)
+          slot_funcs.push_back(f);
+      if (slot_funcs.empty())
+        continue;
+
+      std::vector<Iter> * subiters = (*_slot_subiters)[slot];
+      std::vector<Iter>::iterator it;
+
+      for (it = subiters->begin(); it != subiters->end(); ++it) {
+        Iter & iter = *it;
+        const double * post;
+        int post_step; /* distance between states */
+
+        if (_checkpoints == NULL) {
+          post = _posterior + iter.iter_offset();
+          post_step = _iter->length();
+        } else {
+          /* sub-iterators never cross segment boundaries */
+          int iter_seg = _checkpoints->segment_of(iter.iter_offset());
+          if (iter_seg != seg) {
+            seg = iter_seg;
+            seg_start = _checkpoints->segment_start(seg);
+            seg_size = _checkpoints->segment_size(seg);
+            segment(*seg_iter, seg, NULL, NULL, seg_post, NULL);
+          }
+          post = seg_post + (iter.iter_offset() - seg_start);
+          post_step = seg_size;
+        }
+
+        iter.resetFirst();
+        if (sum == NULL) {
+          for (int j = 0; j < iter.length(); iter.next(), ++j) {
+            for (unsigned int k = 0; k < slot_funcs.size(); ++k) {
+              EmissionFunction * func = funcs[slot_funcs[k]];
+              func->collect_stats(iter, post[func->stateID() * post_step + j], stats + offsets[slot_funcs[k]]);
+            }
+          }
+        } else {
+          for (int j = 0; j < iter.length(); iter.next(), ++j) {
+            for (unsigned int k = 0; k < slot_funcs.size(); ++k) {
+              EmissionFunction * func = funcs[slot_funcs[k]];
+              sum->add(func, iter, post[func->stateID() * post_step + j], stats + offsets[slot_funcs[k]]);
+            }
+          }
+        }
+      }
+    }
+  } catch (QHMMException & e) {
+    if (seg_iter != NULL) {
+      delete seg_iter;
+      delete[] seg_post;
+    }
+    e.stack.push_back("collect_stats");
+    throw;
+  }
+
+  if (seg_iter != NULL) {
+    delete seg_iter;
+    delete[] seg_post;
+  }
+}
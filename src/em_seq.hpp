@@ -4,24 +4,56 @@
 #include "QHMMThreadHelper.hpp"
 #include "hmm.hpp"
 #include "iter.hpp"
+#include "checkpoint.hpp"
 #include <vector>
 
 class PosteriorIterator;
+class PosteriorSum;
 
 class EMSequence {
 public:
-  EMSequence(HMM * hmm, Iter * iter);
+  // cache_emissions: keep a precomputed emission matrix (n_states x length)
+  // checkpoint: keep only forward/backward checkpoints (see FwBkCheckpoints),
+  //             checkpoint_length <= 0 selects the default segment length
+  // segment_cache_limit: memory budget (in bytes) for recomputed checkpoint
+  //                      segments (at least one segment is always kept)
+  EMSequence(HMM * hmm, Iter * iter, bool cache_emissions = false, bool checkpoint = false, int checkpoint_length = 0, size_t segment_cache_limit = 0);
   ~EMSequence();
   
-  // returns sequence log-likelihood
-  void updateFwBk(int seq_id, QHMMThreadHelper & helper, double & loglik);
+  // creates the forward/backward tasks for this sequence, the sequence
+  // log-likelihood is available from loglik() once they complete
+  // with_counts: also collect the expected transition counts (not for checkpointed sequences)
+  void updateFwBk(int seq_id, QHMMThreadHelper & helper, bool with_counts = false);
+  
+  // same, but for a single long sequence: forward and backward are each split
+  // across n_threads (see HMM::forward_parallel), must not be called from
+  // inside a parallel region and not for checkpointed sequences
+  void updateFwBkSplit(int n_threads, bool with_counts = false);
   
   // accessors
-  const double * forward() { return _forward; }
-  const double * backward() { return _backward; }
+  const double * forward() { return _forward; } // NULL if checkpointed
+  const double * backward() { return _backward; } // NULL if checkpointed
+  const FwBkCheckpoints * checkpoints() { return _checkpoints; } // NULL if not checkpointed
+  const double * emissions() { return _emissions; } // NULL if not cached
   Iter & iter() { return *_iter; }
   const HMM * hmm() { return _hmm; }
   const double * local_loglik();
+  const double * transition_counts() { return (_with_counts ? _counts : NULL); } // n_states x n_states
+  double loglik() const { return _loglik; } // from the last updateFwBk
+  double time() const { return _fw_time + _bk_time; } // seconds spent in the last updateFwBk
+  
+  static double wall_time(); // seconds
+  
+  // checkpointed sequences: forward, backward, posterior (state by state) and
+  // local log-likelihood of segment seg (NULL buffers are skipped)
+  // recomputed segments are shared by all posterior iterators until the next
+  // updateFwBk; iter: private copy used for the recomputation
+  void segment(Iter & iter, int seg, double * fw, double * bk, double * post, double * local_loglik);
+  size_t segment_cache_size() const; // bytes
+  
+  // see EMSequences::collect_stats
+  // sum: if not NULL, sum->add is used instead of funcs[i]->collect_stats (see EMSequences::posterior_sums)
+  void collect_stats(std::vector<EmissionFunction*> const & funcs, std::vector<int> const & offsets, double * stats, const PosteriorSum * sum = NULL);
   
   friend class PosteriorIterator;
   
@@ -33,13 +65,30 @@ private:
   bool _posterior_dirty;
   double * _forward;
   double * _backward;
+  double * _emissions;
   double * _posterior;
+  FwBkCheckpoints * _checkpoints;
+  int _seg_slots; // segment cache (direct mapped)
+  int * _seg_cached; // segment in each slot (-1 = none)
+  double * _seg_cache; // fw, bk, posterior and local log-likelihood per slot
+  Workspace _fw_workspace; // scratch memory, reused across EM iterations
+  Workspace _bk_workspace;
   std::vector<std::vector<Iter>* > * _slot_subiters;
   
   void update_posterior();
+  void fwbk_tasks(int seq_id, QHMMThreadHelper & helper);
+  void checkpoint_tasks(int seq_id, QHMMThreadHelper & helper);
+  void counts_task(int seq_id, QHMMThreadHelper & helper);
   
   bool _local_loglik_dirty;
   double * _local_loglik;
+  
+  bool _with_counts;
+  double * _counts;
+  
+  double _loglik;
+  double _fw_time; // forward task (including the emission matrix)
+  double _bk_time; // backward task
 };
 
 #endif
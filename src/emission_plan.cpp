@@ -0,0 +1,137 @@
+#include "emission_plan.hpp"
+#include <algorithm>
+#include <map>
+#include <typeinfo>
+
+struct PlanEntry {
+  int slot;
+  int missing_slot;
+  const std::type_info * type;
+  int group;
+  int state;
+  EmissionFunction * func;
+
+  bool same_run(PlanEntry const & other) const {
+    return slot == other.slot && missing_slot == other.missing_slot && *type == *(other.type);
+  }
+};
+
+struct PlanOrder {
+  bool operator() (PlanEntry const & a, PlanEntry const & b) const {
+    if (a.slot != b.slot)
+      return a.slot < b.slot;
+    if (a.missing_slot != b.missing_slot)
+      return a.missing_slot < b.missing_slot;
+    if (*(a.type) != *(b.type))
+      return a.type->before(*(b.type));
+    if (a.group != b.group)
+      return a.group < b.group;
+    return a.state < b.state;
+  }
+};
+
+EmissionPlan::EmissionPlan(int n_states, std::vector<std::vector<EmissionFunction*> > const & funcs,
+                           std::vector<std::vector<EmissionFunction*> > const & groups) : _n_states(n_states), _missing_aware(true) {
+  std::map<EmissionFunction*, int> group_of;
+  std::vector<PlanEntry> entries;
+
+  for (unsigned int g = 0; g < groups.size(); ++g)
+    for (unsigned int j = 0; j < groups[g].size(); ++j)
+      group_of[groups[g][j]] = g;
+
+  for (unsigned int k = 0; k < funcs.size(); ++k) {
+    for (unsigned int slot = 0; slot < funcs[k].size(); ++slot) {
+      EmissionFunction * func = funcs[k][slot];
+      PlanEntry entry;
+      std::map<EmissionFunction*, int>::const_iterator it = group_of.find(func);
+
+      entry.slot = slot;
+      entry.missing_slot = -1;
+      entry.group = (it != group_of.end() ? it->second : -1);
+      entry.state = k;
+      if (dynamic_cast<MissingEmissionFunction*>(func) != NULL) {
+        entry.missing_slot = func->slotID();
+        func = func->inner();
+      } else
+        _missing_aware = false;
+      entry.func = func;
+      entry.type = &typeid(*func);
+
+      entries.push_back(entry);
+    }
+  }
+
+  std::stable_sort(entries.begin(), entries.end(), PlanOrder());
+
+  for (unsigned int i = 0; i < entries.size(); ++i) {
+    if (i == 0 || !entries[i].same_run(entries[i - 1])) {
+      Run run;
+      run.start = i;
+      run.length = 0;
+      run.slot = entries[i].slot;
+      run.missing_slot = entries[i].missing_slot;
+      _runs.push_back(run);
+    }
+    ++(_runs.back().length);
+
+    _funcs.push_back(entries[i].func);
+    _states.push_back(entries[i].state);
+  }
+}
+
+void EmissionPlan::log_probability_block(Iter const & iter, int offset, int n, double * out) const {
+  double values[BLOCK_LENGTH];
+  int seg_start[BLOCK_LENGTH];
+  int seg_length[BLOCK_LENGTH];
+  const int first_slot = (_runs.empty() ? 0 : _runs[0].slot);
+
+  for (int first = 0; first < n; first += BLOCK_LENGTH) {
+    const int length = (n - first < BLOCK_LENGTH ? n - first : BLOCK_LENGTH);
+    double * out_first = out + first * _n_states;
+
+    for (unsigned int r = 0; r < _runs.size(); ++r) {
+      Run const & run = _runs[r];
+      const bool add = (run.slot != first_slot); /* later slots add to the first one */
+      int n_segs = 0;
+
+      /* segments without missing data */
+      if (run.missing_slot < 0) {
+        seg_start[0] = 0;
+        seg_length[0] = length;
+        n_segs = 1;
+      } else {
+        for (int i = 0; i < length; ++i) {
+          if (iter.is_missing_ext(run.missing_slot, offset + first + i))
+            continue;
+          if (n_segs > 0 && seg_start[n_segs - 1] + seg_length[n_segs - 1] == i)
+            ++seg_length[n_segs - 1];
+          else {
+            seg_start[n_segs] = i;
+            seg_length[n_segs] = 1;
+            ++n_segs;
+          }
+        }
+      }
+
+      for (int e = run.start; e < run.start + run.length; ++e) {
+        EmissionFunction * func = _funcs[e];
+        double * out_e = out_first + _states[e];
+
+        if (!add) {
+          if (n_segs != 1 || seg_length[0] != length)
+            for (int i = 0; i < length; ++i)
+              out_e[i * _n_states] = 0; /* log(1) */
+
+          for (int s = 0; s < n_segs; ++s)
+            func->log_probability_block(iter, offset + first + seg_start[s], seg_length[s], out_e + seg_start[s] * _n_states, _n_states);
+        } else {
+          for (int s = 0; s < n_segs; ++s) {
+            func->log_probability_block(iter, offset + first + seg_start[s], seg_length[s], values, 1);
+            for (int i = 0; i < seg_length[s]; ++i)
+              out_e[(seg_start[s] + i) * _n_states] += values[i];
+          }
+        }
+      }
+    }
+  }
+}
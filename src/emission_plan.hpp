@@ -0,0 +1,69 @@
+#ifndef EMISSION_PLAN_HPP
+#define EMISSION_PLAN_HPP
+
+#include <vector>
+#include "base_classes.hpp"
+
+//
+// Compiled emission evaluation plan.
+//
+// The (state, slot) functions of an emission table are unwrapped from their
+// MissingEmissionFunction wrappers and ordered by slot, concrete type and
+// parameter group. Each run of functions with the same slot and type is
+// evaluated by a single EmissionFunction::log_probabilities call (no virtual
+// calls per state for the built-in emissions), and missing data skips all
+// runs of a slot at once instead of being checked state by state.
+//
+// Slots are added in order, so the column sums are the same as evaluating
+// the table state by state. Blocks of positions are evaluated function by
+// function (EmissionFunction::log_probability_block), skipping missing
+// positions.
+//
+class EmissionPlan {
+public:
+  // funcs[state][slot], groups as in EmissionTable::groups
+  EmissionPlan(int n_states, std::vector<std::vector<EmissionFunction*> > const & funcs,
+               std::vector<std::vector<EmissionFunction*> > const & groups);
+
+  // out[k] = log P(emissions at iter | state k)
+  void log_probabilities(Iter const & iter, double * out) const {
+    for (int k = 0; k < _n_states; ++k)
+      out[k] = 0;
+
+    for (unsigned int r = 0; r < _runs.size(); ++r) {
+      Run const & run = _runs[r];
+
+      if (run.missing_slot >= 0 && iter.is_missing(run.missing_slot))
+        continue; /* log(1) */
+      _funcs[run.start]->log_probabilities(iter, &_funcs[run.start], &_states[run.start], run.length, out);
+    }
+  }
+
+  // block version: out[i * n_states + k] = log P(emissions at position
+  // iter.index() + offset + i | state k), for i < n (iter is not moved)
+  void log_probability_block(Iter const & iter, int offset, int n, double * out) const;
+
+  int run_count() const { return _runs.size(); }
+
+  // every function is wrapped by MissingEmissionFunction: positions with
+  // all slots missing have log-probability 0 in every state
+  bool missing_aware() const { return _missing_aware; }
+
+private:
+  static const int BLOCK_LENGTH = 64; // positions per EmissionFunction::log_probability_block call
+
+  struct Run {
+    int start;
+    int length;
+    int slot;
+    int missing_slot; // slot checked for missing data (-1 = none)
+  };
+
+  const int _n_states;
+  std::vector<EmissionFunction*> _funcs; // unwrapped, in plan order
+  std::vector<int> _states;
+  std::vector<Run> _runs;
+  bool _missing_aware;
+};
+
+#endif
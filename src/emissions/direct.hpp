@@ -51,6 +51,10 @@ public:
     }
   }
 
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    batch_log_probabilities<DirectEmission>(iter, funcs, states, n, out);
+  }
+
 private:
   double _flip;
   bool _is_log;
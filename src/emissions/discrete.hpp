@@ -18,8 +18,11 @@ public:
   virtual bool validParams(Params const & params) const {
     double sum = 0.0;
 
-    for (int i = 0; i < params.length(); ++i)
+    for (int i = 0; i < params.length(); ++i) {
+      if (!(params[i] >= 0 && params[i] <= 1))
+        return false;
       sum += params[i];
+    }
 
     return params.length() > 0 && same_probability(sum, 1.0);
   }
@@ -90,36 +93,29 @@ public:
     return _log_probs[y];
   }
 
-  virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    batch_log_probabilities<DiscreteEmissions>(iter, funcs, states, n, out);
+  }
+
+  // sufficient statistics are the per symbol expected counts
+  virtual int n_stats() const { return (_is_fixed ? 0 : _alphabetSize); }
+
+  virtual void collect_stats(Iter const & iter, double post, double * stats) const {
+    int symbol = iter.count(_slotID) - _offset;
+    
+    stats[symbol] += post;
+  }
+
+  virtual void updateParams(std::vector<EmissionFunction*> * group, const double * stats) {
     if (_is_fixed)
       return;
 
-    // sufficient statistics are the per symbol expected counts
     double expected_counts[_alphabetSize];
     
     std::vector<EmissionFunction*>::iterator ef_it;
     
     for (int i = 0; i < _alphabetSize; ++i)
-      expected_counts[i] = _pseudoCount;
-    
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      DiscreteEmissions * ef = (DiscreteEmissions*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          int symbol = (int) iter.emission(ef->_slotID) - _offset;
-          
-          expected_counts[symbol] += post_j[j];
-        }
-      } while (post_it->next());
-      
-      delete post_it;
-    }
+      expected_counts[i] = _pseudoCount + stats[i];
     
     // use expected counts to estimate parameter values
     double normalization = 0;
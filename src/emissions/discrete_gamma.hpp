@@ -157,41 +157,50 @@ public:
       return _logp_tbl[x];
     return logprob(x);
   }
+
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    batch_log_probabilities<DiscreteGamma>(iter, funcs, states, n, out);
+  }
+
+  virtual void log_probability_block(Iter const & iter, int offset, int n, double * out, int stride) const {
+    dispatch_log_probability_block(*this, _slotID, iter, offset, n, out, stride);
+  }
+
+  template<typename E>
+  void typed_log_probability_block(Iter const & iter, int offset, int n, double * out, int stride) const {
+    const E * emissions = iter.emission_block<E>(_slotID, offset);
+    const int step = iter.emission_step<E>();
+
+    for (int i = 0; i < n; ++i) {
+      int x = (int) (emissions[i * step] + _offset);
+
+      assert(x >= 0);
+      out[i * stride] = (x < _tblSize ? _logp_tbl[x] : logprob(x));
+    }
+  }
   
-  virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+  // sufficient statistics: sum_Pzi, sum_Pzi_xi, sum_Pzi_log_xi
+  // (observations divided by the private scale)
+  virtual int n_stats() const { return (_fixedParams ? 0 : 3); }
+
+  virtual void collect_stats(Iter const & iter, double post, double * stats) const {
+    double x = (int) (iter.emission(_slotID) + _offset) / _scale_private;
+    
+    stats[0] += post;
+    stats[1] += post * x;
+    stats[2] += post * log(x);
+  }
+  
+  virtual void updateParams(std::vector<EmissionFunction*> * group, const double * stats) {
     if (_fixedParams)
       return;
     
-    // sufficient statistics
-    double sum_Pzi = 0;
-    double sum_Pzi_xi = 0;
-    double sum_Pzi_log_xi = 0;
+    double sum_Pzi = stats[0];
+    double sum_Pzi_xi = stats[1];
+    double sum_Pzi_log_xi = stats[2];
     
     std::vector<EmissionFunction*>::iterator ef_it;
     
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      DiscreteGamma * ef = (DiscreteGamma*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-      double scale_i = ef->_scale_private;
-      double log_scale_i = log(scale_i);
-      
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          int x = (int) (iter.emission(ef->_slotID) + _offset);
-          
-          sum_Pzi += post_j[j];
-          sum_Pzi_xi += post_j[j] * x / scale_i;
-          sum_Pzi_log_xi += post_j[j] * (log(x) - log_scale_i);
-        }
-      } while (post_it->next());
-      
-      delete post_it;
-    }
-    
     // update parameter
     // 1. estimate shape
     double mean = sum_Pzi_xi / sum_Pzi;
@@ -25,6 +25,10 @@ public:
     return _log_prob;
   }
 
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    batch_log_probabilities<FixedEmission>(iter, funcs, states, n, out);
+  }
+
 private:
   double _log_prob;
 };
@@ -90,39 +90,49 @@ public:
     
     return _A + (_shape - 1) * log(x) - x / _scale;
   }
+
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    batch_log_probabilities<Gamma>(iter, funcs, states, n, out);
+  }
+
+  virtual void log_probability_block(Iter const & iter, int offset, int n, double * out, int stride) const {
+    dispatch_log_probability_block(*this, _slotID, iter, offset, n, out, stride);
+  }
+
+  template<typename E>
+  void typed_log_probability_block(Iter const & iter, int offset, int n, double * out, int stride) const {
+    const E * emissions = iter.emission_block<E>(_slotID, offset);
+    const int step = iter.emission_step<E>();
+    
+    for (int i = 0; i < n; ++i) {
+      double x = (emissions[i * step] + _offset);
+      
+      assert(x >= 0);
+      out[i * stride] = _A + (_shape - 1) * log(x) - x / _scale;
+    }
+  }
+  
+  // sufficient statistics: sum_Pzi, sum_Pzi_xi, sum_Pzi_log_xi
+  virtual int n_stats() const { return (_fixedParams ? 0 : 3); }
+
+  virtual void collect_stats(Iter const & iter, double post, double * stats) const {
+    double x = (iter.emission(_slotID) + _offset);
+    
+    stats[0] += post;
+    stats[1] += post * x;
+    stats[2] += post * log(x);
+  }
   
-  virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+  virtual void updateParams(std::vector<EmissionFunction*> * group, const double * stats) {
     if (_fixedParams)
       return;
     
-    // sufficient statistics
-    double sum_Pzi = 0;
-    double sum_Pzi_xi = 0;
-    double sum_Pzi_log_xi = 0;
+    double sum_Pzi = stats[0];
+    double sum_Pzi_xi = stats[1];
+    double sum_Pzi_log_xi = stats[2];
     
     std::vector<EmissionFunction*>::iterator ef_it;
     
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      Gamma * ef = (Gamma*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-      
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          double x = (iter.emission(ef->_slotID) + _offset);
-          
-          sum_Pzi += post_j[j];
-          sum_Pzi_xi += post_j[j] * x;
-          sum_Pzi_log_xi += post_j[j] * log(x);
-        }
-      } while (post_it->next());
-      
-      delete post_it;
-    }
-    
     // update parameter
     // 1. estimate shape
     double mean = sum_Pzi_xi / sum_Pzi;
@@ -56,36 +56,29 @@ public:
     return (x - _base) * _log_1_prob + _log_prob;
   }
 
-  virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    batch_log_probabilities<Geometric>(iter, funcs, states, n, out);
+  }
+
+  // sufficient statistics are the sum of the state posteriors and the sum of the posterior times
+  // the observations (less the base)
+  virtual int n_stats() const { return (_is_fixed ? 0 : 2); }
+
+  virtual void collect_stats(Iter const & iter, double post, double * stats) const {
+    int x = iter.count(_slotID) - _base;
+    
+    stats[0] += post;
+    stats[1] += post * x;
+  }
+
+  virtual void updateParams(std::vector<EmissionFunction*> * group, const double * stats) {
     if (_is_fixed)
       return;
 
-    // sufficient statistics are the sum of the state posteriors and the sum of the posterior times
-    // the observations (less the base)
-    double sum_Pzi = 0;
-    double sum_Pzi_xi = 0;
+    double sum_Pzi = stats[0];
+    double sum_Pzi_xi = stats[1];
       
     std::vector<EmissionFunction*>::iterator ef_it;
-      
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      Geometric * ef = (Geometric*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-      
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          int x = (int) iter.emission(ef->_slotID) - _base;
-          
-          sum_Pzi += post_j[j];
-          sum_Pzi_xi += post_j[j] * x;
-        }
-      } while (post_it->next());
-      
-      delete post_it;
-    }
     
     // use expected counts to estimate parameter value
     double mean_xi = sum_Pzi_xi/sum_Pzi;
@@ -119,6 +119,27 @@ public:
       return _logp_tbl[x];
     return logprob(x);
   }
+
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    batch_log_probabilities<NegativeBinomial>(iter, funcs, states, n, out);
+  }
+
+  virtual void log_probability_block(Iter const & iter, int offset, int n, double * out, int stride) const {
+    dispatch_log_probability_block(*this, _slotID, iter, offset, n, out, stride);
+  }
+
+  template<typename E>
+  void typed_log_probability_block(Iter const & iter, int offset, int n, double * out, int stride) const {
+    const E * emissions = iter.emission_block<E>(_slotID, offset);
+    const int step = iter.emission_step<E>();
+
+    for (int i = 0; i < n; ++i) {
+      int x = (int) (emissions[i * step] + _offset);
+
+      assert(x >= 0);
+      out[i * stride] = (x < _tblSize ? _logp_tbl[x] : logprob(x));
+    }
+  }
   
   virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {
     if (_fixedParams)
@@ -128,42 +149,26 @@ public:
     // as it makes the math easier
     double r = _dispersion;
     
-    // sufficient statistics
-    double sum_Pzi = 0;
-    double sum_Pzi_xi = 0;
+    // sufficient statistics: a single posterior scan, all Newton
+    // iterations run over the distinct counts
+    CountHistogram hist;
+    sequences->count_histogram(group, _offset, hist);
     
-    std::vector<EmissionFunction*>::iterator ef_it;
+    double sum_Pzi = hist.total();
+    double sum_Pzi_xi = hist.weighted_sum();
     
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      NegativeBinomial * ef = (NegativeBinomial*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-      
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          int x = (int) (iter.emission(ef->_slotID) + _offset);
-          
-          sum_Pzi += post_j[j];
-          sum_Pzi_xi += post_j[j] * x;
-        }
-      } while (post_it->next());
-      
-      delete post_it;
-    }
+    std::vector<EmissionFunction*>::iterator ef_it;
     
     // update parameter
     // 1. estimate 'r' (dispersion)
     // 1.1 Apply Newton's method
-    double r_prev = r_start_value(r, sum_Pzi, sum_Pzi_xi, sequences, group);
+    double r_prev = r_start_value(r, sum_Pzi, sum_Pzi_xi, hist);
     double change;
     int i = 0;
     int reductionFactor = 2; /* how much to reduce the starting dispersion */
     do {
       ++i;
-      r = r_prev - newton_ratio(sum_Pzi, sum_Pzi_xi, r_prev, sequences, group);
+      r = r_prev - newton_ratio(sum_Pzi, sum_Pzi_xi, r_prev, hist);
       
       /* test boundary conditions */
       if (QHMM_isinf(r) || QHMM_isnan(r)) {
@@ -260,34 +265,16 @@ private:
       memcpy(_logp_tbl, other->_logp_tbl, _tblSize * sizeof(double));
   }
   
-  double r_start_value(double prev_r, double sum_Pzi, double sum_Pzi_xi, EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+  double r_start_value(double prev_r, double sum_Pzi, double sum_Pzi_xi, CountHistogram const & hist) {
     if (!_momInit)
       return prev_r;
     
     // estimate variance
     double mean = sum_Pzi_xi / sum_Pzi;
-    double sum_Pzi_sqdiff = 0.0;
+    double sum_Pzi_sqdiff = 0;
     
-    std::vector<EmissionFunction*>::iterator ef_it;
-    
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      NegativeBinomial * ef = (NegativeBinomial*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-      
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          int x = (int) (iter.emission(ef->_slotID) + _offset);
-          
-          sum_Pzi_sqdiff += post_j[j] * (x - mean) * (x - mean);
-        }
-      } while (post_it->next());
-      
-      delete post_it;
-    }
+    for (int i = 0; i < hist.size(); ++i)
+      sum_Pzi_sqdiff += hist.weight(i) * (hist.value(i) - mean) * (hist.value(i) - mean);
     
     //
     double var = sum_Pzi_sqdiff / sum_Pzi;
@@ -298,7 +285,7 @@ private:
     return r_est;
   }
   
-  double newton_ratio(double A, double B, double r, EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+  double newton_ratio(double A, double B, double r, CountHistogram const & hist) {
     
     // constant terms
     double const_num = 0;
@@ -311,25 +298,9 @@ private:
     double sum_num = 0;
     double sum_denom = 0;
     
-    std::vector<EmissionFunction*>::iterator ef_it;
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      NegativeBinomial * ef = (NegativeBinomial*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-      
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          double x = (iter.emission(ef->_slotID) + _offset);
-          
-          sum_num += post_j[j] * QHMM_digamma(x + r);
-          sum_denom += post_j[j] * QHMM_trigamma(x + r);
-        }
-      } while (post_it->next());
-      
-      delete post_it;
+    for (int i = 0; i < hist.size(); ++i) {
+      sum_num += hist.weight(i) * QHMM_digamma(hist.value(i) + r);
+      sum_denom += hist.weight(i) * QHMM_trigamma(hist.value(i) + r);
     }
     
     // TODO: check if some trickery with the GammaFn can help here!
@@ -133,6 +133,10 @@ public:
       return _logp_tbl[x];
     return logprob(x);
   }
+
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    batch_log_probabilities<NegativeBinomialScaled>(iter, funcs, states, n, out);
+  }
   
   virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {
     if (_fixedParams)
@@ -142,45 +146,36 @@ public:
     // as it makes the math easier
     double r = _dispersion;
     
-    // sufficient statistics
-    double sum_Pzi;
+    // sufficient statistics: one histogram per group member (scales
+    // differ), all Newton iterations run over the distinct counts
+    std::vector<CountHistogram> hists(group->size());
+    double sum_Pzi = 0;
     double sum_Pzi_sj = 0; /* scaled counts */
     double sum_Pzi_xi = 0;
     
-    std::vector<EmissionFunction*>::iterator ef_it;
-    
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      NegativeBinomialScaled * ef = (NegativeBinomialScaled*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
+    for (unsigned int j = 0; j < group->size(); ++j) {
+      NegativeBinomialScaled * ef = (NegativeBinomialScaled*) (*group)[j]->inner();
+      std::vector<EmissionFunction*> single(1, (*group)[j]);
       
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          int x = (int) (iter.emission(ef->_slotID) + _offset);
-          
-          sum_Pzi += post_j[j];
-          sum_Pzi_sj += post_j[j] * ef->_scale;
-          sum_Pzi_xi += post_j[j] * x;
-        }
-      } while (post_it->next());
-      
-      delete post_it;
+      sequences->count_histogram(&single, _offset, hists[j]);
+      sum_Pzi += hists[j].total();
+      sum_Pzi_sj += ef->_scale * hists[j].total();
+      sum_Pzi_xi += hists[j].weighted_sum();
     }
     
+    std::vector<EmissionFunction*>::iterator ef_it;
+    
     // update parameter
     // 1. estimate 'r' (dispersion)
     // 1.1 Apply Newton's method
-    //double r_prev = r_start_value(r, sum_Pzi, sum_Pzi_xi, sequences, group);
-    double r_prev = r_start_value_alt(r, sequences, group);
+    //double r_prev = r_start_value(r, sum_Pzi, sum_Pzi_xi, hists);
+    double r_prev = r_start_value_alt(r, hists, group);
     double change;
     int i = 0;
     int reductionFactor = 2; /* how much to reduce the starting dispersion */
     do {
       ++i;
-      r = r_prev - newton_ratio(sum_Pzi_sj, sum_Pzi_xi, r_prev, sequences, group);
+      r = r_prev - newton_ratio(sum_Pzi_sj, sum_Pzi_xi, r_prev, hists, group);
       
       /* test boundary conditions */
       if (QHMM_isinf(r) || QHMM_isnan(r)) {
@@ -278,34 +273,16 @@ private:
       memcpy(_logp_tbl, other->_logp_tbl, _tblSize * sizeof(double));
   }
   
-  double r_start_value(double prev_r, double sum_Pzi, double sum_Pzi_xi, EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+  double r_start_value(double prev_r, double sum_Pzi, double sum_Pzi_xi, std::vector<CountHistogram> const & hists) {
     if (!_momInit)
       return prev_r;
     
     // estimate variance
     double mean = sum_Pzi_xi / sum_Pzi;
-    double sum_Pzi_sqdiff = 0.0;
+    double sum_Pzi_sqdiff = 0;
     
-    std::vector<EmissionFunction*>::iterator ef_it;
-    
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      NegativeBinomialScaled * ef = (NegativeBinomialScaled*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-      
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          int x = (int) (iter.emission(ef->_slotID) + _offset);
-          
-          sum_Pzi_sqdiff += post_j[j] * (x - mean) * (x - mean);
-        }
-      } while (post_it->next());
-      
-      delete post_it;
-    }
+    for (unsigned int j = 0; j < hists.size(); ++j)
+      sum_Pzi_sqdiff += sq_diff_sum(hists[j], mean);
     
     //
     double var = sum_Pzi_sqdiff / sum_Pzi;
@@ -325,54 +302,23 @@ private:
    * where s_i is the scale factor of state i
    * and r_i is the 'r' estimate for state i (naturally incorporates scale)
    */
-  double r_start_value_alt(double prev_r, EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+  double r_start_value_alt(double prev_r, std::vector<CountHistogram> const & hists, std::vector<EmissionFunction*> * group) {
     if (!_momInit)
       return prev_r;
 
     double sum_scale = 0;
     double sum_estimates = 0;
     
-    std::vector<EmissionFunction*>::iterator ef_it;
-    
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      NegativeBinomialScaled * ef = (NegativeBinomialScaled*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
+    for (unsigned int j = 0; j < group->size(); ++j) {
+      NegativeBinomialScaled * ef = (NegativeBinomialScaled*) (*group)[j]->inner();
       
       /* estimate mean */
-      double sum_Pzi_xi = 0;
-      double sum_Pzi = 0;
-      
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          int x = (int) (iter.emission(ef->_slotID) + _offset);
-          
-          sum_Pzi += post_j[j];
-          sum_Pzi_xi += post_j[j] * x;
-          
-        }
-      } while (post_it->next());
-      
+      double sum_Pzi = hists[j].total();
+      double sum_Pzi_xi = hists[j].weighted_sum();
       double mean = sum_Pzi_xi / sum_Pzi;
       
       /* estimate variance */
-      double sum_Pzi_sqdiff = 0;
-      post_it->reset();
-      
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          int x = (int) (iter.emission(ef->_slotID) + _offset);
-          
-          sum_Pzi_sqdiff += post_j[j] * (x - mean) * (x - mean);
-        }
-      } while (post_it->next());
+      double sum_Pzi_sqdiff = sq_diff_sum(hists[j], mean);
       
       /* save "r" estimate */
       double var = sum_Pzi_sqdiff / sum_Pzi;
@@ -380,8 +326,6 @@ private:
       
       sum_estimates += r_est;
       sum_scale += ef->_scale;
-      
-      delete post_it;
     }
     
     double r_weighted_est = sum_estimates / sum_scale;
@@ -392,7 +336,15 @@ private:
     return r_weighted_est;
   }
   
-  double newton_ratio(double As, double B, double r, EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+  double sq_diff_sum(CountHistogram const & hist, double mean) {
+    double sum = 0;
+    
+    for (int i = 0; i < hist.size(); ++i)
+      sum += hist.weight(i) * (hist.value(i) - mean) * (hist.value(i) - mean);
+    return sum;
+  }
+  
+  double newton_ratio(double As, double B, double r, std::vector<CountHistogram> const & hists, std::vector<EmissionFunction*> * group) {
     
     // constant terms
     double const_num = 0;
@@ -405,25 +357,17 @@ private:
     double sum_num = 0;
     double sum_denom = 0;
     
-    std::vector<EmissionFunction*>::iterator ef_it;
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      NegativeBinomialScaled * ef = (NegativeBinomialScaled*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
+    for (unsigned int j = 0; j < group->size(); ++j) {
+      NegativeBinomialScaled * ef = (NegativeBinomialScaled*) (*group)[j]->inner();
+      CountHistogram const & hist = hists[j];
+      double s = ef->_scale;
+      double digamma_sr = QHMM_digamma(s * r);
+      double trigamma_sr = QHMM_trigamma(s * r);
       
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          double x = (iter.emission(ef->_slotID) + _offset);
-          
-          sum_num += post_j[j] * ef->_scale * (QHMM_digamma(x + ef->_scale * r) - QHMM_digamma(ef->_scale * r));
-          sum_denom += post_j[j] * ef->_scale * ef->_scale * (QHMM_trigamma(x + ef->_scale * r) - QHMM_trigamma(ef->_scale * r));
-        }
-      } while (post_it->next());
-      
-      delete post_it;
+      for (int i = 0; i < hist.size(); ++i) {
+        sum_num += hist.weight(i) * s * (QHMM_digamma(hist.value(i) + s * r) - digamma_sr);
+        sum_denom += hist.weight(i) * s * s * (QHMM_trigamma(hist.value(i) + s * r) - trigamma_sr);
+      }
     }
     
     // TODO: check if some trickery with the GammaFn can help here!
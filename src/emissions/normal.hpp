@@ -48,89 +48,62 @@ public:
     
     return _A - (diff * diff) / (2 * _var);
   }
+
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    batch_log_probabilities<Normal>(iter, funcs, states, n, out);
+  }
+
+  virtual void log_probability_block(Iter const & iter, int offset, int n, double * out, int stride) const {
+    dispatch_log_probability_block(*this, _slotID, iter, offset, n, out, stride);
+  }
+
+  template<typename E>
+  void typed_log_probability_block(Iter const & iter, int offset, int n, double * out, int stride) const {
+    const E * emissions = iter.emission_block<E>(_slotID, offset);
+    const int step = iter.emission_step<E>();
+    
+    for (int i = 0; i < n; ++i) {
+      int x = emissions[i * step];
+      double diff = x - _mean;
+      
+      out[i * stride] = _A - (diff * diff) / (2 * _var);
+    }
+  }
   
-  virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+  // sufficient statistics are the posterior weighted moments of the
+  // observations, shifted by the current mean to avoid cancellation:
+  // sum_Pzi, sum_Pzi (xi - mean), sum_Pzi (xi - mean)^2
+  virtual int n_stats() const { return (_is_fixed_mean && _is_fixed_var ? 0 : 3); }
+
+  virtual void collect_stats(Iter const & iter, double post, double * stats) const {
+    double diff = iter.emission(_slotID) - _mean;
+    
+    stats[0] += post;
+    stats[1] += post * diff;
+    stats[2] += post * diff * diff;
+  }
+  
+  virtual void updateParams(std::vector<EmissionFunction*> * group, const double * stats) {
     if (_is_fixed_mean && _is_fixed_var)
       return;
     
     // suff stats
-    double sum_Pzi = 0;
-    double sum_Pzi_xi = 0;
+    double sum_Pzi = stats[0];
     double mu = _mean;
     double sig2 = _var;
     
     std::vector<EmissionFunction*>::iterator ef_it;
     
-    if (!_is_fixed_mean) {
-      for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-        Normal * ef = (Normal*) (*ef_it)->inner();
-        PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-        
-        do {
-          const double * post_j = post_it->posterior();
-          Iter & iter = post_it->iter();
-          iter.resetFirst();
-          
-          for (int j = 0; j < iter.length(); iter.next(), ++j) {
-            double x = iter.emission(ef->_slotID);
-            
-            sum_Pzi += post_j[j];
-            sum_Pzi_xi += post_j[j] * x;
-          }
-        } while (post_it->next());
-        
-        delete post_it;
-      }
-      
-      mu = sum_Pzi_xi /  sum_Pzi;
-    }
+    if (!_is_fixed_mean)
+      mu = _mean + stats[1] / sum_Pzi;
     
     // for variance
     if (!_is_fixed_var) {
-      double sum_Pzi_sdiff = 0;
-      
-      if (_is_fixed_mean) {
-        for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-          Normal * ef = (Normal*) (*ef_it)->inner();
-          PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-          
-          do {
-            const double * post_j = post_it->posterior();
-            Iter & iter = post_it->iter();
-            iter.resetFirst();
-            
-            for (int j = 0; j < iter.length(); iter.next(), ++j) {
-              double x = iter.emission(ef->_slotID);
-              
-              sum_Pzi += post_j[j];
-              sum_Pzi_sdiff += post_j[j] * (x - mu) * (x - mu);
-            }
-          } while (post_it->next());
-          
-          delete post_it;
-        }
-      } else {
-        for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-          Normal * ef = (Normal*) (*ef_it)->inner();
-          PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-          
-          do {
-            const double * post_j = post_it->posterior();
-            Iter & iter = post_it->iter();
-            iter.resetFirst();
-            
-            for (int j = 0; j < iter.length(); iter.next(), ++j) {
-              double x = iter.emission(ef->_slotID);
-              
-              sum_Pzi_sdiff += post_j[j] * (x - mu) * (x - mu);
-            }
-          } while (post_it->next());
-          
-          delete post_it;
-        }
-      }
+      // sum_Pzi (xi - mu)^2 from the moments around the previous mean
+      double shift = mu - _mean;
+      double sum_Pzi_sdiff = stats[2] - shift * (2 * stats[1] - shift * sum_Pzi);
       
-      if (sum_Pzi_sdiff == 0.0) {
+      if (sum_Pzi_sdiff <= 0.0) {
         // single point degeneracy!
         log_state_slot_msg(_stateID, _slotID, "degenerate variance, setting to 1\n");
         sig2 = 1.0;
@@ -304,7 +304,7 @@ class Poisson : public EmissionFunction {
     }
   
     virtual double log_probability(Iter const & iter) const {
-      int x = (int) iter.emission(_slotID); // cast to integer
+      int x = iter.count(_slotID); // cast to integer
       
       // log prob(x) = log( lambda^x exp(-lambda) / x!)
       //             = x log(lambda) - lambda - log(x!)
@@ -313,38 +313,50 @@ class Poisson : public EmissionFunction {
       else
         return x * _log_lambda - _lambda - LogFactorial::logFactorial(x);
     }
+
+    virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+      batch_log_probabilities<Poisson>(iter, funcs, states, n, out);
+    }
+
+    virtual void log_probability_block(Iter const & iter, int offset, int n, double * out, int stride) const {
+      dispatch_log_probability_block(*this, _slotID, iter, offset, n, out, stride);
+    }
+
+    template<typename E>
+    void typed_log_probability_block(Iter const & iter, int offset, int n, double * out, int stride) const {
+      const E * emissions = iter.emission_block<E>(_slotID, offset);
+      const int step = iter.emission_step<E>();
+      
+      for (int i = 0; i < n; ++i) {
+        int x = (int) emissions[i * step];
+        
+        if (x == 0)
+          out[i * stride] = -_lambda - LogFactorial::logFactorial(x);
+        else
+          out[i * stride] = x * _log_lambda - _lambda - LogFactorial::logFactorial(x);
+      }
+    }
+  
+    // sufficient statistics are the sum of the state posteriors and the sum of the posterior times
+    // the observations
+    virtual int n_stats() const { return (_is_fixed ? 0 : 2); }
+
+    virtual void collect_stats(Iter const & iter, double post, double * stats) const {
+      int x = iter.count(_slotID);
+      
+      stats[0] += post;
+      stats[1] += post * x;
+    }
   
-    virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+    virtual void updateParams(std::vector<EmissionFunction*> * group, const double * stats) {
       if (_is_fixed)
         return;
 
-      // sufficient statistics are the sum of the state posteriors and the sum of the posterior times
-      // the observations
-      double sum_Pzi = 0;
-      double sum_Pzi_xi = 0;
+      double sum_Pzi = stats[0];
+      double sum_Pzi_xi = stats[1];
       
       std::vector<EmissionFunction*>::iterator ef_it;
       
-      for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-        Poisson * ef = (Poisson*) (*ef_it)->inner();
-        PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-        
-        do {
-          const double * post_j = post_it->posterior();
-          Iter & iter = post_it->iter();
-          iter.resetFirst();
-          
-          for (int j = 0; j < iter.length(); iter.next(), ++j) {
-            int x = (int) iter.emission(ef->_slotID);
-            
-            sum_Pzi += post_j[j];
-            sum_Pzi_xi += post_j[j] * x;
-          }
-        } while (post_it->next());
-        
-        delete post_it;
-      }
-      
       // use expected counts to estimate parameter value
       _lambda = sum_Pzi_xi / sum_Pzi;
       _log_lambda = log(_lambda);
@@ -371,7 +383,7 @@ class PoissonCovar : public EmissionFunction {
   PoissonCovar(int stateID, int slotID, int covar_slot = 0) : EmissionFunction(stateID, slotID), _covar_slot(covar_slot) {}
     
     virtual double log_probability(Iter const & iter) const {
-      int x = (int) iter.emission(_slotID); // cast to integer
+      int x = iter.count(_slotID); // cast to integer
       double lambda = iter.covar(_covar_slot);
       
       // log prob(x) = log( lambda^x exp(-lambda) / x!)
@@ -381,6 +393,10 @@ class PoissonCovar : public EmissionFunction {
       else
         return x * log(lambda) - lambda - LogFactorial::logFactorial(x);
     }
+
+    virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+      batch_log_probabilities<PoissonCovar>(iter, funcs, states, n, out);
+    }
   
     virtual bool setCovarSlots(int * slots, int length) {
       if (length != 1)
@@ -475,7 +491,7 @@ public:
   }
 
   virtual double log_probability(Iter const & iter) const {
-    int x = (int) iter.emission(_slotID); // cast to integer
+    int x = iter.count(_slotID); // cast to integer
     double lambda = iter.covar(_covar_slot) * _scale;
     
     // log prob(x) = log( lambda^x exp(-lambda) / x!)
@@ -485,6 +501,10 @@ public:
     else
       return x * log(lambda) - lambda - LogFactorial::logFactorial(x);
   }
+
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    batch_log_probabilities<PoissonScaledCovar>(iter, funcs, states, n, out);
+  }
   
   virtual bool setCovarSlots(int * slots, int length) {
     if (length != 1)
@@ -495,38 +515,27 @@ public:
     return true;
   }
 
-  virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+  // sufficient statistics are the sum of the state posteriors times the lambdas and the sum of the posterior times
+  // the observations
+  virtual int n_stats() const { return (_is_fixed ? 0 : 2); }
+
+  virtual void collect_stats(Iter const & iter, double post, double * stats) const {
+    int x = iter.count(_slotID);
+    double lambda_i = iter.covar(_covar_slot);
+    
+    stats[0] += post * lambda_i;
+    stats[1] += post * x;
+  }
+
+  virtual void updateParams(std::vector<EmissionFunction*> * group, const double * stats) {
     if (_is_fixed)
       return;
 
-    // sufficient statistics are the sum of the state posteriors times the lambdas and the sum of the posterior times
-    // the observations
-    double sum_Pzi_lambda_i = 0;
-    double sum_Pzi_xi = 0;
+    double sum_Pzi_lambda_i = stats[0];
+    double sum_Pzi_xi = stats[1];
       
     std::vector<EmissionFunction*>::iterator ef_it;
     
-    for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-      PoissonScaledCovar * ef = (PoissonScaledCovar*) (*ef_it)->inner();
-      PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-      
-      do {
-        const double * post_j = post_it->posterior();
-        Iter & iter = post_it->iter();
-        iter.resetFirst();
-        
-        for (int j = 0; j < iter.length(); iter.next(), ++j) {
-          int x = (int) iter.emission(ef->_slotID);
-          double lambda_i = iter.covar(_covar_slot);
-          
-          sum_Pzi_lambda_i += post_j[j] * lambda_i;
-          sum_Pzi_xi += post_j[j] * x;
-        }
-      } while (post_it->next());
-      
-      delete post_it;
-    }
-    
     // update parameter
     double scale = (_pseudo_num + sum_Pzi_xi) / (_pseudo_denom + sum_Pzi_lambda_i);
 
@@ -596,7 +605,7 @@ class PoissonScaled : public EmissionFunction {
     }
     
     virtual double log_probability(Iter const & iter) const {
-      int x = (int) iter.emission(_slotID); // cast to integer
+      int x = iter.count(_slotID); // cast to integer
       
       // log prob(x) = log( (scale*lambda)^x exp(-scale*lambda) / x!)
       //             = x log(scale*lambda) - scale*lambda - log(x!)
@@ -606,38 +615,30 @@ class PoissonScaled : public EmissionFunction {
         return x * _log_scale_lambda - _scale_lambda - LogFactorial::logFactorial(x);
     }
 
-    virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {
+    virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+      batch_log_probabilities<PoissonScaled>(iter, funcs, states, n, out);
+    }
+
+    // sufficient statistics are the sum of 'scaled' the state posteriors and the sum of the posterior times
+    // the observations
+    virtual int n_stats() const { return (_is_fixed ? 0 : 2); }
+
+    virtual void collect_stats(Iter const & iter, double post, double * stats) const {
+      int x = iter.count(_slotID);
+      
+      stats[0] += post * _scale;
+      stats[1] += post * x;
+    }
+
+    virtual void updateParams(std::vector<EmissionFunction*> * group, const double * stats) {
       if (_is_fixed)
         return;
 
-      // sufficient statistics are the sum of 'scaled' the state posteriors and the sum of the posterior times
-      // the observations
-      double sum_scale_Pzi = 0;
-      double sum_Pzi_xi = 0;
+      double sum_scale_Pzi = stats[0];
+      double sum_Pzi_xi = stats[1];
       
       std::vector<EmissionFunction*>::iterator ef_it;
       
-      for (ef_it = group->begin(); ef_it != group->end(); ++ef_it) {
-        PoissonScaled * ef = (PoissonScaled*) (*ef_it)->inner();
-        PosteriorIterator * post_it = sequences->iterator(ef->_stateID, ef->_slotID);
-        double scale_i = ef->_scale;
-        
-        do {
-          const double * post_j = post_it->posterior();
-          Iter & iter = post_it->iter();
-          iter.resetFirst();
-          
-          for (int j = 0; j < iter.length(); iter.next(), ++j) {
-            int x = (int) iter.emission(ef->_slotID);
-            
-            sum_scale_Pzi += post_j[j] * scale_i;
-            sum_Pzi_xi += post_j[j] * x;
-          }
-        } while (post_it->next());
-        
-        delete post_it;
-      }
-      
       // if no data was found, don't update the parameters
       if (sum_scale_Pzi == 0) {
         log_state_slot_msg(_stateID, _slotID, "no data, skipping update\n");
@@ -82,6 +82,10 @@ public:
     return log_pdf(x) + log_skewed_2_cdf(x);
   }
 
+  virtual void log_probabilities(Iter const & iter, EmissionFunction * const * funcs, const int * states, int n, double * out) const {
+    batch_log_probabilities<SkewNormal>(iter, funcs, states, n, out);
+  }
+
   virtual void updateParams(EMSequences * sequences, std::vector<EmissionFunction*> * group) {
     if (_is_fixed)
       return;
@@ -2,19 +2,24 @@
 #define FUNC_TABLE_HPP
 
 #include "base_func_table.hpp"
+#include "emission_plan.hpp"
 
 class HomogeneousTransitions : public TransitionTable {
 public:
   HomogeneousTransitions(int n_states) : TransitionTable(n_states) {
-    _m = new double*[n_states];
-    for (int i = 0; i < n_states; ++i)
-      _m[i] = new double[n_states];
+    /* one allocation, each matrix starts on a cache line */
+    const int size = matrix_size(n_states);
+    _storage = new char[4 * size * sizeof(double) + CACHE_LINE];
+    size_t offset = (CACHE_LINE - ((size_t) _storage) % CACHE_LINE) % CACHE_LINE;
+    
+    _m_rows = (double*) (_storage + offset);
+    _m_cols = _m_rows + size;
+    _p_rows = _m_cols + size;
+    _p_cols = _p_rows + size;
   }
   
   virtual ~HomogeneousTransitions() {
-    for (int i = 0; i < _n_states; ++i)
-      delete[] _m[i];
-    delete[] _m;
+    delete[] _storage;
   }
 		
   virtual void setParams(int state, Params const & params) {
@@ -24,10 +29,31 @@ public:
     updateRow(state);
   }
   
-  // TODO: Check if it's worth it to transpose this matrix, since we'll be accessing
-  //       it column by columns
   double operator() (Iter const & iter, int i, int j) const {
-    return _m[i][j];
+    return _m_rows[i * _n_states + j];
+  }
+  
+  // blocks are cached (buffer not needed)
+  virtual int block_buffer_size() const {
+    return 0;
+  }
+  
+  virtual void init_block_buffer(double * buffer, bool log_space = true) const {}
+  
+  virtual const double * log_block(Iter const & iter, double * buffer) const {
+    return _m_cols;
+  }
+  
+  virtual const double * log_block_rows(Iter const & iter, double * buffer) const {
+    return _m_rows;
+  }
+  
+  virtual const double * block(Iter const & iter, double * buffer) const {
+    return _p_cols;
+  }
+  
+  virtual const double * block_rows(Iter const & iter, double * buffer) const {
+    return _p_rows;
   }
   
   virtual void insert(TransitionFunction * func) {
@@ -42,12 +68,29 @@ public:
   }
 
 private:
-  double ** _m;
+  static const int CACHE_LINE = 64; // bytes
+  
+  char * _storage; // all four matrices
+  double * _m_rows; // source-major
+  double * _m_cols; // target-major (transposed)
+  double * _p_rows; // exp(_m_rows)
+  double * _p_cols; // exp(_m_cols)
+  
+  // doubles per matrix, rounded up to whole cache lines
+  static int matrix_size(int n_states) {
+    const int per_line = CACHE_LINE / sizeof(double);
+    return (n_states * n_states + per_line - 1) / per_line * per_line;
+  }
   
   void updateRow(int state) {
-    double * row = _m[state];
-    for (int j = 0; j < _n_states; ++j)
+    double * row = _m_rows + state * _n_states;
+    double * prow = _p_rows + state * _n_states;
+    for (int j = 0; j < _n_states; ++j) {
       row[j] = _funcs[state]->log_probability(j);
+      prow[j] = exp(row[j]);
+      _m_cols[j * _n_states + state] = row[j];
+      _p_cols[j * _n_states + state] = prow[j];
+    }
   }
 };
 
@@ -59,12 +102,76 @@ public:
   double operator() (Iter const & iter, int i, int j) const {
     return _funcs[i]->log_probability(iter, j);
   }
+  
+  // n x n block followed by one row of scratch space
+  virtual int block_buffer_size() const {
+    return _n_states * _n_states + _n_states;
+  }
+  
+  // invalid transitions are set once, only valid ones are updated per position
+  virtual void init_block_buffer(double * buffer, bool log_space = true) const {
+    const int size = _n_states * _n_states;
+    double invalid = (log_space ? -std::numeric_limits<double>::infinity() : 0);
+    
+    for (int i = 0; i < size; ++i)
+      buffer[i] = invalid;
+  }
+  
+  virtual const double * log_block(Iter const & iter, double * buffer) const {
+    double * scratch = buffer + _n_states * _n_states;
+    
+    for (int k = 0; k < _n_states; ++k) {
+      const TransitionFunction * f_k = _funcs[k];
+      const int * targets = f_k->targets();
+      
+      f_k->log_probabilities(iter, scratch);
+      for (int i = 0; i < f_k->n_targets(); ++i)
+        buffer[targets[i] * _n_states + k] = scratch[targets[i]];
+    }
+    return buffer;
+  }
+  
+  virtual const double * log_block_rows(Iter const & iter, double * buffer) const {
+    for (int k = 0; k < _n_states; ++k)
+      _funcs[k]->log_probabilities(iter, buffer + k * _n_states);
+    return buffer;
+  }
+  
+  virtual const double * block(Iter const & iter, double * buffer) const {
+    double * scratch = buffer + _n_states * _n_states;
+    
+    for (int k = 0; k < _n_states; ++k) {
+      const TransitionFunction * f_k = _funcs[k];
+      const int * targets = f_k->targets();
+      
+      f_k->log_probabilities(iter, scratch);
+      for (int i = 0; i < f_k->n_targets(); ++i)
+        buffer[targets[i] * _n_states + k] = exp(scratch[targets[i]]);
+    }
+    return buffer;
+  }
+  
+  virtual const double * block_rows(Iter const & iter, double * buffer) const {
+    for (int k = 0; k < _n_states; ++k) {
+      const TransitionFunction * f_k = _funcs[k];
+      const int * targets = f_k->targets();
+      double * row = buffer + k * _n_states;
+      
+      f_k->log_probabilities(iter, row);
+      for (int i = 0; i < f_k->n_targets(); ++i)
+        row[targets[i]] = exp(row[targets[i]]);
+    }
+    return buffer;
+  }
 };
 
 class Emissions : public EmissionTable, private FunctionTable<EmissionFunction> {
 public:
-  Emissions(int n_states) : FunctionTable<EmissionFunction>(n_states) {}
-  virtual ~Emissions() {}
+  Emissions(int n_states) : FunctionTable<EmissionFunction>(n_states), _plan(NULL) {}
+  virtual ~Emissions() {
+    if (_plan != NULL)
+      delete _plan;
+  }
   
   bool validSlotParams(int state, int slot, Params const & params) const {
     return validParams(state, params);
@@ -94,6 +201,27 @@ public:
     return _funcs[i]->log_probability(iter);
   }
   
+  // out[k] = (*this)(iter, k) for all states (see EmissionPlan)
+  void log_probabilities(Iter const & iter, double * out) const {
+    if (_plan != NULL)
+      _plan->log_probabilities(iter, out);
+    else
+      for (int k = 0; k < _n_states; ++k)
+        out[k] = _funcs[k]->log_probability(iter);
+  }
+  
+  // positions with all slots missing have log-probability 0 in every state
+  bool missing_aware() const { return _plan != NULL && _plan->missing_aware(); }
+  
+  // out[i * n_states + k] = (*this)(iter at index() + offset + i, k), for i < n
+  void log_probability_block(Iter const & iter, int offset, int n, double * out) const {
+    if (_plan != NULL)
+      _plan->log_probability_block(iter, offset, n, out);
+    else
+      for (int k = 0; k < _n_states; ++k)
+        _funcs[k]->log_probability_block(iter, offset, n, out + k, _n_states);
+  }
+  
   virtual void insert(EmissionFunction * func) {
     FunctionTable<EmissionFunction>::insert(func);
   }
@@ -116,6 +244,13 @@ public:
   
   virtual void commitGroups() {
     FunctionTable<EmissionFunction>::commitGroups();
+    
+    std::vector<std::vector<EmissionFunction*> > funcs;
+    for (unsigned int i = 0; i < _funcs.size(); ++i)
+      funcs.push_back(std::vector<EmissionFunction*>(1, _funcs[i]));
+    if (_plan != NULL)
+      delete _plan;
+    _plan = new EmissionPlan(_n_states, funcs, _groups);
   }
   
   virtual const std::vector<std::vector<EmissionFunction*> > & groups() {
@@ -125,11 +260,14 @@ public:
   virtual int n_states() const {
     return _n_states;
   };
+
+private:
+  EmissionPlan * _plan; // NULL until commitGroups
 };
 
 class MultiEmissions : public EmissionTable {
 public:
-  MultiEmissions(int n_states, int n_slots) : _n_states(n_states), _n_slots(n_slots) {
+  MultiEmissions(int n_states, int n_slots) : _n_states(n_states), _n_slots(n_slots), _plan(NULL) {
     _funcs.reserve(n_states);
     for (int i = 0; i < n_slots; ++i) {
       std::vector<EmissionFunction *> vec;
@@ -145,6 +283,8 @@ public:
       for (unsigned int j = 0; j < funcs_i.size(); ++j)
         delete funcs_i[j];
     }
+    if (_plan != NULL)
+      delete _plan;
   }
   
   bool validSlotParams(int state, int slot, Params const & params) const {
@@ -192,6 +332,30 @@ public:
     return log_prob;
   }
   
+  // out[k] = (*this)(iter, k) for all states (see EmissionPlan)
+  void log_probabilities(Iter const & iter, double * out) const {
+    if (_plan != NULL)
+      _plan->log_probabilities(iter, out);
+    else
+      for (int k = 0; k < _n_states; ++k)
+        out[k] = (*this)(iter, k);
+  }
+  
+  // positions with all slots missing have log-probability 0 in every state
+  bool missing_aware() const { return _plan != NULL && _plan->missing_aware(); }
+  
+  // out[i * n_states + k] = (*this)(iter at index() + offset + i, k), for i < n
+  void log_probability_block(Iter const & iter, int offset, int n, double * out) const {
+    if (_plan != NULL)
+      _plan->log_probability_block(iter, offset, n, out);
+    else {
+      Iter cursor(iter, offset);
+      
+      for (int i = 0; i < n; ++i, cursor.next())
+        log_probabilities(cursor, out + i * _n_states);
+    }
+  }
+  
   int n_states() const { return _n_states; }
   int n_slots() const { return _n_slots; }
   
@@ -243,6 +407,10 @@ public:
         _groups.push_back(group);
       }
     }
+    
+    if (_plan != NULL)
+      delete _plan;
+    _plan = new EmissionPlan(_n_states, _funcs, _groups);
   }
   
   virtual const std::vector<std::vector<EmissionFunction*> > & groups() {
@@ -256,7 +424,8 @@ public:
   
     std::vector<std::vector<EmissionFunction *> > _singletons;
     std::vector<std::vector<EmissionFunction *> > _groups;
-
+  
+    EmissionPlan * _plan; // NULL until commitGroups
 };
 
 #endif
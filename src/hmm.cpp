@@ -1,14 +1,17 @@
 #include "inner_tmpl.hpp"
 #include "hmm_tmpl.hpp"
+#include "hmm_scaled_tmpl.hpp"
 
 template<typename TransTableT, typename EmissionTableT>
-HMM * HMM::create(TransTableT * transitions, EmissionTableT * emissions, double * init_log_probs) {
+HMM * HMM::create(TransTableT * transitions, EmissionTableT * emissions, double * init_log_probs, bool scaled) {
 
   // determine appropriate inner loop type (Sparse vs Dense)
   if (transitions->isSparse()) {
     InnerFwdSparse<TransTableT *> * innerFwd = new InnerFwdSparse<TransTableT *>(transitions);
     InnerBckSparse<TransTableT *, EmissionTableT *> * innerBck = new InnerBckSparse<TransTableT *, EmissionTableT *>(transitions);
     
+    if (scaled)
+      return new_scaled_hmm_instance(innerFwd, innerBck, transitions, emissions, init_log_probs);
     return new_hmm_instance(innerFwd, innerBck, transitions, emissions, init_log_probs);
   }
   
@@ -16,5 +19,7 @@ HMM * HMM::create(TransTableT * transitions, EmissionTableT * emissions, double
   InnerFwdDense<TransTableT *> * innerFwd = new InnerFwdDense<TransTableT *>();
   InnerBckDense<TransTableT *, EmissionTableT *> * innerBck = new InnerBckDense<TransTableT *, EmissionTableT *>();
   
+  if (scaled)
+    return new_scaled_hmm_instance(innerFwd, innerBck, transitions, emissions, init_log_probs);
   return new_hmm_instance(innerFwd, innerBck, transitions, emissions, init_log_probs);
 }
@@ -3,16 +3,34 @@
 
 #include <vector>
 #include "iter.hpp"
+#include "run_iter.hpp"
 #include "base_func_table.hpp"
 #include "param_record.hpp"
+#include "workspace.hpp"
 
 typedef struct EMResult {
   std::vector<double> * log_likelihood;
   std::vector<ParamRecord*> * param_trace;
+  std::vector<double> * estep_time; // E-step wall time (seconds) per iteration
+  std::vector<double> * sequence_time; // forward/backward time (seconds) per sequence, summed over iterations
 } EMResult;
 
+typedef struct EMOptions {
+  double tolerance;
+  bool checkpoint; // checkpointed forward/backward: O(n_states * sqrt(length)) memory per sequence
+  int checkpoint_length; // checkpoint segment length (0 = sqrt(length))
+  int n_threads; // OpenMP threads for the E and M steps (0 = keep current setting)
+  int split_length; // sequences longer than this have their forward/backward split across all threads (0 = never)
+  int n_batches; // incremental EM: each iteration refreshes one of n_batches batches of sequences until a sweep stops improving (1 = standard EM)
+  bool accelerate; // SQUAREM extrapolation over the free parameters (ignores n_batches)
+
+  EMOptions(double tol = 1e-5) : tolerance(tol), checkpoint(false), checkpoint_length(0), n_threads(0), split_length(0), n_batches(1), accelerate(false) {}
+} EMOptions;
+
 class HMM {
   public:
+    static const int VITERBI_ONLINE_WINDOW = 1024;
+
     virtual ~HMM() {}
 
     virtual TransitionTable * transitions() const = 0;
@@ -20,20 +38,71 @@ class HMM {
   
     virtual void set_initial_probs(double * probs) = 0;
 
-    virtual double forward(Iter & iter, double * matrix) const = 0;
-    virtual double backward(Iter & iter, double * matrix) const = 0;
-    virtual void viterbi(Iter & iter, int * path) const = 0;
-    virtual void state_posterior(Iter & iter, const double * const fw, const double * const bk, double * matrix) const = 0;
-    virtual void local_loglik(Iter & iter, const double * const fw, const double * const bk, double * result) const = 0;
-    virtual void transition_posterior(Iter & iter_at_target, const double * const fw, const double * const bk, double loglik, int n_src, const int * const src, int n_tgt, double * result) const = 0;
+    // log_emissions: optional precomputed emission matrix (see emission_matrix),
+    //                if NULL emissions are evaluated on the fly
+    // workspace: optional scratch memory reused across calls (see Workspace),
+    //            if NULL a private one is used
+    virtual double forward(Iter & iter, double * matrix, const double * log_emissions = NULL, Workspace * workspace = NULL) const = 0;
+    virtual double backward(Iter & iter, double * matrix, const double * log_emissions = NULL, Workspace * workspace = NULL) const = 0;
+
+    // compute forward (backward) columns [start, end] only, matrix holds (end - start + 1) columns
+    // fw_prev: forward column at start - 1 (ignored if start == 0)
+    // bk_next: backward column at end + 1 (ignored if end == length - 1)
+    // forward_segment returns the log of the sum of the last forward column
+    virtual double forward_segment(Iter & iter, int start, int end, const double * fw_prev, double * matrix, const double * log_emissions = NULL, Workspace * workspace = NULL) const = 0;
+    virtual void backward_segment(Iter & iter, int start, int end, const double * bk_next, double * matrix, const double * log_emissions = NULL, Workspace * workspace = NULL) const = 0;
+    // backward pass that also adds the expected transition counts
+    // counts[k * n_states + l] += sum_i P(z_i = k, z_{i+1} = l | x), fw: forward matrix
+    virtual double backward_counts(Iter & iter, const double * fw, double * matrix, double * counts, const double * log_emissions = NULL, Workspace * workspace = NULL) const = 0;
+    // intra-sequence parallel forward (backward): the sequence is split into n_threads
+    // segments, the (log) transfer matrix of each segment is computed in parallel,
+    // the boundary columns are stitched sequentially and all segments are then
+    // recomputed in parallel. Results match forward (backward), but the total work
+    // is about (n_states + 1) times larger, so this pays off when n_threads is
+    // large relative to n_states.
+    virtual double forward_parallel(Iter & iter, double * matrix, int n_threads, const double * log_emissions = NULL) const = 0;
+    virtual double backward_parallel(Iter & iter, double * matrix, int n_threads, const double * log_emissions = NULL) const = 0;
+    // run-length encoded sequences (see RunIter): matrix holds one column per run,
+    // the forward (backward) column at the last position of the run. A run is
+    // crossed with powers of its step matrix (log a_kl + log e_l, constant within
+    // the run), by repeated squaring for long runs, so the cost follows the number
+    // of runs rather than the sequence length. Log sums are not truncated (see
+    // LogSum::create), as truncation errors would compound in the matrix powers.
+    // Both return the log-likelihood.
+    virtual double forward_runs(RunIter & riter, double * matrix, Workspace * workspace = NULL) const = 0;
+    virtual double backward_runs(RunIter & riter, double * matrix, Workspace * workspace = NULL) const = 0;
+    // posterior at every sequence position (as state_posterior), expanded from the
+    // run columns of forward_runs and backward_runs
+    virtual void state_posterior_runs(RunIter & riter, const double * fw, const double * bk, double * matrix, Workspace * workspace = NULL) const = 0;
+    virtual void viterbi(Iter & iter, int * path, Workspace * workspace = NULL) const = 0;
+    // same result as viterbi, but only keeps a window of backpointers: the decoded
+    // prefix is flushed whenever all surviving paths coalesce
+    // window: initial window size in columns (0 = VITERBI_ONLINE_WINDOW)
+    virtual void viterbi_online(Iter & iter, int * path, int window = 0, Workspace * workspace = NULL) const = 0;
+    virtual void state_posterior(Iter & iter, const double * const fw, const double * const bk, double * matrix, Workspace * workspace = NULL) const = 0;
+    virtual void local_loglik(Iter & iter, const double * const fw, const double * const bk, double * result, Workspace * workspace = NULL) const = 0;
+    // fw_src: forward column at the source position (iter_at_target - 1)
+    // bk_tgt: backward column at the target position
+    // e_tgt: optional emission log-probabilities at the target position
+    virtual void transition_posterior(Iter & iter_at_target, const double * const fw_src, const double * const bk_tgt, double loglik, int n_src, const int * const src, int n_tgt, double * result, const double * e_tgt = NULL) const = 0;
+
+    // fills matrix (n_states x length, one column per position) with the emission log-probabilities
+    virtual void emission_matrix(Iter & iter, double * matrix) const = 0;
 
     virtual struct EMResult em(std::vector<Iter*> & iters, double tolerance);
+    virtual struct EMResult em(std::vector<Iter*> & iters, EMOptions const & options);
 
-    virtual void stochastic_backtrace(Iter & iter, double * fwdmatrix, int * path) = 0;
+    virtual void stochastic_backtrace(Iter & iter, double * fwdmatrix, int * path, Workspace * workspace = NULL) = 0;
 
 
+    // scaled = true selects the linear space (scaled) forward/backward engine
+    // for forward, backward, forward_segment and backward_segment only;
+    // backward_counts, forward_parallel/backward_parallel and the run-length
+    // passes (forward_runs, ...) always use the log engine. Only homogeneous
+    // tables gain from it: with non-homogeneous transitions every cell still
+    // needs an exp of the per-position log-probability.
     template<typename TransTableT, typename EmissionTableT>
-    static HMM * create(TransTableT * transitions, EmissionTableT * emissions, double * init_log_probs);
+    static HMM * create(TransTableT * transitions, EmissionTableT * emissions, double * init_log_probs, bool scaled = false);
 
     // properties
     virtual int state_count() const = 0;
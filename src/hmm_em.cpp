@@ -1,6 +1,7 @@
 #include "hmm.hpp"
 #include "em_base.hpp"
 #include <limits>
+#include <algorithm>
 #include <cstdio>
 #include <cmath>
 
@@ -61,7 +62,101 @@ void HMM::delete_records(std::vector<ParamRecord*> * ptr) {
   delete ptr;
 }
 
+/* emission M-step: groups that support fused statistics are updated from
+   the totals of a single pass over the data, the others walk the
+   posteriors themselves */
+static void update_emission_params(EMSequences * sequences, std::vector<std::vector<EmissionFunction*> > groups) {
+  std::vector<EmissionFunction*> stat_funcs;
+  std::vector<int> stat_offsets;
+  std::vector<int> group_offsets;
+  int n_stats = 0;
+
+  for (unsigned int i = 0; i < groups.size(); ++i) {
+    int group_n_stats = groups[i][0]->n_stats();
+
+    if (group_n_stats > 0) {
+      /* group members share the same statistics */
+      for (unsigned int j = 0; j < groups[i].size(); ++j) {
+        stat_funcs.push_back(groups[i][j]->inner());
+        stat_offsets.push_back(n_stats);
+      }
+      group_offsets.push_back(n_stats);
+      n_stats += group_n_stats;
+    } else
+      group_offsets.push_back(-1);
+  }
+
+  double * stats = NULL;
+  if (n_stats > 0) {
+    stats = new double[n_stats];
+    try {
+      sequences->collect_stats(stat_funcs, stat_offsets, n_stats, stats);
+    } catch (QHMMException & e) {
+      delete[] stats;
+      throw;
+    }
+  }
+
+  try {
+    for (unsigned int i = 0; i < groups.size(); ++i) {
+      EmissionFunction * head = groups[i][0];
+
+      if (group_offsets[i] >= 0)
+        head->updateParams(&groups[i], stats + group_offsets[i]);
+      else
+        head->updateParams(sequences, &groups[i]);
+    }
+  } catch (QHMMException & e) {
+    if (stats != NULL)
+      delete[] stats;
+    throw;
+  }
+
+  if (stats != NULL)
+    delete[] stats;
+}
+
 EMResult HMM::em(std::vector<Iter*> & iters, double tolerance) {
+  return em(iters, EMOptions(tolerance));
+}
+
+/* SQUAREM step (Varadhan & Roland, 2008) from two successive EM updates
+   theta0 -> theta1 -> theta2: theta0 + 2 a r + a^2 v, where r = theta1 - theta0,
+   v = theta2 - 2 theta1 + theta0 and a = |r| / |v| (at most step_max)
+   a = 1 gives theta2; step_max starts at 1 and grows by SQUAREM_STEP_FACTOR
+   each time it caps the step (em shrinks it after rejected extrapolations)
+   returns false if the step doesn't go beyond theta2 */
+static const double SQUAREM_STEP_FACTOR = 4;
+
+static bool squarem_extrapolate(int n, const double * theta0, const double * theta1, const double * theta2, double * out, double & step_max) {
+  double r2 = 0, v2 = 0;
+
+  for (int i = 0; i < n; ++i) {
+    double r = theta1[i] - theta0[i];
+    double v = theta2[i] - 2 * theta1[i] + theta0[i];
+    r2 += r * r;
+    v2 += v * v;
+  }
+  if (!(v2 > 0))
+    return false;
+
+  double a = sqrt(r2 / v2);
+  if (a >= step_max) {
+    a = step_max;
+    step_max *= SQUAREM_STEP_FACTOR;
+  }
+  if (!(a > 1))
+    return false;
+
+  for (int i = 0; i < n; ++i) {
+    double r = theta1[i] - theta0[i];
+    double v = theta2[i] - 2 * theta1[i] + theta0[i];
+    out[i] = theta0[i] + 2 * a * r + a * a * v;
+  }
+  return true;
+}
+
+EMResult HMM::em(std::vector<Iter*> & iters, EMOptions const & options) {
   int iter_count = 0;
   double cur_loglik, prev_loglik;
   EMResult result;
@@ -70,37 +165,145 @@ EMResult HMM::em(std::vector<Iter*> & iters, double tolerance) {
   /* initialize result trace */
   result.param_trace = init_records();
   result.log_likelihood = new std::vector<double>();
+  result.estep_time = new std::vector<double>();
+  result.sequence_time = new std::vector<double>(iters.size(), 0.0);
 
   /* initialize sequences & fw/bk memory
      (handles spliting by missing data)
    */
-  EMSequences * sequences = new EMSequences(this, iters);
+  EMSequences * sequences = new EMSequences(this, iters, EMSequences::EMISSION_CACHE_LIMIT, options.checkpoint, options.checkpoint_length, options.split_length);
   skip_transitions = sequences->unitarySequences();
 
+  /* accelerated EM: the E-step after an extrapolation only keeps it if the
+     log-likelihood didn't decrease, otherwise it falls back to the plain
+     EM update theta2 */
+  ParamVector * params = NULL;
+  double * thetas = NULL; /* theta0, theta1, theta2, extrapolated */
+  int n_params = 0;
+  int sq_phase = 0; /* 0: at theta0, 1: at theta1, 2: at the extrapolation */
+  double step_max = 1;
+  if (options.accelerate) {
+    params = new ParamVector(transition_groups(), emission_groups());
+    n_params = params->size();
+    thetas = new double[4 * (n_params > 0 ? n_params : 1)];
+  }
+  double * theta0 = thetas;
+  double * theta1 = thetas + n_params;
+  double * theta2 = thetas + 2 * n_params;
+  double * theta_x = thetas + 3 * n_params;
+
+  /* collect expected transition counts during the backward pass if some
+     transition group can use them, the others scan the posteriors */
+  bool with_counts = false;
+  bool scan_transitions = false;
+  bool scan_free = false; /* some scanning group has free parameters */
+  if (!skip_transitions) {
+    std::vector<std::vector<TransitionFunction*> > tgroups = transition_groups();
+    for (unsigned int i = 0; i < tgroups.size(); ++i) {
+      if (tgroups[i][0]->usesCounts())
+        with_counts = true;
+      else {
+        scan_transitions = true;
+        
+        Params * par = tgroups[i][0]->getParams();
+        if (par != NULL && !par->isAllFixed())
+          scan_free = true;
+        if (par != NULL)
+          delete par;
+      }
+    }
+  }
+
+  /* incremental EM: sequences outside the batch only keep their posteriors
+     and transition counts, the transition posteriors scanned by the other
+     groups would be recomputed under the current parameters */
+  int n_batches = 1;
+  try {
+    if (!options.accelerate && options.n_batches > 1 && scan_free)
+      throw QHMMException("incremental EM needs transition groups that use counts", "EM", true, -1, -1, -1, -1);
+    n_batches = sequences->set_batches(options.accelerate ? 1 : options.n_batches);
+  } catch (QHMMException & e) {
+    delete sequences;
+    if (params != NULL) {
+      delete params;
+      delete[] thetas;
+    }
+    delete result.log_likelihood;
+    delete result.estep_time;
+    delete result.sequence_time;
+    delete_records(result.param_trace);
+    
+    if (e.stack.back() != "EM") /* not thrown by EM itself */
+      e.stack.push_back("EM");
+    throw;
+  }
+
+#ifdef _OPENMP
+  int prev_threads = omp_get_max_threads();
+  if (options.n_threads > 0)
+    omp_set_num_threads(options.n_threads);
+#endif
+
   /* main EM loop */
   try {
     prev_loglik = -std::numeric_limits<double>::infinity();
+    int batch = -1; /* first E-step covers all sequences */
     while (1) {
       ++iter_count;
       
-      /* compute forward/backward per sequence => get log-lik */
-      cur_loglik = sequences->updateFwBk();
+      /* compute forward/backward per sequence => get log-lik
+         (incremental EM: only for the current batch, the others keep
+          the statistics from their last refresh) */
+      cur_loglik = sequences->updateFwBk(with_counts, batch);
+      result.estep_time->push_back(sequences->time());
+      for (int i = 0; i < sequences->size(); ++i)
+        (*result.sequence_time)[i] += sequences->time(i);
+      
+      /* check extrapolation */
+      if (sq_phase == 2) {
+        sq_phase = 0;
+        if (!(cur_loglik >= prev_loglik)) {
+          printf("[%d] loglik: %g (rejected)\n", iter_count, cur_loglik);
+          step_max = std::max(1.0, step_max / SQUAREM_STEP_FACTOR);
+          params->set(theta2);
+          refresh_transition_table();
+          continue;
+        }
+      }
       
       /* output cur_loglik & store current parameters */
       update_records(result.param_trace);
       result.log_likelihood->push_back(cur_loglik);
       printf("[%d] loglik: %g\n", iter_count, cur_loglik);
       
-      /* check log-lik */
-      if (cur_loglik < prev_loglik ||
-          cur_loglik - prev_loglik < tolerance)
-        break;
+      /* check log-lik
+         (incremental EM: once every sequence was refreshed, i.e., at the
+          end of each sweep over the batches; the sequences of a sweep were
+          refreshed under different parameters, so instead of stopping it
+          continues with full E-steps until plain EM converges) */
+      if (batch < 0 || batch == n_batches - 1) {
+        if (cur_loglik < prev_loglik ||
+            cur_loglik - prev_loglik < options.tolerance) {
+          if (n_batches == 1)
+            break;
+          n_batches = 1;
+          batch = -1;
+          prev_loglik = -std::numeric_limits<double>::infinity();
+        } else
+          prev_loglik = cur_loglik;
+      }
+      
+      if (sq_phase == 0 && params != NULL)
+        params->get(theta0);
       
       /* update parameters */
       
       /* - transition functions */
       if (!skip_transitions) {
         std::vector<std::vector<TransitionFunction*> > tgroups = transition_groups();
+        
+        if (scan_transitions)
+          sequences->update_local_loglik(); /* shared by the concurrent updates */
 #ifdef _OPENMP
         QHMMThreadHelper helper;
         
@@ -134,28 +337,38 @@ EMResult HMM::em(std::vector<Iter*> & iters, double tolerance) {
           head->updateParams(sequences, &group_i);
         }
 #endif
-        refresh_transition_table(); // refresh internal caches
       }
       
-      /* - emission functions */
-      std::vector<std::vector<EmissionFunction*> > groups = emission_groups();
-      std::vector<std::vector<EmissionFunction*> >::iterator it;
-      for (it = groups.begin(); it != groups.end(); ++it) {
-        std::vector<EmissionFunction*> group_i = *it;
-        EmissionFunction * head = group_i[0];
-        
-        head->updateParams(sequences, &group_i);
-      }
+      /* - emission functions
+         (before refreshing the transition table: checkpointed sequences
+          recompute their posteriors under the E-step transitions) */
+      update_emission_params(sequences, emission_groups());
+      if (!skip_transitions)
+        refresh_transition_table(); // refresh internal caches
       
       /* */
-      prev_loglik = cur_loglik;
+      if (n_batches > 1)
+        batch = (batch + 1) % n_batches;
+      
+      /* - extrapolation */
+      if (sq_phase == 0 && params != NULL) {
+        params->get(theta1);
+        sq_phase = 1;
+      } else if (sq_phase == 1) {
+        params->get(theta2);
+        sq_phase = 0;
+        if (squarem_extrapolate(n_params, theta0, theta1, theta2, theta_x, step_max) && params->set(theta_x)) {
+          refresh_transition_table();
+          sq_phase = 2;
+        }
+      }
       
       /* check things went ok */
-      if (prev_loglik == -std::numeric_limits<double>::infinity()) {
+      if (cur_loglik == -std::numeric_limits<double>::infinity()) {
         printf("-Inf log likelihood! Aborted!\n");
         break;
       }
-      if (std::isnan(prev_loglik)) {
+      if (std::isnan(cur_loglik)) {
         printf("NaN log likelihood! Aborted!\n");
         break;
       }
@@ -163,7 +376,16 @@ EMResult HMM::em(std::vector<Iter*> & iters, double tolerance) {
   } catch (QHMMException & e) {
     // clean up memory
     delete sequences;
+    if (params != NULL) {
+      delete params;
+      delete[] thetas;
+    }
+#ifdef _OPENMP
+    omp_set_num_threads(prev_threads);
+#endif
     delete result.log_likelihood;
+    delete result.estep_time;
+    delete result.sequence_time;
     delete_records(result.param_trace);
     
     e.stack.push_back("EM");
@@ -172,6 +394,13 @@ EMResult HMM::em(std::vector<Iter*> & iters, double tolerance) {
 
   /* clean up */
   delete sequences;
+  if (params != NULL) {
+    delete params;
+    delete[] thetas;
+  }
+#ifdef _OPENMP
+  omp_set_num_threads(prev_threads);
+#endif
   
   return result;
 }
@@ -0,0 +1,207 @@
+#ifndef HMMSCALEDTMPL_HPP
+#define HMMSCALEDTMPL_HPP
+
+#include "hmm_tmpl.hpp"
+
+//
+// Forward/Backward engine using linear space probabilities with per column
+// scaling factors (Rabiner scaling).
+//
+// Each column is normalized to sum to one and the log of the scaling factors
+// is accumulated, so the inner loops only perform multiplications and
+// additions instead of a log-sum-exp per cell. Emission log probabilities are
+// shifted by their column maximum before exponentiation to avoid underflow.
+//
+// Output matrices are converted back to log space:
+//   log f_k(i) = log f^_k(i) + sum_{j <= i} log c_j
+// so the results can be used interchangeably with those of HMMImpl
+// (posteriors, EM, stochastic backtrace, ...).
+//
+template <typename InnerFwd, typename InnerBck, typename FuncAkl, typename FuncEkb>
+class HMMScaledImpl : public HMMImpl<InnerFwd, InnerBck, FuncAkl, FuncEkb> {
+  typedef HMMImpl<InnerFwd, InnerBck, FuncAkl, FuncEkb> Base;
+  typedef typename Base::EmissionBlock EmissionBlock;
+
+  public:
+    HMMScaledImpl(InnerFwd innerFwd, InnerBck innerBck, FuncAkl logAkl, FuncEkb logEkb, double * init_log_probs) : Base(innerFwd, innerBck, logAkl, logEkb, init_log_probs) {}
+
+    double forward(Iter & iter, double * matrix, const double * log_emissions = NULL, Workspace * workspace = NULL) const {
+      return forward_segment(iter, 0, iter.length() - 1, NULL, matrix, log_emissions, workspace);
+    }
+
+    double forward_segment(Iter & iter, int start, int end, const double * fw_prev, double * matrix, const double * log_emissions = NULL, Workspace * workspace = NULL) const {
+      Workspace::Scope ws(workspace);
+      const int n_states = this->_n_states;
+      double * col = ws->doubles(n_states);
+      double * col_prev = ws->doubles(n_states);
+      double * akl_buffer = this->block_buffer(ws.get(), false);
+      double * m_col = matrix;
+      const double * e_col;
+      double log_scale;
+      int first = start;
+      EmissionBlock e_block = this->emission_block(log_emissions, ws.get(), start, end, false);
+      iter.seek(start);
+
+      try {
+        if (start == 0) {
+          /* border conditions - position i = 0
+           * f_k(0) = e_k(0) * a0k
+           * (already in log space, no need to convert back)
+           */
+          e_col = this->emission_column(iter, log_emissions, e_block);
+          for (int k = 0; k < n_states; ++k)
+            m_col[k] = e_col[k] + this->_init_log_probs[k];
+          log_scale = normalize(m_col, col);
+
+          ++first;
+          m_col += n_states;
+          iter.next();
+        } else
+          log_scale = normalize(fw_prev, col); /* resume from checkpoint */
+
+        /* inner cells */
+        for (int i = first; i <= end; ++i, m_col += n_states, iter.next()) {
+          double * tmp = col_prev;
+          col_prev = col;
+          col = tmp;
+
+          e_col = this->emission_column(iter, log_emissions, e_block);
+          double emax = column_max(e_col);
+
+          if (emax == -std::numeric_limits<double>::infinity()) {
+            for (int l = 0; l < n_states; ++l)
+              col[l] = 0;
+          } else {
+            const double * akl = this->_logAkl->block(iter, akl_buffer);
+
+            for (int l = 0; l < n_states; ++l)
+              col[l] = exp(e_col[l] - emax) * this->_innerFwd->scaled(n_states, col_prev, l, akl + l*n_states);
+          }
+
+          log_scale += emax + rescale(col);
+          to_log_space(col, log_scale, m_col);
+        }
+      } catch (QHMMException & e) {
+        e.stack.push_back("forward (scaled)");
+        throw;
+      }
+
+      /* log-likelihood: last column sums to one in scaled space */
+      return log_scale;
+    }
+
+    void backward_segment(Iter & iter, int start, int end, const double * bk_next, double * matrix, const double * log_emissions = NULL, Workspace * workspace = NULL) const {
+      Workspace::Scope ws(workspace);
+      const int n_states = this->_n_states;
+      const int last = iter.length() - 1;
+      double * col = ws->doubles(n_states);
+      double * col_next = ws->doubles(n_states);
+      double * e_next = ws->doubles(n_states);
+      double * akl_buffer = this->block_buffer(ws.get(), false);
+      double * m_col = matrix + (end - start)*n_states;
+      double log_scale = 0;
+      int first = end;
+      EmissionBlock e_block = this->emission_block(log_emissions, ws.get(), start + 1, (end < last ? end + 1 : end), true);
+
+      /* column i depends on the transitions and emissions at i + 1 */
+      iter.seek(end < last ? end + 1 : end);
+
+      if (end == last) {
+        /* border conditions @ position = N - 1*/
+        for (int k = 0; k < n_states; ++k) {
+          m_col[k] = 0; /* log(1) */
+          col[k] = 1;
+        }
+        --first;
+        m_col -= n_states;
+      } else
+        log_scale = normalize(bk_next, col); /* resume from checkpoint */
+
+      try {
+        /* inner cells */
+        for (int i = first; i >= start; --i, m_col -= n_states, iter.prev()) {
+          double * tmp = col_next;
+          col_next = col;
+          col = tmp;
+
+          /* scaled emissions at next position */
+          const double * e_col = this->emission_column(iter, log_emissions, e_block);
+          double emax = column_max(e_col);
+
+          if (emax == -std::numeric_limits<double>::infinity()) {
+            for (int k = 0; k < n_states; ++k)
+              col[k] = 0;
+          } else {
+            const double * akl = this->_logAkl->block_rows(iter, akl_buffer);
+
+            for (int l = 0; l < n_states; ++l)
+              e_next[l] = exp(e_col[l] - emax);
+
+            for (int k = 0; k < n_states; ++k)
+              col[k] = this->_innerBck->scaled(n_states, col_next, k, akl + k*n_states, e_next);
+          }
+
+          log_scale += emax + rescale(col);
+          to_log_space(col, log_scale, m_col);
+        }
+      } catch (QHMMException & e) {
+        e.stack.push_back("backward (scaled)");
+        throw;
+      }
+    }
+
+  private:
+
+    double column_max(const double * log_col) const {
+      double max = -std::numeric_limits<double>::infinity();
+
+      for (int i = 0; i < this->_n_states; ++i)
+        if (log_col[i] > max)
+          max = log_col[i];
+      return max;
+    }
+
+    /* scales column to sum to one, returns log of scaling factor */
+    double rescale(double * col) const {
+      double sum = 0;
+
+      for (int i = 0; i < this->_n_states; ++i)
+        sum += col[i];
+
+      if (sum == 0)
+        return -std::numeric_limits<double>::infinity();
+
+      for (int i = 0; i < this->_n_states; ++i)
+        col[i] /= sum;
+      return log(sum);
+    }
+
+    /* converts log column into a normalized linear column, returns log of scaling factor */
+    double normalize(const double * log_col, double * col) const {
+      double max = column_max(log_col);
+
+      if (max == -std::numeric_limits<double>::infinity()) {
+        for (int i = 0; i < this->_n_states; ++i)
+          col[i] = 0;
+        return max;
+      }
+
+      for (int i = 0; i < this->_n_states; ++i)
+        col[i] = exp(log_col[i] - max);
+
+      return max + rescale(col);
+    }
+
+    void to_log_space(const double * col, double log_scale, double * log_col) const {
+      for (int i = 0; i < this->_n_states; ++i)
+        log_col[i] = log(col[i]) + log_scale;
+    }
+};
+
+// auxiliary function to enable type inference
+template <typename InnerFwd, typename InnerBck, typename FuncAkl, typename FuncEkb>
+HMM * new_scaled_hmm_instance(InnerFwd innerFwd, InnerBck innerBck, FuncAkl logAkl, FuncEkb logEkb, double * init_log_probs) {
+  return new HMMScaledImpl<InnerFwd, InnerBck, FuncAkl, FuncEkb>(innerFwd, innerBck, logAkl, logEkb, init_log_probs);
+}
+
+#endif
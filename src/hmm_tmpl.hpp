@@ -5,12 +5,16 @@
 #include "inner_tmpl.hpp"
 #include "func_table.hpp"
 #include "hmm.hpp"
+#include "QHMMThreadHelper.hpp"
+#include "workspace.hpp"
 
 #include "math.hpp"
+#include <stdint.h>
+#include <cstring>
 
 template <typename InnerFwd, typename InnerBck, typename FuncAkl, typename FuncEkb>
 class HMMImpl : public HMM {
-  private:
+  protected:
     const int _n_states;
     const FuncAkl _logAkl;
     const FuncEkb _logEkb;
@@ -18,7 +22,6 @@ class HMMImpl : public HMM {
     const InnerBck _innerBck;
     
     double * _init_log_probs;
-  protected:
   
     virtual const std::vector<std::vector<EmissionFunction*> > & emission_groups() const {
       return _logEkb->groups();
@@ -31,6 +34,235 @@ class HMMImpl : public HMM {
     virtual void refresh_transition_table() {
       return _logAkl->refresh();
     }
+    
+    // emission log-probabilities at the current position: taken from the
+    // precomputed emission matrix if available, otherwise evaluated into buffer
+    const double * emission_column(Iter const & iter, const double * log_emissions, double * buffer) const {
+      if (log_emissions != NULL)
+        return log_emissions + iter.index() * _n_states;
+      
+      _logEkb->log_probabilities(iter, buffer);
+      return buffer;
+    }
+    
+    // emission columns for a pass over positions [first, last], evaluated
+    // EMISSION_BLOCK positions at a time in the direction of the pass
+    // (positions with all slots missing share a column of zeros if the
+    // emission functions are missing data aware, so missing stretches are
+    // pure transition steps)
+    static const int EMISSION_BLOCK = 32;
+    
+    struct EmissionBlock {
+      double * values; // EMISSION_BLOCK columns (NULL with a precomputed emission matrix)
+      double * zeros; // NULL unless missing data aware
+      int first, last;
+      bool backward;
+      int start, count; // positions in values
+    };
+    
+    EmissionBlock emission_block(const double * log_emissions, Workspace * workspace, int first, int last, bool backward) const {
+      EmissionBlock block;
+      
+      block.values = (log_emissions == NULL ? workspace->doubles(EMISSION_BLOCK * _n_states) : NULL);
+      block.zeros = NULL;
+      if (log_emissions == NULL && _logEkb->missing_aware()) {
+        block.zeros = workspace->doubles(_n_states);
+        for (int k = 0; k < _n_states; ++k)
+          block.zeros[k] = 0; /* log(1) */
+      }
+      block.first = first;
+      block.last = last;
+      block.backward = backward;
+      block.start = 0;
+      block.count = 0;
+      return block;
+    }
+    
+    const double * emission_column(Iter const & iter, const double * log_emissions, EmissionBlock & block) const {
+      const int index = iter.index();
+      
+      if (log_emissions != NULL)
+        return log_emissions + index * _n_states;
+      
+      if (block.zeros != NULL && iter.all_missing())
+        return block.zeros;
+      
+      if (index < block.start || index >= block.start + block.count) {
+        int start, end;
+        
+        if (block.backward) {
+          end = index;
+          start = (index - EMISSION_BLOCK + 1 > block.first ? index - EMISSION_BLOCK + 1 : block.first);
+        } else {
+          start = index;
+          end = (index + EMISSION_BLOCK - 1 < block.last ? index + EMISSION_BLOCK - 1 : block.last);
+        }
+        
+        _logEkb->log_probability_block(iter, start - index, end - start + 1, block.values);
+        block.start = start;
+        block.count = end - start + 1;
+      }
+      return block.values + (index - block.start) * _n_states;
+    }
+  
+    // log-likelihood from the first backward column
+    double backward_loglik(Iter & iter, const double * matrix, const double * log_emissions, Workspace * workspace) const {
+      Workspace::Scope ws(workspace);
+      double * e_buffer = ws->doubles(_n_states);
+      const double * e_col;
+      LogSum * logsum = ws->logsum(_n_states);
+      
+      try {
+        iter.resetFirst();
+        e_col = emission_column(iter, log_emissions, e_buffer);
+        for (int k = 0; k < _n_states; ++k) {
+          double value = matrix[k] + _init_log_probs[k] + e_col[k];
+          logsum->store(value);
+        }
+      } catch (QHMMException & e) {
+        e.stack.push_back("backward");
+        throw;
+      }
+      
+      return logsum->compute();
+    }
+    
+    // transition block buffer (see TransitionTable::log_block)
+    double * block_buffer(Workspace * ws, bool log_space = true) const {
+      const int size = _logAkl->block_buffer_size();
+      if (size == 0)
+        return NULL;
+      
+      double * buffer = ws->doubles(size);
+      _logAkl->init_block_buffer(buffer, log_space);
+      return buffer;
+    }
+    
+    // segment layout for forward_parallel/backward_parallel: one segment per
+    // thread, returns false if the sequence is too short to be worth splitting
+    bool parallel_segments(int length, int n_threads, int & n_segs, int & seg_len) const {
+      if (n_threads <= 1 || length < 2 * n_threads)
+        return false;
+      
+      seg_len = (length + n_threads - 1) / n_threads;
+      n_segs = (length + seg_len - 1) / seg_len;
+      return n_segs > 1;
+    }
+    
+    void set_unit(double * col, int j) const {
+      for (int k = 0; k < _n_states; ++k)
+        col[k] = -std::numeric_limits<double>::infinity();
+      col[j] = 0; /* log(1) */
+    }
+    
+    // out[l] = log sum_j exp(transfer[j * n_states + l] + in[j])
+    void apply_transfer(const double * transfer, const double * in, double * out) const {
+      LogSum * logsum = LogSum::create(_n_states);
+      
+      for (int l = 0; l < _n_states; ++l) {
+        logsum->clear();
+        for (int j = 0; j < _n_states; ++j)
+          logsum->store(transfer[j * _n_states + l] + in[j]);
+        out[l] = logsum->compute();
+      }
+      
+      delete logsum;
+    }
+      
+    // runs with more steps than n_states per bit of their length are crossed by
+    // repeated squaring (n_states^3 per squaring, n_states^2 per plain step)
+    bool run_power(int steps) const {
+      int bits = 0;
+      for (int r = steps; r > 0; r >>= 1)
+        ++bits;
+      return steps > _n_states * bits;
+    }
+    
+    // step matrix at the current position of iter
+    // rows = false: target-major, step[l * n_states + k] = log a_kl + log e_l (forward)
+    // rows = true: source-major, step[k * n_states + l] = log a_kl + log e_l (backward)
+    void run_step(Iter const & iter, bool rows, double * step, double * akl_buffer, double * e_buffer) const {
+      const double * e_col = emission_column(iter, NULL, e_buffer);
+      
+      if (rows) {
+        const double * akl = _logAkl->log_block_rows(iter, akl_buffer);
+        for (int k = 0; k < _n_states; ++k)
+          for (int l = 0; l < _n_states; ++l)
+            step[k * _n_states + l] = akl[k * _n_states + l] + e_col[l];
+      } else {
+        const double * akl = _logAkl->log_block(iter, akl_buffer);
+        for (int l = 0; l < _n_states; ++l)
+          for (int k = 0; k < _n_states; ++k)
+            step[l * _n_states + k] = akl[l * _n_states + k] + e_col[l];
+      }
+    }
+    
+    // out[i] = log sum_j exp(m[i * n_states + j] + in[j])
+    void log_matvec(const double * m, const double * in, double * out, LogSum * logsum) const {
+      for (int i = 0; i < _n_states; ++i) {
+        logsum->clear();
+        for (int j = 0; j < _n_states; ++j)
+          logsum->store(m[i * _n_states + j] + in[j]);
+        out[i] = logsum->compute();
+      }
+    }
+    
+    // c = a b in log space (c must not overlap a or b)
+    void log_matmul(const double * a, const double * b, double * c, LogSum * logsum) const {
+      for (int i = 0; i < _n_states; ++i)
+        for (int l = 0; l < _n_states; ++l) {
+          logsum->clear();
+          for (int j = 0; j < _n_states; ++j)
+            logsum->store(a[i * _n_states + j] + b[j * _n_states + l]);
+          c[i * _n_states + l] = logsum->compute();
+        }
+    }
+    
+    // powers of the step matrix of one run value: level b holds step^(2^b)
+    struct RunPowers {
+      int value; // RunIter::run_value (-1 = none)
+      int levels;
+      std::vector<double> ladder;
+      
+      RunPowers() : value(-1), levels(0) {}
+    };
+    
+    // v = step^steps v (in place), tmp: n_states scratch values
+    // the ladder is kept across runs with the same value
+    void run_advance(double * v, const double * step, int steps, int value, RunPowers & powers, double * tmp, LogSum * logsum) const {
+      const int size = _n_states * _n_states;
+      
+      if (!run_power(steps)) {
+        for (int t = 0; t < steps; ++t) {
+          log_matvec(step, v, tmp, logsum);
+          memcpy(v, tmp, sizeof(double) * _n_states);
+        }
+        return;
+      }
+      
+      if (powers.value != value) {
+        powers.value = value;
+        powers.levels = 0;
+      }
+      if (powers.levels == 0) {
+        powers.ladder.resize(size);
+        memcpy(&powers.ladder[0], step, sizeof(double) * size);
+        powers.levels = 1;
+      }
+      
+      for (int b = 0; steps > 0; ++b, steps >>= 1) {
+        if (b == powers.levels) {
+          powers.ladder.resize((b + 1) * size);
+          log_matmul(&powers.ladder[(b - 1) * size], &powers.ladder[(b - 1) * size], &powers.ladder[b * size], logsum);
+          ++powers.levels;
+        }
+        
+        if (steps & 1) {
+          log_matvec(&powers.ladder[b * size], v, tmp, logsum);
+          memcpy(v, tmp, sizeof(double) * _n_states);
+        }
+      }
+    }
   
   public:
     HMMImpl(InnerFwd innerFwd, InnerBck innerBck, FuncAkl logAkl, FuncEkb logEkb, double * init_log_probs) : _n_states(logAkl->n_states()), _logAkl(logAkl), _logEkb(logEkb), _innerFwd(innerFwd), _innerBck(innerBck), _init_log_probs(init_log_probs) { }
@@ -57,95 +289,330 @@ class HMMImpl : public HMM {
         _init_log_probs[i] = log(probs[i]);
     }
     
-    double forward(Iter & iter, double * matrix) const {
-      double * m_col, * m_col_prev;
-      LogSum * logsum = LogSum::create(_n_states);
-      iter.resetFirst();
+    double forward(Iter & iter, double * matrix, const double * log_emissions = NULL, Workspace * workspace = NULL) const {
+      return forward_segment(iter, 0, iter.length() - 1, NULL, matrix, log_emissions, workspace);
+    }
+
+    double forward_segment(Iter & iter, int start, int end, const double * fw_prev, double * matrix, const double * log_emissions = NULL, Workspace * workspace = NULL) const {
+      Workspace::Scope ws(workspace);
+      double * m_col = matrix;
+      const double * m_col_prev = fw_prev;
+      const double * e_col;
+      LogSum * logsum = ws->logsum(_n_states);
+      double * akl_buffer = block_buffer(ws.get());
+      EmissionBlock e_block = emission_block(log_emissions, ws.get(), start, end, false);
+      iter.seek(start);
     
       try {
-        /* border conditions - position i = 0
-         * f_k(0) = e_k(0) * a0k
-         * log f_k(0) = log e_k(0) + log a0k
-         */
-        m_col = matrix;
-        for (int k = 0; k < _n_states; ++k)
-          m_col[k] = (*_logEkb)(iter, k) + _init_log_probs[k];
-        
-        /* inner cells */
-        m_col_prev = m_col;
-        m_col += _n_states;
-        for (; iter.next(); m_col_prev += _n_states, m_col += _n_states) {
-          for (int l = 0; l < _n_states; ++l)
-            m_col[l] = (*_logEkb)(iter, l) + (*_innerFwd)(_n_states, m_col_prev, l, iter, _logAkl, logsum);
+        for (int i = start; i <= end; ++i, m_col_prev = m_col, m_col += _n_states, iter.next()) {
+          e_col = emission_column(iter, log_emissions, e_block);
+          
+          if (i == 0) {
+            /* border conditions - position i = 0
+             * f_k(0) = e_k(0) * a0k
+             * log f_k(0) = log e_k(0) + log a0k
+             */
+            for (int k = 0; k < _n_states; ++k)
+              m_col[k] = e_col[k] + _init_log_probs[k];
+          } else {
+            /* inner cells */
+            const double * akl = _logAkl->log_block(iter, akl_buffer);
+            
+            for (int l = 0; l < _n_states; ++l)
+              m_col[l] = e_col[l] + (*_innerFwd)(_n_states, m_col_prev, l, akl + l*_n_states, logsum);
+          }
         }
-        
       } catch (QHMMException & e) {
-        // clean up
-        delete logsum;
-        
         e.stack.push_back("forward");
         throw;
       }
       
-      /* log-likelihood */
+      /* log-likelihood (up to end) */
       logsum->clear();
-      m_col = matrix + (iter.length() - 1)*_n_states;
+      m_col = matrix + (end - start)*_n_states;
       for (int i = 0; i < _n_states; ++i)
         logsum->store(m_col[i]);
-      double loglik = logsum->compute();
+      
+      return logsum->compute();
+    }
 
-      // clean up
-      delete logsum;
+    double backward(Iter & iter, double * matrix, const double * log_emissions = NULL, Workspace * workspace = NULL) const {
+      backward_segment(iter, 0, iter.length() - 1, NULL, matrix, log_emissions, workspace);
+      return backward_loglik(iter, matrix, log_emissions, workspace);
+    }
+
+    void backward_segment(Iter & iter, int start, int end, const double * bk_next, double * matrix, const double * log_emissions = NULL, Workspace * workspace = NULL) const {
+      Workspace::Scope ws(workspace);
+      const int last = iter.length() - 1;
+      double * m_col = matrix + (end - start)*_n_states;
+      const double * m_col_next = bk_next;
+      const double * e_next;
+      LogSum * logsum = ws->logsum(_n_states);
+      double * akl_buffer = block_buffer(ws.get());
+      EmissionBlock e_block = emission_block(log_emissions, ws.get(), start + 1, (end < last ? end + 1 : end), true);
       
-      return loglik;
+      /* column i depends on the transitions and emissions at i + 1 */
+      iter.seek(end < last ? end + 1 : end);
+
+      try {
+        for (int i = end; i >= start; --i, m_col_next = m_col, m_col -= _n_states) {
+          if (i == last) {
+            /* border conditions @ position = N - 1*/
+            for (int k = 0; k < _n_states; ++k)
+              m_col[k] = 0; /* log(1) */
+          } else {
+            /* inner cells */
+            const double * akl = _logAkl->log_block_rows(iter, akl_buffer);
+            e_next = emission_column(iter, log_emissions, e_block);
+            
+            for (int k = 0; k < _n_states; ++k)
+              m_col[k] = (*_innerBck)(_n_states, m_col_next, k, akl + k*_n_states, e_next, logsum);
+            iter.prev();
+          }
+        }
+      } catch (QHMMException & e) {
+        e.stack.push_back("backward");
+        throw;
+      }
     }
 
-    double backward(Iter & iter, double * matrix) const {
-      double * m_col, * m_col_next;
-      LogSum * logsum = LogSum::create(_n_states);
+    double backward_counts(Iter & iter, const double * fw, double * matrix, double * counts, const double * log_emissions = NULL, Workspace * workspace = NULL) const {
+      Workspace::Scope ws(workspace);
+      const int last = iter.length() - 1;
+      double * m_col = matrix + last*_n_states;
+      double * e_bk = ws->doubles(_n_states);
+      LogSum * logsum = ws->logsum(_n_states);
+      double * akl_buffer = block_buffer(ws.get());
+      EmissionBlock e_block = emission_block(log_emissions, ws.get(), 1, last, true);
       
       /* border conditions @ position = N - 1*/
-      m_col = matrix + (iter.length() - 1)*_n_states;
       for (int k = 0; k < _n_states; ++k)
         m_col[k] = 0; /* log(1) */
-
+      
+      /* column i depends on the transitions and emissions at i + 1 */
+      iter.resetLast();
+      
       try {
-        /* inner cells */
-        iter.resetLast();
-        m_col_next = m_col;
-        m_col -= _n_states;
-        for (; m_col >= matrix; m_col_next -= _n_states, m_col -= _n_states, iter.prev()) {
+        for (int i = last - 1; i >= 0; --i, iter.prev()) {
+          const double * m_col_next = m_col;
+          m_col -= _n_states;
+          
+          const double * akl = _logAkl->log_block_rows(iter, akl_buffer);
+          const double * e_next = emission_column(iter, log_emissions, e_block);
           
           for (int k = 0; k < _n_states; ++k)
-            m_col[k] = (*_innerBck)(_n_states, m_col_next, k, iter, _logAkl, _logEkb, logsum);
-        }
-        
-        /* log-likelihood */
-        m_col = matrix;
-        logsum->clear();
-        iter.resetFirst();
-        for (int k = 0; k < _n_states; ++k) {
-          double value = m_col[k] + _init_log_probs[k] + (*_logEkb)(iter, k);
-          logsum->store(value);
+            m_col[k] = (*_innerBck)(_n_states, m_col_next, k, akl + k*_n_states, e_next, logsum);
+          
+          /* transitions i -> i + 1, normalized by the local likelihood at
+             the target (same as transition_posterior) */
+          const double * fw_src = fw + i*_n_states;
+          const double * fw_tgt = fw_src + _n_states;
+          
+          logsum->clear();
+          for (int l = 0; l < _n_states; ++l) {
+            logsum->store(fw_tgt[l] + m_col_next[l]);
+            e_bk[l] = e_next[l] + m_col_next[l];
+          }
+          double logPx = logsum->compute();
+          
+          for (int k = 0; k < _n_states; ++k) {
+            const TransitionFunction * func = _logAkl->function(k);
+            const int * tgt = func->targets();
+            const double * akl_k = akl + k*_n_states;
+            double * c_k = counts + k*_n_states;
+            double base = fw_src[k] - logPx;
+            
+            for (int j = 0; j < func->n_targets(); ++j) {
+              int l = tgt[j];
+              c_k[l] += exp(base + akl_k[l] + e_bk[l]);
+            }
+          }
         }
       } catch (QHMMException & e) {
-        // clean up
-        delete logsum;
-        
-        e.stack.push_back("backward");
+        e.stack.push_back("backward (counts)");
         throw;
       }
-      double loglik = logsum->compute();
+      
+      return backward_loglik(iter, matrix, log_emissions, ws.get());
+    }
 
-      // clean-up
-      delete logsum;
+    double forward_parallel(Iter & iter, double * matrix, int n_threads, const double * log_emissions = NULL) const {
+      const int K = _n_states;
+      int n_segs, seg_len;
+      
+#ifndef _OPENMP
+      n_threads = 1;
+#endif
+      if (!parallel_segments(iter.length(), n_threads, n_segs, seg_len))
+        return forward(iter, matrix, log_emissions);
+      
+      double * transfer = new double[K * K * n_segs];
+      double * boundary = new double[K * n_segs];
+      double loglik = 0;
+      QHMMThreadHelper helper;
+      
+      /* 1. segment 0 from the initial probabilities; segments 1 .. n - 2 are
+            started from each unit vector to get their (log) transfer matrix:
+            column j of transfer s is the last forward column given state j
+            at the previous position. The output matrix is used as scratch. */
+      #pragma omp parallel num_threads(n_threads) shared(helper)
+      {
+        Iter * it = iter.shallowCopy();
+        Workspace workspace; /* reused across unit vector passes */
+        double * unit = new double[K];
+        
+        #pragma omp for schedule(dynamic, 1)
+        for (int s = 0; s < n_segs - 1; ++s) {
+          int start = s * seg_len;
+          int end = start + seg_len - 1;
+          double * out = matrix + start * K;
+          double * last_col = out + (end - start) * K;
+          
+          try {
+            if (s == 0) {
+              forward_segment(*it, start, end, NULL, out, log_emissions, &workspace);
+              memcpy(boundary, last_col, sizeof(double) * K);
+            } else {
+              for (int j = 0; j < K; ++j) {
+                set_unit(unit, j);
+                forward_segment(*it, start, end, unit, out, log_emissions, &workspace);
+                memcpy(transfer + (s * K + j) * K, last_col, sizeof(double) * K);
+              }
+            }
+          } catch (QHMMException & e) {
+            helper.captureException(e);
+          }
+        }
+        
+        delete[] unit;
+        delete it;
+      }
+      
+      /* 2. stitch boundary columns (sequential, O(n_segs * K^2)) */
+      if (!helper.failed())
+        for (int s = 1; s < n_segs - 1; ++s)
+          apply_transfer(transfer + s * K * K, boundary + (s - 1) * K, boundary + s * K);
+      
+      /* 3. recompute segments 1 .. n - 1 from the true boundary columns */
+      if (!helper.failed()) {
+        #pragma omp parallel num_threads(n_threads) shared(helper, loglik)
+        {
+          Iter * it = iter.shallowCopy();
+          
+          #pragma omp for schedule(dynamic, 1)
+          for (int s = 1; s < n_segs; ++s) {
+            int start = s * seg_len;
+            int end = (s == n_segs - 1 ? iter.length() - 1 : start + seg_len - 1);
+            
+            try {
+              double value = forward_segment(*it, start, end, boundary + (s - 1) * K, matrix + start * K, log_emissions);
+              if (s == n_segs - 1)
+                loglik = value;
+            } catch (QHMMException & e) {
+              helper.captureException(e);
+            }
+          }
+          
+          delete it;
+        }
+      }
+      
+      delete[] transfer;
+      delete[] boundary;
       
+      helper.rethrow();
       return loglik;
     }
 
+    double backward_parallel(Iter & iter, double * matrix, int n_threads, const double * log_emissions = NULL) const {
+      const int K = _n_states;
+      const int last = iter.length() - 1;
+      int n_segs, seg_len;
+      
+#ifndef _OPENMP
+      n_threads = 1;
+#endif
+      if (!parallel_segments(iter.length(), n_threads, n_segs, seg_len))
+        return backward(iter, matrix, log_emissions);
+      
+      double * transfer = new double[K * K * n_segs];
+      double * boundary = new double[K * n_segs];
+      QHMMThreadHelper helper;
+      
+      /* 1. last segment from the end of the sequence; segments n - 2 .. 1 are
+            started from each unit vector to get their (log) transfer matrix:
+            column j of transfer s is the first backward column given state j
+            at the next position. */
+      #pragma omp parallel num_threads(n_threads) shared(helper)
+      {
+        Iter * it = iter.shallowCopy();
+        Workspace workspace; /* reused across unit vector passes */
+        double * unit = new double[K];
+        
+        #pragma omp for schedule(dynamic, 1)
+        for (int s = n_segs - 1; s >= 1; --s) {
+          int start = s * seg_len;
+          int end = (s == n_segs - 1 ? last : start + seg_len - 1);
+          double * out = matrix + start * K;
+          
+          try {
+            if (s == n_segs - 1) {
+              backward_segment(*it, start, end, NULL, out, log_emissions, &workspace);
+              memcpy(boundary + s * K, out, sizeof(double) * K);
+            } else {
+              for (int j = 0; j < K; ++j) {
+                set_unit(unit, j);
+                backward_segment(*it, start, end, unit, out, log_emissions, &workspace);
+                memcpy(transfer + (s * K + j) * K, out, sizeof(double) * K);
+              }
+            }
+          } catch (QHMMException & e) {
+            helper.captureException(e);
+          }
+        }
+        
+        delete[] unit;
+        delete it;
+      }
+      
+      /* 2. stitch boundary columns (sequential, O(n_segs * K^2)) */
+      if (!helper.failed())
+        for (int s = n_segs - 2; s >= 1; --s)
+          apply_transfer(transfer + s * K * K, boundary + (s + 1) * K, boundary + s * K);
+      
+      /* 3. recompute segments 0 .. n - 2 from the true boundary columns */
+      if (!helper.failed()) {
+        #pragma omp parallel num_threads(n_threads) shared(helper)
+        {
+          Iter * it = iter.shallowCopy();
+          
+          #pragma omp for schedule(dynamic, 1)
+          for (int s = 0; s < n_segs - 1; ++s) {
+            int start = s * seg_len;
+            int end = start + seg_len - 1;
+            
+            try {
+              backward_segment(*it, start, end, boundary + (s + 1) * K, matrix + start * K, log_emissions);
+            } catch (QHMMException & e) {
+              helper.captureException(e);
+            }
+          }
+          
+          delete it;
+        }
+      }
+      
+      delete[] transfer;
+      delete[] boundary;
+      
+      helper.rethrow();
+      return backward_loglik(iter, matrix, log_emissions, NULL);
+    }
+
 #define AT(M, I, J) M[(I) + (J)*rows]
 
-    void viterbi(Iter & iter, int * path) const {
+    void viterbi(Iter & iter, int * path, Workspace * workspace = NULL) const {
+      Workspace::Scope ws(workspace);
       int rows = _n_states; /* needed by AT macro */
       int cols = iter.length();
       double * m_col, * m_col_prev;
@@ -153,15 +620,22 @@ class HMMImpl : public HMM {
       int * backptr;
       int * pptr;
       double * matrix;
+      double * akl_buffer;
+      double * e_col;
 
-      /* setup matrices */
+      /* setup matrices
+         (O(n_states * length): kept out of the workspace, which is
+          retained across calls) */
       matrix = new double[rows*cols];
       backptr = new int[rows*cols];
+      akl_buffer = block_buffer(ws.get());
+      e_col = ws->doubles(rows);
 
       /* fill first column */
       iter.resetFirst();
+      _logEkb->log_probabilities(iter, e_col);
       for (int l = 0; l < _n_states; ++l) {
-        AT(matrix, l, 0) = (*_logEkb)(iter, l) + _init_log_probs[l];
+        AT(matrix, l, 0) = e_col[l] + _init_log_probs[l];
         AT(backptr, l, 0) = -1; /* stop */
       }
 
@@ -171,30 +645,21 @@ class HMMImpl : public HMM {
         m_col = matrix + rows;
         b_col = backptr + rows;
         for ( ; iter.next(); m_col += rows, m_col_prev += rows, b_col += rows) {
+          const double * akl = _logAkl->log_block(iter, akl_buffer);
+          _logEkb->log_probabilities(iter, e_col);
           
           for (int l = 0; l < _n_states; ++l) {
-            double max = -std::numeric_limits<double>::infinity();
-            int argmax = -1;
-            
-            for (int k = 0; k < _n_states; ++k) {
-              double value = m_col_prev[k] + (*_logAkl)(iter, k, l);
-              
-              if (value > max) {
-                max = value;
-                argmax = k;
-              }
-            }
+            int argmax;
+            double max = _innerFwd->best(_n_states, m_col_prev, l, akl + l*rows, argmax);
             
             /* assert(argmax != -1); */
-            m_col[l] = (*_logEkb)(iter, l) + max;
+            m_col[l] = e_col[l] + max;
             b_col[l] = argmax;
           }
         }
       } catch (QHMMException & e) {
-        // clean up
         delete[] matrix;
         delete[] backptr;
-        
         e.stack.push_back("viterbi");
         throw;
       }
@@ -230,14 +695,27 @@ class HMMImpl : public HMM {
         /* assert(prev >= 0); */
       }
       
-      // clean up
       delete[] matrix;
       delete[] backptr;
     }
+
+    void viterbi_online(Iter & iter, int * path, int window = 0, Workspace * workspace = NULL) const {
+      if (window <= 0)
+        window = VITERBI_ONLINE_WINDOW;
+
+      /* use the smallest backpointer type that can hold a state index */
+      if (_n_states <= 256)
+        viterbi_online_impl<uint8_t>(iter, path, window, workspace);
+      else if (_n_states <= 65536)
+        viterbi_online_impl<uint16_t>(iter, path, window, workspace);
+      else
+        viterbi_online_impl<int>(iter, path, window, workspace);
+    }
   
-    void state_posterior(Iter & iter, const double * const fw, const double * const bk, double * matrix) const {
+    void state_posterior(Iter & iter, const double * const fw, const double * const bk, double * matrix, Workspace * workspace = NULL) const {
+      Workspace::Scope ws(workspace);
       /* posterior matrix is filled, state by state */
-      LogSum * logsum = LogSum::create(_n_states);
+      LogSum * logsum = ws->logsum(_n_states);
       
       /* posterior_i,k = exp(fw[i,k] + bk[i,k] - logPx_i)
        
@@ -257,12 +735,159 @@ class HMMImpl : public HMM {
         for (int j = 0; j < _n_states; ++j)
           matrix[j*iter.length() + i] = exp(fw[i*_n_states + j] + bk[i*_n_states + j] - logPx);
       }
+    }
 
-      delete logsum;
+    double forward_runs(RunIter & riter, double * matrix, Workspace * workspace = NULL) const {
+      Workspace::Scope ws(workspace);
+      const int n_runs = riter.run_count();
+      LogSum * logsum = ws->logsum(_n_states, false);
+      double * akl_buffer = block_buffer(ws.get());
+      double * e_buffer = ws->doubles(_n_states);
+      double * step = ws->doubles(_n_states * _n_states);
+      double * tmp = ws->doubles(_n_states);
+      RunPowers powers;
+      
+      try {
+        riter.resetFirst();
+        for (int j = 0; j < n_runs; ++j, riter.next()) {
+          double * m_col = matrix + j * _n_states;
+          int steps = riter.run_length(j);
+          
+          if (j == 0) {
+            const double * e_col = emission_column(riter, NULL, e_buffer);
+            for (int k = 0; k < _n_states; ++k)
+              m_col[k] = e_col[k] + _init_log_probs[k];
+            --steps;
+          } else
+            memcpy(m_col, m_col - _n_states, sizeof(double) * _n_states);
+          
+          if (steps > 0) {
+            run_step(riter, false, step, akl_buffer, e_buffer);
+            run_advance(m_col, step, steps, riter.run_value(j), powers, tmp, logsum);
+          }
+        }
+      } catch (QHMMException & e) {
+        e.stack.push_back("forward_runs");
+        throw;
+      }
+      
+      logsum->clear();
+      for (int k = 0; k < _n_states; ++k)
+        logsum->store(matrix[(n_runs - 1) * _n_states + k]);
+      return logsum->compute();
+    }
+    
+    double backward_runs(RunIter & riter, double * matrix, Workspace * workspace = NULL) const {
+      Workspace::Scope ws(workspace);
+      const int n_runs = riter.run_count();
+      LogSum * logsum = ws->logsum(_n_states, false);
+      double * akl_buffer = block_buffer(ws.get());
+      double * e_buffer = ws->doubles(_n_states);
+      double * step = ws->doubles(_n_states * _n_states);
+      double * tmp = ws->doubles(_n_states);
+      double * b_first = ws->doubles(_n_states);
+      RunPowers powers;
+      
+      try {
+        double * m_col = matrix + (n_runs - 1) * _n_states;
+        for (int k = 0; k < _n_states; ++k)
+          m_col[k] = 0; /* log(1) */
+        
+        /* backward at the end of run j - 1 from the end of run j */
+        riter.resetLast();
+        for (int j = n_runs - 1; j > 0; --j, riter.prev()) {
+          m_col = matrix + (j - 1) * _n_states;
+          memcpy(m_col, m_col + _n_states, sizeof(double) * _n_states);
+          run_step(riter, true, step, akl_buffer, e_buffer);
+          run_advance(m_col, step, riter.run_length(j), riter.run_value(j), powers, tmp, logsum);
+        }
+        
+        /* first position */
+        memcpy(b_first, matrix, sizeof(double) * _n_states);
+        if (riter.run_length(0) > 1) {
+          run_step(riter, true, step, akl_buffer, e_buffer);
+          run_advance(b_first, step, riter.run_length(0) - 1, riter.run_value(0), powers, tmp, logsum);
+        }
+        
+        const double * e_col = emission_column(riter, NULL, e_buffer);
+        logsum->clear();
+        for (int k = 0; k < _n_states; ++k)
+          logsum->store(b_first[k] + _init_log_probs[k] + e_col[k]);
+      } catch (QHMMException & e) {
+        e.stack.push_back("backward_runs");
+        throw;
+      }
+      
+      return logsum->compute();
+    }
+    
+    void state_posterior_runs(RunIter & riter, const double * fw, const double * bk, double * matrix, Workspace * workspace = NULL) const {
+      Workspace::Scope ws(workspace);
+      const int n_runs = riter.run_count();
+      const int length = riter.sequence_length();
+      LogSum * logsum = ws->logsum(_n_states, false);
+      double * akl_buffer = block_buffer(ws.get());
+      double * akl_rows_buffer = block_buffer(ws.get()); /* invalid entries differ by layout */
+      double * e_buffer = ws->doubles(_n_states);
+      double * step_fw = ws->doubles(_n_states * _n_states);
+      double * step_bk = ws->doubles(_n_states * _n_states);
+      double * f = ws->doubles(_n_states);
+      double * b = ws->doubles(_n_states);
+      double * tmp = ws->doubles(_n_states);
+      
+      /* positions within a run are stepped one at a time: forward columns
+         are stored in matrix and combined with the backward columns on the
+         way back */
+      try {
+        riter.resetFirst();
+        for (int j = 0; j < n_runs; ++j, riter.next()) {
+          const int start = riter.run_start(j);
+          const int steps = riter.run_length(j);
+          
+          run_step(riter, false, step_fw, akl_buffer, e_buffer);
+          run_step(riter, true, step_bk, akl_rows_buffer, e_buffer);
+          
+          for (int t = 0; t < steps; ++t) {
+            if (t == 0 && j == 0) {
+              const double * e_col = emission_column(riter, NULL, e_buffer);
+              for (int k = 0; k < _n_states; ++k)
+                f[k] = e_col[k] + _init_log_probs[k];
+            } else {
+              log_matvec(step_fw, (t == 0 ? fw + (j - 1) * _n_states : f), tmp, logsum);
+              memcpy(f, tmp, sizeof(double) * _n_states);
+            }
+            
+            for (int k = 0; k < _n_states; ++k)
+              matrix[k * length + start + t] = f[k];
+          }
+          
+          memcpy(b, bk + j * _n_states, sizeof(double) * _n_states);
+          for (int t = steps - 1; t >= 0; --t) {
+            const int i = start + t;
+            
+            if (t < steps - 1) {
+              log_matvec(step_bk, b, tmp, logsum);
+              memcpy(b, tmp, sizeof(double) * _n_states);
+            }
+            
+            logsum->clear();
+            for (int k = 0; k < _n_states; ++k)
+              logsum->store(matrix[k * length + i] + b[k]);
+            double logPx = logsum->compute();
+            
+            for (int k = 0; k < _n_states; ++k)
+              matrix[k * length + i] = exp(matrix[k * length + i] + b[k] - logPx);
+          }
+        }
+      } catch (QHMMException & e) {
+        e.stack.push_back("state_posterior_runs");
+        throw;
+      }
     }
 
-    void local_loglik(Iter & iter, const double * const fw, const double * const bk, double * result) const {
-      LogSum * logsum = LogSum::create(_n_states);
+    void local_loglik(Iter & iter, const double * const fw, const double * const bk, double * result, Workspace * workspace = NULL) const {
+      Workspace::Scope ws(workspace);
+      LogSum * logsum = ws->logsum(_n_states);
 
       for (int i = 0; i < iter.length(); ++i) {
         logsum->clear();
@@ -270,15 +895,10 @@ class HMMImpl : public HMM {
           logsum->store(fw[i*_n_states + j] + bk[i*_n_states + j]);
         result[i] = logsum->compute();
       }
-
-      delete logsum;
     }
 
-    void transition_posterior(Iter & iter_at_target, const double * const fw, const double * const bk, double loglik, int n_src, const int * const src, int n_tgt, double * result) const {
+    void transition_posterior(Iter & iter_at_target, const double * const fw_src, const double * const bk_tgt, double loglik, int n_src, const int * const src, int n_tgt, double * result, const double * e_tgt = NULL) const {
 
-      int index_tgt = iter_at_target.index();
-      const double * const fw_src = fw + _n_states * (index_tgt - 1);
-      const double * const bk_tgt = bk + _n_states * index_tgt;
       double * rptr = result;
 
       for (int isrc = 0; isrc < n_src; ++isrc) {
@@ -287,7 +907,7 @@ class HMMImpl : public HMM {
         
         for (int itgt = 0; itgt < n_tgt; ++itgt, ++rptr) {
           int l = tgt[itgt];
-          double log_emission = (*_logEkb)(iter_at_target, l);
+          double log_emission = (e_tgt != NULL ? e_tgt[l] : (*_logEkb)(iter_at_target, l));
           double log_trans = (*_logAkl)(iter_at_target, k, l);
           
           *rptr = exp(fw_src[k] + log_trans + log_emission + bk_tgt[l] - loglik);
@@ -295,10 +915,22 @@ class HMMImpl : public HMM {
       }
     }
     
-    void stochastic_backtrace(Iter & iter, double * fwdmatrix, int * path) {
+    void emission_matrix(Iter & iter, double * matrix) const {
+      try {
+        iter.resetFirst();
+        _logEkb->log_probability_block(iter, 0, iter.length(), matrix);
+      } catch (QHMMException & e) {
+        e.stack.push_back("emission_matrix");
+        throw;
+      }
+    }
+    
+    void stochastic_backtrace(Iter & iter, double * fwdmatrix, int * path, Workspace * workspace = NULL) {
+      Workspace::Scope ws(workspace);
       int * pptr = path + iter.length() - 1;
-      double * probs = new double[_n_states];
+      double * probs = ws->doubles(_n_states);
       double * m_col = fwdmatrix + (iter.length() - 1) * _n_states; /* last column */
+      double * akl_buffer = block_buffer(ws.get());
       int state;
       
       QHMM_rnd_prepare();
@@ -310,21 +942,28 @@ class HMMImpl : public HMM {
       --pptr;
       m_col -= _n_states;
       
-      /* walk backwards */
+      /* walk backwards (transitions into position i + 1 are taken at i + 1) */
       iter.resetLast();
-      for (;pptr >= path; --pptr, m_col -= _n_states) {
-        /* compute sample probabilities */
-        for (int k = 0; k < _n_states; ++k)
-          probs[k] = exp(m_col[k] + (*_logAkl)(iter, k, state));
+      try {
+        for (;pptr >= path; --pptr, m_col -= _n_states, iter.prev()) {
+          /* compute sample probabilities */
+          const double * akl = _logAkl->log_block(iter, akl_buffer);
+          _innerFwd->weights(_n_states, m_col, state, akl + state*_n_states, probs);
+          
+          /* sample state */
+          state = sample_state(probs);
+          *pptr = state;
+        }
+      } catch (QHMMException & e) {
+        // clean up
+        QHMM_rnd_cleanup();
         
-        /* sample state */
-        state = sample_state(probs);
-        *pptr = state;
+        e.stack.push_back("stochastic backtrace");
+        throw;
       }
       
       /* clean up */
       QHMM_rnd_cleanup();
-      delete[] probs;
     }
     
   private:
@@ -360,6 +999,157 @@ class HMMImpl : public HMM {
 
       return state;
     }
+
+  protected:
+    // Online Viterbi: only a window of backpointer columns is kept. When the
+    // window fills up, all surviving paths are traced back to find the most
+    // recent position where they coalesce; the path up to that position can no
+    // longer change, so it is written out and dropped from the window. If no
+    // coalescence point frees at least half the window, the window is doubled.
+    template <typename BackPtr>
+    void viterbi_online_impl(Iter & iter, int * path, int window, Workspace * workspace) const {
+      Workspace::Scope ws(workspace);
+      const int rows = _n_states;
+      int capacity = window;
+      int n_cols = 0; /* columns in window */
+      int base = 0; /* sequence index of first window column */
+      double * m_col = ws->doubles(rows);
+      double * m_col_prev = ws->doubles(rows);
+      int * trace = ws->ints(rows);
+      BackPtr * backptr = new BackPtr[rows * capacity];
+      double * akl_buffer = block_buffer(ws.get());
+      double * e_col = ws->doubles(rows);
+
+      /* first column */
+      iter.resetFirst();
+      _logEkb->log_probabilities(iter, e_col);
+      for (int l = 0; l < _n_states; ++l)
+        m_col[l] = e_col[l] + _init_log_probs[l];
+
+      try {
+        /* inner columns (window column j holds the backpointers into position base + j - 1) */
+        while (iter.next()) {
+          double * tmp = m_col_prev;
+          m_col_prev = m_col;
+          m_col = tmp;
+
+          if (n_cols == capacity) {
+            int p = viterbi_coalesce(backptr, n_cols, base, m_col_prev, trace, path);
+
+            if (p >= base) {
+              int drop = p - base + 1;
+              n_cols -= drop;
+              base = p + 1;
+              memmove(backptr, backptr + drop * rows, sizeof(BackPtr) * n_cols * rows);
+            }
+
+            if (2 * n_cols > capacity) {
+              BackPtr * larger = new BackPtr[2 * rows * capacity];
+              memcpy(larger, backptr, sizeof(BackPtr) * n_cols * rows);
+              delete[] backptr;
+              backptr = larger;
+              capacity *= 2;
+            }
+          }
+
+          if (n_cols == 0)
+            base = iter.index();
+
+          const double * akl = _logAkl->log_block(iter, akl_buffer);
+          BackPtr * b_col = backptr + n_cols * rows;
+          _logEkb->log_probabilities(iter, e_col);
+
+          for (int l = 0; l < _n_states; ++l) {
+            int argmax;
+            double max = _innerFwd->best(_n_states, m_col_prev, l, akl + l*rows, argmax);
+
+            /* unreachable states keep a valid (unused) backpointer, they
+               are left out of the coalescence check */
+            m_col[l] = e_col[l] + max;
+            b_col[l] = (BackPtr) (argmax < 0 ? 0 : argmax);
+          }
+          ++n_cols;
+        }
+      } catch (QHMMException & e) {
+        // clean up
+        delete[] backptr;
+
+        e.stack.push_back("viterbi (online)");
+        throw;
+      }
+
+      /* last state */
+      {
+        double max = -std::numeric_limits<double>::infinity();
+        int argmax = -1;
+
+        for (int k = 0; k < _n_states; ++k) {
+          if (m_col[k] > max) {
+            max = m_col[k];
+            argmax = k;
+          }
+        }
+        path[iter.length() - 1] = argmax;
+      }
+
+      /* remaining window */
+      int z = path[iter.length() - 1];
+      for (int j = n_cols - 1; j >= 0; --j) {
+        z = backptr[j * rows + z];
+        path[base + j - 1] = z;
+      }
+
+      // clean up
+      delete[] backptr;
+    }
+
+    // traces the surviving states (finite m_col, at the newest window
+    // position) back through the window, returns the most recent position
+    // where all survivors agree (base - 1 if none) and writes the path up to
+    // that position
+    template <typename BackPtr>
+    int viterbi_coalesce(const BackPtr * backptr, int n_cols, int base, const double * m_col, int * trace, int * path) const {
+      const int rows = _n_states;
+      int n_live = 0;
+      int j;
+
+      /* backpointers of live states lead to live states */
+      for (int k = 0; k < rows; ++k)
+        if (m_col[k] > -std::numeric_limits<double>::infinity())
+          trace[n_live++] = k;
+      if (n_live == 0) /* sequence has zero probability: keep all */
+        for (n_live = 0; n_live < rows; ++n_live)
+          trace[n_live] = n_live;
+
+      /* after step j, trace holds the survivor states at position base + j - 1 */
+      for (j = n_cols - 1; j >= 1; --j) {
+        const BackPtr * b_col = backptr + j * rows;
+        bool coalesced = true;
+
+        for (int k = 0; k < n_live; ++k) {
+          trace[k] = b_col[trace[k]];
+          if (trace[k] != trace[0])
+            coalesced = false;
+        }
+
+        if (coalesced)
+          break;
+      }
+
+      if (j < 1)
+        return base - 1;
+
+      /* write fixed path: positions base - 1 .. p */
+      int p = base + j - 1;
+      int z = trace[0];
+      path[p] = z;
+      for (int i = j - 1; i >= 0; --i) {
+        z = backptr[i * rows + z];
+        path[base + i - 1] = z;
+      }
+
+      return p;
+    }
 };
 
 // auxiliary function to enable type inference
@@ -3,6 +3,8 @@
 
 #include "iter.hpp"
 #include "logsum.hpp"
+#include <cmath>
+#include <limits>
 
 //
 // Forward Inner Loop
@@ -11,14 +13,48 @@
 template<typename FuncType>
 class InnerFwdDense {
 public:
-  double operator() (const int & n_states, double const * const m_col_prev, int l, Iter const & iter, FuncType logAkl, LogSum * lg) {
+  // akl_col: transitions into l (column l of the target-major transition block)
+  double operator() (const int & n_states, double const * const m_col_prev, int l, double const * const akl_col, LogSum * lg) {
     lg->clear();
     
     for (int k = 0; k < n_states; ++k)
-      lg->store(m_col_prev[k] + (*logAkl)(iter, k, l));
+      lg->store(m_col_prev[k] + akl_col[k]);
 
     return lg->compute();
   }
+
+  // linear space (scaled) version
+  double scaled(const int & n_states, double const * const col_prev, int l, double const * const akl_col) {
+    double sum = 0;
+
+    for (int k = 0; k < n_states; ++k)
+      sum += col_prev[k] * akl_col[k];
+
+    return sum;
+  }
+
+  // max-product version (Viterbi): returns max_k m_col_prev[k] + akl_col[k]
+  // and sets argmax to the first maximizing k (-1 if none is finite)
+  double best(const int & n_states, double const * const m_col_prev, int l, double const * const akl_col, int & argmax) {
+    double max = -std::numeric_limits<double>::infinity();
+    argmax = -1;
+
+    for (int k = 0; k < n_states; ++k) {
+      double value = m_col_prev[k] + akl_col[k];
+
+      if (value > max) {
+        max = value;
+        argmax = k;
+      }
+    }
+    return max;
+  }
+
+  // unnormalized probabilities of the states preceding l (stochastic backtrace)
+  void weights(const int & n_states, double const * const m_col_prev, int l, double const * const akl_col, double * probs) {
+    for (int k = 0; k < n_states; ++k)
+      probs[k] = exp(m_col_prev[k] + akl_col[k]);
+  }
 };
 
 template<typename FuncType>
@@ -31,15 +67,48 @@ public:
     delete[] _previous;
   }
 
-  double operator() (const int & n_states, double const * const  m_col_prev, int l, Iter const & iter, FuncType logAkl, LogSum * lg) {
+  double operator() (const int & n_states, double const * const  m_col_prev, int l, double const * const akl_col, LogSum * lg) {
     lg->clear();
   
     for (int * ptr = _previous[l]; *ptr >= 0; ++ptr)
-      lg->store(m_col_prev[*ptr] + (*logAkl)(iter, *ptr, l));
+      lg->store(m_col_prev[*ptr] + akl_col[*ptr]);
 
     return lg->compute();
   }
 
+  double scaled(const int & n_states, double const * const col_prev, int l, double const * const akl_col) {
+    double sum = 0;
+
+    for (int * ptr = _previous[l]; *ptr >= 0; ++ptr)
+      sum += col_prev[*ptr] * akl_col[*ptr];
+
+    return sum;
+  }
+
+  double best(const int & n_states, double const * const m_col_prev, int l, double const * const akl_col, int & argmax) {
+    double max = -std::numeric_limits<double>::infinity();
+    argmax = -1;
+
+    /* previous states are sorted, so ties resolve as in the dense version */
+    for (int * ptr = _previous[l]; *ptr >= 0; ++ptr) {
+      double value = m_col_prev[*ptr] + akl_col[*ptr];
+
+      if (value > max) {
+        max = value;
+        argmax = *ptr;
+      }
+    }
+    return max;
+  }
+
+  void weights(const int & n_states, double const * const m_col_prev, int l, double const * const akl_col, double * probs) {
+    for (int k = 0; k < n_states; ++k)
+      probs[k] = 0;
+
+    for (int * ptr = _previous[l]; *ptr >= 0; ++ptr)
+      probs[*ptr] = exp(m_col_prev[*ptr] + akl_col[*ptr]);
+  }
+
 private:
   int ** _previous;
   const int _n_states;
@@ -52,15 +121,27 @@ private:
 template<typename FuncAkl, typename FuncEkb>
 class InnerBckDense {
 public:
-  double operator() (const int & n_states, double const * const m_col_next, int k, Iter const & iter, FuncAkl logAkl, FuncEkb logEkb, LogSum * lg) {
+  // akl_row: transitions out of k (row k of the source-major transition block)
+  // e_next: emission log-probabilities at the next position
+  double operator() (const int & n_states, double const * const m_col_next, int k, double const * const akl_row, double const * const e_next, LogSum * lg) {
     lg->clear();
 
     for (int l = 0; l < n_states; ++l) {
-      double value = m_col_next[l] + (*logAkl)(iter, k, l) + (*logEkb)(iter, l);
+      double value = m_col_next[l] + akl_row[l] + e_next[l];
       lg->store(value);
     }
     return lg->compute();
   }
+
+  // linear space (scaled) version: e_next holds the (scaled) emission probabilities at iter
+  double scaled(const int & n_states, double const * const col_next, int k, double const * const akl_row, double const * const e_next) {
+    double sum = 0;
+
+    for (int l = 0; l < n_states; ++l)
+      sum += col_next[l] * akl_row[l] * e_next[l];
+
+    return sum;
+  }
 };
 
 template<typename FuncAkl, typename FuncEkb>
@@ -73,17 +154,27 @@ public:
     delete[] _next;
   }
 
-  double operator() (const int & n_states, double const * const m_col_next, int k, Iter const & iter, FuncAkl logAkl, FuncEkb logEkb, LogSum * lg) {
+  double operator() (const int & n_states, double const * const m_col_next, int k, double const * const akl_row, double const * const e_next, LogSum * lg) {
     lg->clear();
 
     for (int * ptr = _next[k]; *ptr >= 0; ++ptr) {
       int l = *ptr;
-      double value = m_col_next[l] + (*logAkl)(iter, k, l) + (*logEkb)(iter, l);
+      double value = m_col_next[l] + akl_row[l] + e_next[l];
       lg->store(value);
     }
     return lg->compute();
   }
 
+  double scaled(const int & n_states, double const * const col_next, int k, double const * const akl_row, double const * const e_next) {
+    double sum = 0;
+
+    for (int * ptr = _next[k]; *ptr >= 0; ++ptr) {
+      int l = *ptr;
+      sum += col_next[l] * akl_row[l] * e_next[l];
+    }
+    return sum;
+  }
+
 private:
   int ** _next;
   const int _n_states;
@@ -3,6 +3,44 @@
 
 Iter::Iter(int length, int emission_slots, int * e_slot_dim, double * emissions,
          int covar_slots, int * c_slot_dim, double * covars, int * missing) {
+  init(length, emission_slots, e_slot_dim, NULL, emissions, covar_slots, c_slot_dim, covars, missing);
+}
+
+Iter::Iter(int length, int emission_slots, int * e_slot_dim, int * e_slot_type, void * emissions,
+         int covar_slots, int * c_slot_dim, double * covars, int * missing) {
+  init(length, emission_slots, e_slot_dim, e_slot_type, emissions, covar_slots, c_slot_dim, covars, missing);
+}
+
+int Iter::element_size(int type) {
+  switch (type) {
+    case FLOAT32: return sizeof(float);
+    case INT32: return sizeof(int32_t);
+    case UINT32: return sizeof(uint32_t);
+    case UINT16: return sizeof(uint16_t);
+  }
+  return sizeof(double);
+}
+
+int Iter::emission_layout(int emission_slots, const int * e_slot_dim, const int * e_slot_type, int * offsets) {
+  int size = 0;
+  int max_element = 1;
+  
+  for (int i = 0; i < emission_slots; ++i) {
+    int element = element_size(e_slot_type == NULL ? FLOAT64 : e_slot_type[i]);
+    
+    size = (size + element - 1) / element * element;
+    offsets[i] = size;
+    size += element * e_slot_dim[i];
+    if (element > max_element)
+      max_element = element;
+  }
+  
+  return (size + max_element - 1) / max_element * max_element;
+}
+
+/* e_slot_type == NULL: all slots FLOAT64 */
+void Iter::init(int length, int emission_slots, int * e_slot_dim, int * e_slot_type, void * emissions,
+                int covar_slots, int * c_slot_dim, double * covars, int * missing) {
   assert(length > 0);
   assert(emission_slots > 0);
   assert(e_slot_dim != NULL);
@@ -16,15 +54,14 @@ Iter::Iter(int length, int emission_slots, int * e_slot_dim, double * emissions,
   _emission_slot_count = emission_slots;
   _covar_slot_count = covar_slots;
   
-  _emission_step = 0;
   _emission_offsets = new int[emission_slots];
-  for (int i = 0; i < emission_slots; ++i) {
-    _emission_offsets[i] = _emission_step;
-    _emission_step += e_slot_dim[i];
-  }
-  _emission_ptr = emissions;
-  _emission_start = emissions;
-  _emission_end = emissions + (length - 1) * _emission_step;
+  _emission_types = new int[emission_slots];
+  for (int i = 0; i < emission_slots; ++i)
+    _emission_types[i] = (e_slot_type == NULL ? FLOAT64 : e_slot_type[i]);
+  _emission_step = emission_layout(emission_slots, e_slot_dim, _emission_types, _emission_offsets);
+  _emission_ptr = (char *) emissions;
+  _emission_start = (char *) emissions;
+  _emission_end = (char *) emissions + (ptrdiff_t) (length - 1) * _emission_step;
   
   _covar_step = 0;
   if (covar_slots == 0)
@@ -39,21 +76,92 @@ Iter::Iter(int length, int emission_slots, int * e_slot_dim, double * emissions,
   _covar_start = covars;
   _covar_end = covars + (length - 1) * _covar_step;
 
-  _missing_step = (missing == NULL ? 0 : emission_slots);
-  _missing_ptr = missing;
-  _missing_start = missing;
-  _missing_end = missing + (length - 1) * _missing_step;
+  _missing_bits = NULL;
+  _missing_words = 0;
+  _missing_first = 0;
+  _missing_owned = NULL;
+  if (missing != NULL)
+    pack_missing(missing);
+}
+
+void Iter::pack_missing(const int * missing) {
+  const size_t words = bitmap_words(_length);
+  uint64_t * bits = new uint64_t[words * _emission_slot_count];
+  
+  for (size_t w = 0; w < words * _emission_slot_count; ++w)
+    bits[w] = 0;
+  for (int i = 0; i < _length; ++i)
+    for (int slot = 0; slot < _emission_slot_count; ++slot)
+      if (missing[i * _emission_slot_count + slot] != 0)
+        bits[slot * words + (i >> 6)] |= ((uint64_t) 1) << (i & 63);
+  
+  if (_missing_owned != NULL)
+    delete[] _missing_owned;
+  _missing_owned = bits;
+  _missing_bits = bits;
+  _missing_words = words;
+  _missing_first = 0;
+}
+
+void Iter::share_missing_bits(const uint64_t * bits, size_t words_per_slot, int first) {
+  assert(!(_is_subiterator || _is_copy));
+  if (_missing_owned != NULL) {
+    delete[] _missing_owned;
+    _missing_owned = NULL;
+  }
+  _missing_bits = bits;
+  _missing_words = words_per_slot;
+  _missing_first = first;
+}
+
+static int trailing_zeros(uint64_t word) {
+#ifdef __GNUC__
+  return __builtin_ctzll(word);
+#else
+  int n = 0;
+  for (; (word & 1) == 0; word >>= 1)
+    ++n;
+  return n;
+#endif
+}
+
+int Iter::find_missing(int slot, int from, int end, bool value) const {
+  const uint64_t * bits = _missing_bits + slot * _missing_words;
+  
+  while (from < end) {
+    const size_t bit = _missing_first + from;
+    uint64_t word = bits[bit >> 6];
+    
+    if (!value)
+      word = ~word;
+    word >>= (bit & 63);
+    if (word != 0) {
+      from += trailing_zeros(word);
+      break;
+    }
+    from += 64 - (bit & 63);
+  }
+  return (from < end ? from : end);
 }
 
 Iter::~Iter() {
   if (!(_is_subiterator || _is_copy)) {
     delete[] _emission_offsets;
+    delete[] _emission_types;
+    if (_missing_owned != NULL)
+      delete[] _missing_owned;
     if (_covar_offsets != NULL)
       delete[] _covar_offsets;
   }
 }
 
-Iter::Iter(Iter * parent, int start, int end) : _is_subiterator(true), _missing_ptr(NULL), _missing_start(NULL), _missing_end(NULL), _missing_step(0) {
+Iter::Iter(Iter const & parent, int offset) {
+  *this = parent; // member-wise copy
+  _is_copy = true; // shares parent's offsets
+  seek(_index + offset);
+}
+
+Iter::Iter(Iter * parent, int start, int end) : _is_subiterator(true), _missing_bits(NULL), _missing_words(0), _missing_first(0), _missing_owned(NULL) {
   // set length
   _length = end - start + 1;
   _index = 0;
@@ -63,13 +171,14 @@ Iter::Iter(Iter * parent, int start, int end) : _is_subiterator(true), _missing_
   _emission_slot_count = parent->_emission_slot_count;
   _covar_slot_count = parent->_covar_slot_count;
   _emission_offsets = parent->_emission_offsets;
+  _emission_types = parent->_emission_types;
   _covar_offsets = parent->_covar_offsets;
   _emission_step = parent->_emission_step;
   _covar_step = parent->_covar_step;
 
   // start/end/ptr pointers
-  _emission_start = parent->_emission_start + parent->_emission_step * start;
-  _emission_end = parent->_emission_start + parent->_emission_step * end;
+  _emission_start = parent->_emission_start + (ptrdiff_t) parent->_emission_step * start;
+  _emission_end = parent->_emission_start + (ptrdiff_t) parent->_emission_step * end;
   _emission_ptr = _emission_start;
   
   _covar_start = parent->_covar_start + parent->_covar_step * start;
@@ -77,28 +186,38 @@ Iter::Iter(Iter * parent, int start, int end) : _is_subiterator(true), _missing_
   _covar_ptr = _covar_start;
 }
 
-std::vector<Iter> * Iter::sub_iterators(int slot) {
+std::vector<Iter> * Iter::sub_iterators(int slot, int max_length) {
   assert(!_is_subiterator);
   assert(slot >= 0 && slot < _emission_slot_count);
   std::vector<Iter> * result = new std::vector<Iter>();
   
   if (has_missing()) {
-    int start = -1;
-    int * mptr = _missing_start + slot;
+    int start = find_missing(slot, 0, _length, false);
     
-    for (int i = 0; i < _length; ++i, mptr += _missing_step) {
-      if (*mptr != 0 && start >= 0) {
-        result->push_back(Iter(this, start, i - 1));
-        start = -1;
-      } else if (*mptr == 0 && start < 0)
-        start = i;
+    while (start < _length) {
+      int end = find_missing(slot, start, _length, true);
+      push_sub_iterators(result, start, end - 1, max_length);
+      start = find_missing(slot, end, _length, false);
     }
-    
-    // close last, if any
-    if (start >= 0)
-      result->push_back(Iter(this, start, _length - 1));
   } else
-    result->push_back(Iter(this, 0, _length - 1));
+    push_sub_iterators(result, 0, _length - 1, max_length);
 
   return result;
 }
+
+void Iter::push_sub_iterators(std::vector<Iter> * result, int start, int end, int max_length) {
+  if (max_length <= 0) {
+    result->push_back(Iter(this, start, end));
+    return;
+  }
+  
+  // split at multiples of max_length
+  while (start <= end) {
+    int block_end = (start / max_length + 1) * max_length - 1;
+    if (block_end > end)
+      block_end = end;
+    
+    result->push_back(Iter(this, start, block_end));
+    start = block_end + 1;
+  }
+}
@@ -1,30 +1,50 @@
 #ifndef ITER_HPP
 #define ITER_HPP
 
+#include <cstddef>
 #include <cstdlib> // for NULL
 #include <cassert>
+#include <stdint.h>
 #include <vector>
 
 class Iter {
 
   public:
+    // element types of emission slots
+    enum ElementType { FLOAT64 = 0, FLOAT32 = 1, INT32 = 2, UINT32 = 3, UINT16 = 4 };
+
     // Missing data must follow the same slot count as emissions
+    // (flags are copied into bitmaps, see share_missing_bits)
     Iter(int length, int emission_slots, int * e_slot_dim, double * emissions,
          int covar_slots, int * c_slot_dim, double * covars, int * missing = NULL);
+
+    // typed emission slots: each position is a row laid out by emission_layout
+    // (e.g. one slot of INT32 counts is a plain int32_t array)
+    Iter(int length, int emission_slots, int * e_slot_dim, int * e_slot_type, void * emissions,
+         int covar_slots, int * c_slot_dim, double * covars, int * missing = NULL);
     virtual ~Iter();
+
+    static int element_size(int type);
+
+    // row layout for typed emissions: slot i starts at byte offsets[i]
+    // (aligned to its element size); returns the row size in bytes, a multiple
+    // of the largest element size
+    static int emission_layout(int emission_slots, const int * e_slot_dim, const int * e_slot_type, int * offsets);
+
+    // cursor sharing the data of parent, positioned offset positions after it
+    // (only valid while parent exists)
+    Iter(Iter const & parent, int offset);
   
     // control ops
     void resetFirst() {
       _emission_ptr = _emission_start;
       _covar_ptr = _covar_start;
-      _missing_ptr = _missing_start;
       _index = 0;
     }
     
     void resetLast() {
       _emission_ptr = _emission_end;
       _covar_ptr = _covar_end;
-      _missing_ptr = _missing_end;
       _index = _length - 1;
     }
     
@@ -33,7 +53,6 @@ class Iter {
         return false;
       _emission_ptr += _emission_step;
       _covar_ptr += _covar_step;
-      _missing_ptr += _missing_step;
       ++_index;
       return true;
     }
@@ -43,20 +62,61 @@ class Iter {
         return false;
       _emission_ptr -= _emission_step;
       _covar_ptr -= _covar_step;
-      _missing_ptr -= _missing_step;
       --_index;
       return true;
     }
+    
+    // move to arbitrary position
+    void seek(const int index) {
+      assert(index >= 0 && index < _length);
+      const int delta = index - _index;
+      _emission_ptr += (ptrdiff_t) delta * _emission_step;
+      _covar_ptr += delta * _covar_step;
+      _index = index;
+    }
         
     // data ops
     double emission(const int slot) const {
-      return _emission_ptr[_emission_offsets[slot]];
+      return emission_i(slot, 0);
     }
     
     double emission_i(const int slot, const int i) const {
-      return _emission_ptr[_emission_offsets[slot] + i];
+      const char * ptr = _emission_ptr + _emission_offsets[slot];
+      
+      switch (_emission_types[slot]) {
+        case FLOAT32: return ((const float *) ptr)[i];
+        case INT32: return ((const int32_t *) ptr)[i];
+        case UINT32: return ((const uint32_t *) ptr)[i];
+        case UINT16: return ((const uint16_t *) ptr)[i];
+      }
+      return ((const double *) ptr)[i];
+    }
+    
+    // count data: integer slots are read without a round trip through double
+    int count(const int slot) const {
+      const char * ptr = _emission_ptr + _emission_offsets[slot];
+      
+      switch (_emission_types[slot]) {
+        case FLOAT32: return (int) *((const float *) ptr);
+        case INT32: return *((const int32_t *) ptr);
+        case UINT32: return (int) *((const uint32_t *) ptr);
+        case UINT16: return *((const uint16_t *) ptr);
+      }
+      return (int) *((const double *) ptr);
+    }
+    
+    int emission_type(const int slot) const { return _emission_types[slot]; }
+    
+    // block access: with T the element type of slot, the value of slot at
+    // position index() + offset + i is emission_block<T>(slot, offset)[i * emission_step<T>()]
+    template<typename T>
+    const T * emission_block(const int slot, const int offset) const {
+      return (const T *) (_emission_ptr + (ptrdiff_t) offset * _emission_step + _emission_offsets[slot]);
     }
     
+    template<typename T>
+    int emission_step() const { return _emission_step / sizeof(T); }
+    
     double covar(const int slot) const {
       assert(_covar_start != NULL);
       return _covar_ptr[_covar_offsets[slot]];
@@ -78,12 +138,41 @@ class Iter {
     int index() const { return _index; }
   
     bool is_missing(int slot) const {
-      if (_missing_ptr == NULL)
+      return is_missing_at(slot, _index);
+    }
+
+    // offset with respect to current iterator sequence position
+    bool is_missing_ext(int slot, int offset) const {
+      return is_missing_at(slot, _index + offset);
+    }
+
+    // independent of the current position
+    bool is_missing_at(int slot, int index) const {
+      if (_missing_bits == NULL)
         return false;
-      return (_missing_ptr[slot] != 0);
+      const size_t bit = _missing_first + index;
+      return (_missing_bits[slot * _missing_words + (bit >> 6)] >> (bit & 63)) & 1;
     }
 
-    bool has_missing() const { return _missing_ptr != NULL; }
+    bool has_missing() const { return _missing_bits != NULL; }
+
+    // all emission slots missing at position index() + offset
+    bool all_missing(int offset = 0) const {
+      if (_missing_bits == NULL)
+        return false;
+      for (int slot = 0; slot < _emission_slot_count; ++slot)
+        if (!is_missing_at(slot, _index + offset))
+          return false;
+      return true;
+    }
+
+    // missing data as bitmaps shared with the caller (replaces any previous
+    // flags): one bitmap of words_per_slot 64 bit words per emission slot,
+    // position i is bit first + i (bit b of a bitmap is bit b % 64 of word b / 64)
+    void share_missing_bits(const uint64_t * bits, size_t words_per_slot, int first = 0);
+
+    // 64 bit words for a bitmap of length bits
+    static size_t bitmap_words(int length) { return ((size_t) length + 63) / 64; }
 
     // Partition sequence into blocks with no missing data (for a given slot)
     // NOTES: 1. These wull share data with the parent iterator and, as such, are not valid
@@ -92,9 +181,11 @@ class Iter {
     //           perspective of the indicated slot (if missing data does not align across
     //           emission slots, then a separate set of sub-iterators must be created per
     //           emission slot).
-    std::vector<Iter> * sub_iterators(int slot);
+    //        3. If max_length > 0, blocks are further split so that no block crosses a
+    //           multiple of max_length (used by checkpointed forward/backward).
+    std::vector<Iter> * sub_iterators(int slot, int max_length = 0);
 
-    int emission_slot_count() { return _emission_slot_count; }
+    int emission_slot_count() const { return _emission_slot_count; }
     int iter_offset() const { return _offset; }
   
     Iter * shallowCopy() {
@@ -104,7 +195,16 @@ class Iter {
     }
   
   protected:
+    friend class RunIter;
+
     Iter(Iter * parent, int start, int end); // constructor for sub_iterator() function
+    void init(int length, int emission_slots, int * e_slot_dim, int * e_slot_type, void * emissions,
+              int covar_slots, int * c_slot_dim, double * covars, int * missing);
+    // packs missing flags (Iter layout, length() positions) into owned bitmaps
+    void pack_missing(const int * missing);
+    // first position >= from and < end with missing flag value for slot (end if none)
+    int find_missing(int slot, int from, int end, bool value) const;
+    void push_sub_iterators(std::vector<Iter> * result, int start, int end, int max_length);
   
     bool _is_subiterator;
     bool _is_copy;
@@ -113,11 +213,12 @@ class Iter {
     int _index;
   
     int _emission_slot_count;
-    double * _emission_ptr;
-    double * _emission_start;
-    double * _emission_end;
-    int _emission_step;
-    int * _emission_offsets;
+    char * _emission_ptr;
+    char * _emission_start;
+    char * _emission_end;
+    int _emission_step; // bytes
+    int * _emission_offsets; // bytes
+    int * _emission_types;
   
     int _covar_slot_count;
     double * _covar_ptr;
@@ -126,10 +227,10 @@ class Iter {
     int _covar_step;
     int * _covar_offsets;
   
-    int * _missing_ptr;
-    int * _missing_start;
-    int * _missing_end;
-    int _missing_step;
+    const uint64_t * _missing_bits; // one bitmap per emission slot, NULL if no missing data
+    size_t _missing_words; // per slot
+    int _missing_first; // bit of position 0
+    uint64_t * _missing_owned; // bitmaps packed from constructor flags
   
     // could also store slot descriptions and add asserts to data ops
     // ideally, there should be a non-performance penalty way to add the
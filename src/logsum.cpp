@@ -37,11 +37,210 @@ class LogSum2 : public LogSum {
     }
 };
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QHMM_LOGSUM_VEC
+#endif
+
+#ifdef QHMM_LOGSUM_VEC
+#include <immintrin.h>
+
+/*
+ * Vectorized LogSum
+ *
+ * exp(x) is evaluated for x in [-708, 0] as 2^n * exp(r), with
+ * x = n * log(2) + r, |r| <= log(2)/2, and exp(r) given by its degree 11
+ * Taylor polynomial (relative error below 1e-14).
+ *
+ * Values are padded with -Inf to a multiple of the vector width. The max
+ * term contributes exp(0) = 1 to the sum, so the result is computed as
+ * max + log1p(sum - 1).
+ */
+
+#define LOGSUM_VEC_WIDTH 8
+#define LOGSUM_VEC_MIN_COUNT 12 /* below this the scalar version is faster */
+#define LOGSUM_EXP_MIN -708.0
+
+static const double EXP_LOG2E = 1.44269504088896340736;
+static const double EXP_LN2_HI = 6.93147180369123816490e-01;
+static const double EXP_LN2_LO = 1.90821492927058770002e-10;
+static const double EXP_COEFS[] = {
+  1.0 / 39916800, 1.0 / 3628800, 1.0 / 362880, 1.0 / 40320, 1.0 / 5040, 1.0 / 720,
+  1.0 / 120, 1.0 / 24, 1.0 / 6, 1.0 / 2, 1.0, 1.0 };
+
+typedef double (*LogSumKernel)(const double * values, const unsigned int n, const double threshold);
+
+__attribute__((target("avx2,fma")))
+static inline __m256d exp_avx2(__m256d x) {
+  __m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(EXP_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(EXP_LN2_HI), x);
+  r = _mm256_fnmadd_pd(n, _mm256_set1_pd(EXP_LN2_LO), r);
+
+  __m256d p = _mm256_set1_pd(EXP_COEFS[0]);
+  for (int i = 1; i < 12; ++i)
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(EXP_COEFS[i]));
+
+  /* 2^n: n + 1.5 * 2^52 holds n in its low mantissa bits */
+  __m256i bits = _mm256_castpd_si256(_mm256_add_pd(n, _mm256_set1_pd(6755399441055744.0)));
+  bits = _mm256_slli_epi64(_mm256_add_epi64(bits, _mm256_set1_epi64x(1023)), 52);
+
+  return _mm256_mul_pd(p, _mm256_castsi256_pd(bits));
+}
+
+__attribute__((target("avx2,fma")))
+static double logsum_avx2(const double * values, const unsigned int n, const double threshold) {
+  __m256d vmax = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+  double tmp[4];
+
+  for (unsigned int i = 0; i < n; i += 4)
+    vmax = _mm256_max_pd(vmax, _mm256_loadu_pd(values + i));
+  _mm256_storeu_pd(tmp, vmax);
+  double max = std::max(std::max(tmp[0], tmp[1]), std::max(tmp[2], tmp[3]));
+
+  if (std::isinf(max))
+    return max;
+
+  __m256d vm = _mm256_set1_pd(max);
+  __m256d vthreshold = _mm256_set1_pd(threshold);
+  __m256d vmin = _mm256_set1_pd(LOGSUM_EXP_MIN);
+  __m256d vsum = _mm256_setzero_pd();
+
+  for (unsigned int i = 0; i < n; i += 4) {
+    __m256d x = _mm256_sub_pd(_mm256_loadu_pd(values + i), vm);
+    __m256d keep = _mm256_cmp_pd(x, vthreshold, _CMP_GT_OQ);
+
+    x = _mm256_max_pd(x, vmin);
+    vsum = _mm256_add_pd(vsum, _mm256_and_pd(exp_avx2(x), keep));
+  }
+  _mm256_storeu_pd(tmp, vsum);
+
+  return max + log1p((tmp[0] + tmp[1]) + (tmp[2] + tmp[3]) - 1.0);
+}
+
+// the AVX-512 intrinsics use _mm512_undefined_pd() internally, which trips
+// (spurious) uninitialized warnings on some GCC versions
+#if !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f")))
+static inline __m512d exp_avx512(__m512d x) {
+  __m512d n = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(EXP_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512d r = _mm512_fnmadd_pd(n, _mm512_set1_pd(EXP_LN2_HI), x);
+  r = _mm512_fnmadd_pd(n, _mm512_set1_pd(EXP_LN2_LO), r);
+
+  __m512d p = _mm512_set1_pd(EXP_COEFS[0]);
+  for (int i = 1; i < 12; ++i)
+    p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(EXP_COEFS[i]));
+
+  return _mm512_scalef_pd(p, n);
+}
+
+__attribute__((target("avx512f")))
+static double logsum_avx512(const double * values, const unsigned int n, const double threshold) {
+  __m512d vmax = _mm512_set1_pd(-std::numeric_limits<double>::infinity());
+
+  for (unsigned int i = 0; i < n; i += 8)
+    vmax = _mm512_max_pd(vmax, _mm512_loadu_pd(values + i));
+  double max = _mm512_reduce_max_pd(vmax);
+
+  if (std::isinf(max))
+    return max;
+
+  __m512d vm = _mm512_set1_pd(max);
+  __m512d vthreshold = _mm512_set1_pd(threshold);
+  __m512d vmin = _mm512_set1_pd(LOGSUM_EXP_MIN);
+  __m512d vsum = _mm512_setzero_pd();
+
+  for (unsigned int i = 0; i < n; i += 8) {
+    __m512d x = _mm512_sub_pd(_mm512_loadu_pd(values + i), vm);
+    __mmask8 keep = _mm512_cmp_pd_mask(x, vthreshold, _CMP_GT_OQ);
+
+    x = _mm512_max_pd(x, vmin);
+    vsum = _mm512_mask_add_pd(vsum, keep, vsum, exp_avx512(x));
+  }
+
+  return max + log1p(_mm512_reduce_add_pd(vsum) - 1.0);
+}
+
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+class LogSumVec : public LogSum {
+  public:
+    LogSumVec(const unsigned int capacity, const bool optimize, LogSumKernel kernel = LogSumVec::kernel()) : LogSum(capacity, optimize), _kernel(kernel), _vthreshold(std::max(_threshold, LOGSUM_EXP_MIN)) {
+      // make room for padding
+      delete[] _values;
+      _values = new double[padded(capacity)];
+    }
+
+    static bool supported() {
+      return kernel() != NULL;
+    }
+
+    // kernel for createType (4: AVX2, 5: AVX-512, otherwise the best one),
+    // NULL if the CPU lacks the instructions
+    static LogSumKernel kernel(const int type) {
+      __builtin_cpu_init();
+      if (type == 4)
+        return (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? logsum_avx2 : NULL);
+      if (type == 5)
+        return (__builtin_cpu_supports("avx512f") ? logsum_avx512 : NULL);
+      return kernel();
+    }
+
+    virtual double compute() {
+      assert(_count > 0);
+
+      // sparse inner loops may only fill a few entries
+      if (_count < LOGSUM_VEC_MIN_COUNT)
+        return LogSum::compute();
+
+      const unsigned int n = padded(_count);
+
+      for (unsigned int i = _count; i < n; ++i)
+        _values[i] = -std::numeric_limits<double>::infinity();
+
+      return _kernel(_values, n, _vthreshold);
+    }
+
+  private:
+    const LogSumKernel _kernel;
+    const double _vthreshold;
+
+    static unsigned int padded(const unsigned int count) {
+      return (count + LOGSUM_VEC_WIDTH - 1) / LOGSUM_VEC_WIDTH * LOGSUM_VEC_WIDTH;
+    }
+
+    // runtime CPU dispatch (decided once)
+    static LogSumKernel kernel() {
+      static const LogSumKernel selected = select_kernel();
+      return selected;
+    }
+
+    static LogSumKernel select_kernel() {
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f"))
+        return logsum_avx512;
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return logsum_avx2;
+      return NULL;
+    }
+};
+#endif
+
 LogSum * LogSum::create(const unsigned int capacity, const bool optimize) {
   // special case implementations
   if (capacity == 2)
     return new LogSum2(capacity, optimize);
 
+#ifdef QHMM_LOGSUM_VEC
+  if (capacity >= LOGSUM_VEC_MIN_COUNT && LogSumVec::supported())
+    return new LogSumVec(capacity, optimize);
+#endif
+
   return new LogSum(capacity, optimize);
 }
 
@@ -49,8 +248,23 @@ LogSum * LogSum::createType(const int type, const unsigned int capacity, const b
   if (capacity == 2 && type == 1)
     return new LogSum2(capacity, optimize);
 
+#ifdef QHMM_LOGSUM_VEC
+  if (type >= 3 && hasType(type))
+    return new LogSumVec(capacity, optimize, LogSumVec::kernel(type));
+#endif
+
   return new LogSum(capacity, optimize);
 }
+
+bool LogSum::hasType(const int type) {
+  if (type == 1 || type == 2)
+    return true;
+#ifdef QHMM_LOGSUM_VEC
+  if (type >= 3 && type <= 5)
+    return LogSumVec::kernel(type) != NULL;
+#endif
+  return false;
+}
    
 double LogSum::compute() {
   assert(_count > 0);
@@ -9,8 +9,12 @@ class LogSum {
     static const double SUM_LOG_THRESHOLD;
 
     static LogSum * create(const unsigned int capacity, const bool optimize = true);
-    // for benchmarks
+    // for benchmarks & tests (1: LogSum2, 2: LogSum, 3: LogSumVec with the best
+    // kernel, 4: LogSumVec AVX2 kernel, 5: LogSumVec AVX-512 kernel - types 3 to 5
+    // fall back to LogSum if the CPU lacks the instructions)
     static LogSum * createType(const int type, const unsigned int capacity, const bool optimize);
+    // false if createType(type, ...) falls back to LogSum
+    static bool hasType(const int type);
     
     virtual ~LogSum() { delete[] _values; }
   
@@ -33,6 +37,10 @@ class LogSum {
       _count = 0;
     }
     
+    unsigned int capacity() const {
+      return _length;
+    }
+    
     virtual double compute();
     
   protected:
@@ -96,3 +96,91 @@ int ParamRecord::paramIndex(int position) const {
 
   return _indexes[position];
 }
+
+ParamVector::ParamVector(std::vector<std::vector<TransitionFunction*> > const & tgroups, std::vector<std::vector<EmissionFunction*> > const & egroups) : _tgroups(tgroups), _egroups(egroups) {
+  _size = 0;
+
+  for (int g = 0; g < group_count(); ++g) {
+    Params * par = group_params(g);
+    if (par == NULL)
+      continue;
+
+    for (int i = 0; i < par->length(); ++i)
+      if (!par->isFixed(i))
+        ++_size;
+    delete par;
+  }
+}
+
+Params * ParamVector::group_params(int group) const {
+  int n_trans = _tgroups.size();
+
+  if (group < n_trans)
+    return _tgroups[group][0]->getParams();
+  return _egroups[group - n_trans][0]->getParams();
+}
+
+bool ParamVector::valid_params(int group, Params const & params) const {
+  int n_trans = _tgroups.size();
+
+  if (group < n_trans)
+    return _tgroups[group][0]->validParams(params);
+  return _egroups[group - n_trans][0]->validParams(params);
+}
+
+void ParamVector::set_params(int group, Params const & params) {
+  int n_trans = _tgroups.size();
+
+  if (group < n_trans) {
+    for (unsigned int j = 0; j < _tgroups[group].size(); ++j)
+      _tgroups[group][j]->setParams(params);
+  } else {
+    for (unsigned int j = 0; j < _egroups[group - n_trans].size(); ++j)
+      _egroups[group - n_trans][j]->setParams(params);
+  }
+}
+
+void ParamVector::get(double * values) const {
+  int k = 0;
+
+  for (int g = 0; g < group_count(); ++g) {
+    Params * par = group_params(g);
+    if (par == NULL)
+      continue;
+
+    for (int i = 0; i < par->length(); ++i)
+      if (!par->isFixed(i))
+        values[k++] = (*par)[i];
+    delete par;
+  }
+  assert(k == _size);
+}
+
+bool ParamVector::set(const double * values) {
+  std::vector<Params*> params(group_count(), (Params*) NULL);
+  bool valid = true;
+  int k = 0;
+
+  /* validate all groups before changing any */
+  for (int g = 0; g < group_count() && valid; ++g) {
+    Params * par = group_params(g);
+    params[g] = par;
+    if (par == NULL || par->isAllFixed())
+      continue;
+
+    for (int i = 0; i < par->length(); ++i)
+      if (!par->isFixed(i))
+        (*par)[i] = values[k++];
+    valid = !par->anyNaN() && valid_params(g, *par);
+  }
+
+  for (int g = 0; g < group_count(); ++g) {
+    if (params[g] == NULL)
+      continue;
+    if (valid && !params[g]->isAllFixed())
+      set_params(g, *(params[g]));
+    delete params[g];
+  }
+
+  return valid;
+}
@@ -34,4 +34,28 @@ private:
   void init(Params * par);
 };
 
+// Free parameters of all transition and emission groups as a single vector
+// (group heads define the values, set applies them to all group members)
+class ParamVector {
+public:
+  ParamVector(std::vector<std::vector<TransitionFunction*> > const & tgroups, std::vector<std::vector<EmissionFunction*> > const & egroups);
+
+  int size() const { return _size; }
+
+  void get(double * values) const;
+  // returns false, leaving all parameters untouched, if values are not
+  // valid for some group
+  bool set(const double * values);
+
+private:
+  std::vector<std::vector<TransitionFunction*> > _tgroups;
+  std::vector<std::vector<EmissionFunction*> > _egroups;
+  int _size;
+
+  Params * group_params(int group) const;
+  bool valid_params(int group, Params const & params) const;
+  void set_params(int group, Params const & params);
+  int group_count() const { return _tgroups.size() + _egroups.size(); }
+};
+
 #endif
@@ -2,14 +2,22 @@
 #include "em_seq.hpp"
 
 PosteriorIterator::PosteriorIterator(int state, int slot, const std::vector<EMSequence*> * seqs) : _state(state), _slot(slot), _seqs(seqs) {
+  _seg_iter = NULL;
+  _seg_capacity = 0;
+  _seg_post = NULL;
   reset();
 }
 
+PosteriorIterator::~PosteriorIterator() {
+  if (_seg_iter != NULL)
+    delete _seg_iter;
+  if (_seg_post != NULL)
+    delete[] _seg_post;
+}
+
 void PosteriorIterator::reset() {
   _outer_iter = _seqs->begin();
-  _inner_vec = (*((*_outer_iter)->_slot_subiters))[_slot];
-  _inner_iter = _inner_vec->begin();
-  (*_outer_iter)->update_posterior();
+  changed_sequence();
 }
 
 bool PosteriorIterator::next() {
@@ -21,13 +29,9 @@ bool PosteriorIterator::next() {
     if (_outer_iter == _seqs->end())
       return false;
     
-    /* update posterior */
-    (*_outer_iter)->update_posterior();
-    
-    /* update inner iterator */
-    _inner_vec = (*((*_outer_iter)->_slot_subiters))[_slot];
-    _inner_iter = _inner_vec->begin();
-  }
+    changed_sequence();
+  } else
+    update_segment();
   
   return true;
 }
@@ -38,6 +42,63 @@ Iter & PosteriorIterator::iter() {
 
 const double * PosteriorIterator::posterior() {
   EMSequence * em_seq = (*_outer_iter);
+  
+  if (em_seq->_checkpoints != NULL)
+    return _seg_post + _state * _seg_size + ((*_inner_iter).iter_offset() - _seg_start);
+  
   double * post_state = em_seq->_posterior + (_state * em_seq->_iter->length());
   return post_state + (*_inner_iter).iter_offset();
 }
+
+void PosteriorIterator::changed_sequence() {
+  EMSequence * em_seq = (*_outer_iter);
+  
+  /* update posterior */
+  em_seq->update_posterior();
+  
+  /* update inner iterator */
+  _inner_vec = (*(em_seq->_slot_subiters))[_slot];
+  _inner_iter = _inner_vec->begin();
+  
+  /* segment state */
+  if (_seg_iter != NULL) {
+    delete _seg_iter;
+    _seg_iter = NULL;
+  }
+  _seg = -1;
+  update_segment();
+}
+
+void PosteriorIterator::update_segment() {
+  EMSequence * em_seq = (*_outer_iter);
+  const FwBkCheckpoints * checkpoints = em_seq->_checkpoints;
+  
+  if (checkpoints == NULL || _inner_iter == _inner_vec->end())
+    return;
+  
+  /* sub-iterators never cross segment boundaries */
+  int seg = checkpoints->segment_of((*_inner_iter).iter_offset());
+  if (seg == _seg)
+    return;
+  
+  /* (re)allocate segment buffer */
+  int n_states = em_seq->_hmm->state_count();
+  int capacity = n_states * checkpoints->segment_length();
+  if (capacity > _seg_capacity) {
+    if (_seg_post != NULL)
+      delete[] _seg_post;
+    _seg_post = new double[capacity];
+    _seg_capacity = capacity;
+  }
+  
+  /* private iterator copy: segment recomputation moves the iterator */
+  if (_seg_iter == NULL)
+    _seg_iter = em_seq->_iter->shallowCopy();
+  
+  /* shared with the other iterators over this sequence */
+  em_seq->segment(*_seg_iter, seg, NULL, NULL, _seg_post, NULL);
+  
+  _seg = seg;
+  _seg_start = checkpoints->segment_start(seg);
+  _seg_size = checkpoints->segment_size(seg);
+}
@@ -8,6 +8,7 @@ class EMSequence;
 class PosteriorIterator {
 public:
   PosteriorIterator(int state, int slot, const std::vector<EMSequence*> * seqs);
+  ~PosteriorIterator();
   void reset();
   
   bool next();
@@ -25,6 +26,17 @@ private:
   std::vector<Iter>::iterator _inner_iter;
   
   const std::vector<EMSequence*> * _seqs;
+  
+  // checkpointed sequences: posterior for the current segment only
+  Iter * _seg_iter;
+  int _seg;
+  int _seg_start;
+  int _seg_size;
+  int _seg_capacity;
+  double * _seg_post;
+  
+  void changed_sequence();
+  void update_segment();
 };
 
 #endif
@@ -0,0 +1,173 @@
+#include "post_stream.hpp"
+#include <cmath>
+#include <cstring>
+
+PosteriorStream::PosteriorStream(const HMM * hmm, int lag, int emission_slots, int * e_slot_dim,
+                                 int covar_slots, int * c_slot_dim, bool with_missing) :
+  _hmm(hmm), _n_states(hmm->state_count()), _lag(lag), _block(lag > 0 ? lag : 1), _capacity(1 + _lag + _block) {
+
+  assert(lag >= 0);
+
+  _emission_step = 0;
+  for (int i = 0; i < emission_slots; ++i)
+    _emission_step += e_slot_dim[i];
+  _covar_step = 0;
+  for (int i = 0; i < covar_slots; ++i)
+    _covar_step += c_slot_dim[i];
+  _emission_slots = emission_slots;
+  _missing_words = Iter::bitmap_words(_capacity);
+
+  /* window buffers: all positions hold valid values, even if unused */
+  _emissions = new double[_capacity * _emission_step];
+  memset(_emissions, 0, sizeof(double) * _capacity * _emission_step);
+  _covars = NULL;
+  if (_covar_step > 0) {
+    _covars = new double[_capacity * _covar_step];
+    memset(_covars, 0, sizeof(double) * _capacity * _covar_step);
+  }
+  _missing = NULL;
+  _iter = new Iter(_capacity, emission_slots, e_slot_dim, _emissions, covar_slots, c_slot_dim, _covars);
+  if (with_missing) {
+    _missing = new uint64_t[_missing_words * emission_slots];
+    memset(_missing, 0, sizeof(uint64_t) * _missing_words * emission_slots);
+    _iter->share_missing_bits(_missing, _missing_words);
+  }
+
+  _fw = new double[_capacity * _n_states];
+  _bk = new double[_capacity * _n_states];
+  _post = new double[_capacity * _n_states];
+  _logsum = LogSum::create(_n_states);
+
+  reset();
+}
+
+PosteriorStream::~PosteriorStream() {
+  delete _iter;
+  delete[] _emissions;
+  if (_covars != NULL)
+    delete[] _covars;
+  if (_missing != NULL)
+    delete[] _missing;
+  delete[] _fw;
+  delete[] _bk;
+  delete[] _post;
+  delete _logsum;
+}
+
+void PosteriorStream::reset() {
+  _n = 0;
+  _first_pending = 0;
+  _total = 0;
+  _n_post = 0;
+  _post_start = 0;
+  _loglik = 0;
+}
+
+int PosteriorStream::push(const double * emissions, const double * covars, const int * missing) {
+  int idx = _n;
+
+  /* copy position into window */
+  memcpy(_emissions + idx * _emission_step, emissions, sizeof(double) * _emission_step);
+  if (_covar_step > 0)
+    memcpy(_covars + idx * _covar_step, covars, sizeof(double) * _covar_step);
+  if (_missing != NULL)
+    for (int slot = 0; slot < _emission_slots; ++slot)
+      set_missing(idx, slot, missing[slot] != 0);
+
+  /* advance forward recursion */
+  try {
+    if (_total == 0)
+      _loglik = _hmm->forward_segment(*_iter, 0, 0, NULL, _fw, NULL, &_workspace);
+    else
+      _loglik = _hmm->forward_segment(*_iter, idx, idx, _fw + (idx - 1) * _n_states, _fw + idx * _n_states, NULL, &_workspace);
+  } catch (QHMMException & e) {
+    e.stack.push_back("posterior stream");
+    throw;
+  }
+  ++_n;
+  ++_total;
+
+  _n_post = 0;
+  if (_n - _first_pending < _lag + _block)
+    return 0;
+
+  return release(_block);
+}
+
+int PosteriorStream::finish() {
+  int result = 0;
+
+  _n_post = 0;
+  if (_n > _first_pending)
+    result = release(_n - _first_pending);
+
+  /* keep released posteriors & log-likelihood */
+  _n = 0;
+  _first_pending = 0;
+  _total = 0;
+
+  return result;
+}
+
+int PosteriorStream::release(int count) {
+  const int last = _n - 1;
+  double * bk_last = _bk + last * _n_states;
+
+  /* backward over pending window, truncated at newest position */
+  for (int k = 0; k < _n_states; ++k)
+    bk_last[k] = 0; /* log(1) */
+
+  try {
+    if (last > _first_pending)
+      _hmm->backward_segment(*_iter, _first_pending, last - 1, bk_last, _bk + _first_pending * _n_states, NULL, &_workspace);
+  } catch (QHMMException & e) {
+    e.stack.push_back("posterior stream");
+    throw;
+  }
+
+  /* posteriors for oldest positions */
+  for (int j = 0; j < count; ++j) {
+    const double * fw_j = _fw + (_first_pending + j) * _n_states;
+    const double * bk_j = _bk + (_first_pending + j) * _n_states;
+    double * post_j = _post + j * _n_states;
+
+    _logsum->clear();
+    for (int k = 0; k < _n_states; ++k)
+      _logsum->store(fw_j[k] + bk_j[k]);
+    double logPx = _logsum->compute();
+
+    for (int k = 0; k < _n_states; ++k)
+      post_j[k] = exp(fw_j[k] + bk_j[k] - logPx);
+  }
+  _n_post = count;
+  _post_start = _total - _n + _first_pending;
+
+  /* shift window: last released position is kept as the anchor for the
+     forward recursion */
+  int anchor = _first_pending + count - 1;
+  int n_keep = _n - anchor;
+
+  memmove(_emissions, _emissions + anchor * _emission_step, sizeof(double) * n_keep * _emission_step);
+  if (_covar_step > 0)
+    memmove(_covars, _covars + anchor * _covar_step, sizeof(double) * n_keep * _covar_step);
+  if (_missing != NULL)
+    for (int i = 0; i < n_keep; ++i)
+      for (int slot = 0; slot < _emission_slots; ++slot)
+        set_missing(i, slot, _iter->is_missing_at(slot, anchor + i));
+  memmove(_fw, _fw + anchor * _n_states, sizeof(double) * n_keep * _n_states);
+
+  _n = n_keep;
+  _first_pending = 1;
+
+  return count;
+}
+
+void PosteriorStream::set_missing(int idx, int slot, bool value) {
+  uint64_t & word = _missing[slot * _missing_words + (idx >> 6)];
+  const uint64_t bit = ((uint64_t) 1) << (idx & 63);
+
+  if (value)
+    word |= bit;
+  else
+    word &= ~bit;
+}
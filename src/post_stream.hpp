@@ -0,0 +1,87 @@
+#ifndef POST_STREAM_HPP
+#define POST_STREAM_HPP
+
+#include "hmm.hpp"
+#include "iter.hpp"
+#include "logsum.hpp"
+
+//
+// Streaming posterior decoding with fixed-lag smoothing.
+//
+// Positions are pushed one at a time and the forward recursion is advanced
+// immediately. Once lag + block positions are pending, the backward
+// recursion is run over the pending window (truncated at the newest
+// position) and the posteriors for the oldest block positions are
+// released. Each released posterior is therefore conditioned on all
+// previous data and on at least lag subsequent positions.
+//
+// Only the data and forward columns for the current window are kept, so
+// memory use is O((n_states + data dimension) * lag), independent of the
+// stream length. Positions still pending when the stream ends are released
+// by finish() and those are exact (same as HMM::state_posterior).
+//
+class PosteriorStream {
+public:
+  // slot layout as in Iter
+  // with_missing: pushed positions carry missing data flags (one per emission slot)
+  PosteriorStream(const HMM * hmm, int lag, int emission_slots, int * e_slot_dim,
+                  int covar_slots = 0, int * c_slot_dim = NULL, bool with_missing = false);
+  ~PosteriorStream();
+
+  // append one position (same layout as a single Iter row)
+  // returns the number of positions with newly available posteriors
+  int push(const double * emissions, const double * covars = NULL, const int * missing = NULL);
+
+  // end of stream: releases all pending positions and resets the stream
+  int finish();
+
+  // discard all state (start a new sequence)
+  void reset();
+
+  // posteriors released by the last push()/finish() call
+  // n_states values per position, one position after the other
+  const double * posterior() const { return _post; }
+  int posterior_count() const { return _n_post; }
+  // sequence index of the first released position
+  int posterior_start() const { return _post_start; }
+
+  // log-likelihood of the positions pushed so far
+  double loglik() const { return _loglik; }
+
+  int lag() const { return _lag; }
+
+private:
+  const HMM * _hmm;
+  const int _n_states;
+  const int _lag;
+  const int _block; // positions released at a time
+  const int _capacity; // anchor + lag + block
+
+  // window data (Iter over the window buffers)
+  Iter * _iter;
+  double * _emissions;
+  double * _covars;
+  uint64_t * _missing; // window bitmaps (see Iter::share_missing_bits)
+  int _emission_slots;
+  int _emission_step;
+  int _covar_step;
+  size_t _missing_words;
+
+  double * _fw;
+  double * _bk;
+  double * _post;
+  LogSum * _logsum;
+  Workspace _workspace;
+
+  int _n; // positions in window
+  int _first_pending; // window index of first unreleased position
+  int _total; // positions pushed
+  int _n_post;
+  int _post_start;
+  double _loglik;
+
+  int release(int count);
+  void set_missing(int idx, int slot, bool value);
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "run_iter.hpp"
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+/* missing data flags of source at position i (empty without missing data) */
+static void missing_row(Iter const & source, int i, std::vector<char> & flags) {
+  flags.clear();
+  if (source.has_missing())
+    for (int slot = 0; slot < source.emission_slot_count(); ++slot)
+      flags.push_back(source.is_missing_at(slot, i) ? 1 : 0);
+}
+
+static bool all_set(std::vector<char> const & flags) {
+  for (unsigned int i = 0; i < flags.size(); ++i)
+    if (!flags[i])
+      return false;
+  return !flags.empty();
+}
+
+RunIter::RunIter(Iter const & source, bool merge_missing) : Iter(source) {
+  const int n = source._length;
+  const char * emissions = source._emission_start;
+  const double * covars = (_covar_step > 0 ? source._covar_start : NULL);
+  std::vector<int> starts;
+  std::vector<char> row_missing, prev_missing;
+  std::vector<int> missing;
+  std::map<std::string, int> values;
+
+  /* own copies of the slot layout (source may be a copy or sub-iterator) */
+  _is_subiterator = false;
+  _is_copy = false;
+  _offset = 0;
+  _index = 0;
+  _emission_offsets = new int[_emission_slot_count];
+  memcpy(_emission_offsets, source._emission_offsets, sizeof(int) * _emission_slot_count);
+  _emission_types = new int[_emission_slot_count];
+  memcpy(_emission_types, source._emission_types, sizeof(int) * _emission_slot_count);
+  if (source._covar_offsets != NULL) {
+    _covar_offsets = new int[_covar_slot_count];
+    memcpy(_covar_offsets, source._covar_offsets, sizeof(int) * _covar_slot_count);
+  }
+  _missing_bits = NULL;
+  _missing_owned = NULL;
+
+  /* find runs */
+  for (int i = 0; i < n; ++i) {
+    missing_row(source, i, row_missing);
+
+    bool same = (i > 0 && row_missing == prev_missing);
+    if (same && covars != NULL)
+      same = (memcmp(covars + (size_t) (i - 1) * _covar_step, covars + (size_t) i * _covar_step, sizeof(double) * _covar_step) == 0);
+    if (same && !(merge_missing && all_set(row_missing)))
+      same = (memcmp(emissions + (size_t) (i - 1) * _emission_step, emissions + (size_t) i * _emission_step, _emission_step) == 0);
+
+    if (!same)
+      starts.push_back(i);
+    prev_missing.swap(row_missing);
+  }
+
+  const int n_runs = starts.size();
+  _run_start = new int[n_runs + 1];
+  _run_value = new int[n_runs];
+  _emissions = new char[(size_t) n_runs * _emission_step];
+  _covars = (covars != NULL ? new double[(size_t) n_runs * _covar_step] : NULL);
+
+  for (int j = 0; j < n_runs; ++j) {
+    const int i = starts[j];
+    char * e_row = _emissions + (size_t) j * _emission_step;
+    std::string key;
+
+    missing_row(source, i, row_missing);
+    for (unsigned int slot = 0; slot < row_missing.size(); ++slot)
+      missing.push_back(row_missing[slot]);
+
+    _run_start[j] = i;
+    if (merge_missing && all_set(row_missing))
+      memset(e_row, 0, _emission_step);
+    else
+      memcpy(e_row, emissions + (size_t) i * _emission_step, _emission_step);
+    key.append(e_row, _emission_step);
+    if (_covars != NULL) {
+      memcpy(_covars + (size_t) j * _covar_step, covars + (size_t) i * _covar_step, sizeof(double) * _covar_step);
+      key.append((const char *) (covars + (size_t) i * _covar_step), sizeof(double) * _covar_step);
+    }
+    key.append(row_missing.begin(), row_missing.end());
+
+    std::map<std::string, int>::iterator it = values.find(key);
+    if (it == values.end())
+      it = values.insert(std::make_pair(key, (int) values.size())).first;
+    _run_value[j] = it->second;
+  }
+  _run_start[n_runs] = n;
+  _n_values = values.size();
+
+  /* iterate over the runs */
+  _length = n_runs;
+  _emission_start = _emission_ptr = _emissions;
+  _emission_end = _emissions + (size_t) (n_runs - 1) * _emission_step;
+  if (_covars != NULL) {
+    _covar_start = _covar_ptr = _covars;
+    _covar_end = _covars + (size_t) (n_runs - 1) * _covar_step;
+  } else
+    _covar_start = _covar_ptr = _covar_end = NULL;
+  if (source.has_missing())
+    pack_missing(&missing[0]);
+}
+
+RunIter::~RunIter() {
+  delete[] _emissions;
+  if (_covars != NULL)
+    delete[] _covars;
+  delete[] _run_start;
+  delete[] _run_value;
+}
@@ -0,0 +1,51 @@
+#ifndef RUN_ITER_HPP
+#define RUN_ITER_HPP
+
+#include "iter.hpp"
+
+//
+// Run-length encoded sequence.
+//
+// Consecutive positions with identical emissions, covariates and missing
+// data flags form a run and are stored once. As an Iter, a RunIter has one
+// position per run (holding the run's data), so emission and transition
+// functions evaluated at position j give the values for every sequence
+// position of run j. Runs with identical data (not necessarily adjacent)
+// share a value id.
+//
+// With merge_missing, positions with all emission slots missing compare
+// equal whatever their emission data, so a stretch of missing data is a
+// single run (only valid if every emission function is missing data aware,
+// i.e. wrapped by MissingEmissionFunction).
+//
+// See HMM::forward_runs/backward_runs/state_posterior_runs.
+//
+class RunIter : public Iter {
+public:
+  // compresses all positions of source (the RunIter owns a copy of the data)
+  RunIter(Iter const & source, bool merge_missing = false);
+  virtual ~RunIter();
+
+  int run_count() const { return _length; }
+  int sequence_length() const { return _run_start[_length]; }
+
+  // first sequence position & number of positions of run j
+  int run_start(int j) const { return _run_start[j]; }
+  int run_length(int j) const { return _run_start[j + 1] - _run_start[j]; }
+
+  // runs j and j' have the same data iff run_value(j) == run_value(j')
+  int run_value(int j) const { return _run_value[j]; }
+  int value_count() const { return _n_values; }
+
+private:
+  char * _emissions;
+  double * _covars;
+  int * _run_start; // run_count() + 1 entries
+  int * _run_value;
+  int _n_values;
+
+  RunIter(const RunIter &);
+  RunIter & operator=(const RunIter &);
+};
+
+#endif
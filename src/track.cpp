@@ -0,0 +1,493 @@
+#include "track.hpp"
+#include "log.hpp"
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char MAGIC[8] = { 'Q', 'H', 'M', 'M', 'T', 'R', 'K', '\0' };
+static const int32_t VERSION = 1;
+static const int32_t BYTE_ORDER_MARK = 0x01020304;
+static const size_t FIXED_HEADER_SIZE = 40;
+static const size_t COLUMN_ENTRY_SIZE = 16;
+
+static size_t align8(size_t offset) {
+  return (offset + 7) / 8 * 8;
+}
+
+static size_t type_size(int type) {
+  switch (type) {
+    case TrackFile::UINT16: return 2;
+    case TrackFile::UINT32: return 4;
+    case TrackFile::FLOAT32: return 4;
+    case TrackFile::FLOAT64: return 8;
+  }
+  return 0;
+}
+
+/* Iter::ElementType holding values of a column type */
+static int element_type(int type) {
+  switch (type) {
+    case TrackFile::UINT16: return Iter::UINT16;
+    case TrackFile::UINT32: return Iter::UINT32;
+    case TrackFile::FLOAT32: return Iter::FLOAT32;
+  }
+  return Iter::FLOAT64;
+}
+
+TrackFile::TrackFile() : _map(NULL), _size(0), _mapped(false), _length(0), _emission_slots(0), _covar_slots(0),
+  _e_slot_dim(NULL), _c_slot_dim(NULL), _e_slot_type(NULL), _e_offsets(NULL), _e_row_size(0), _emission_size(0), _covar_size(0), _n_columns(0), _types(NULL),
+  _columns(NULL), _missing(NULL), _missing_words(0) {}
+
+TrackFile::~TrackFile() {
+  if (_map != NULL) {
+#ifndef _WIN32
+    if (_mapped)
+      munmap(_map, _size);
+    else
+#endif
+      delete[] (char*) _map;
+  }
+  delete[] _e_slot_dim;
+  delete[] _c_slot_dim;
+  delete[] _e_slot_type;
+  delete[] _e_offsets;
+  delete[] _types;
+  delete[] _columns;
+}
+
+TrackFile * TrackFile::open(const char * path) {
+  TrackFile * track = new TrackFile();
+
+  /* map file */
+#ifndef _WIN32
+  int fd = ::open(path, O_RDONLY);
+  struct stat info;
+
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    log_msg("can't open track file: %s\n", path);
+    if (fd >= 0)
+      close(fd);
+    delete track;
+    return NULL;
+  }
+  track->_size = info.st_size;
+  if (track->_size >= FIXED_HEADER_SIZE) {
+    void * map = mmap(NULL, track->_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      track->_map = map;
+      track->_mapped = true;
+    }
+  }
+  close(fd);
+#else
+  FILE * file = fopen(path, "rb");
+
+  if (file == NULL) {
+    log_msg("can't open track file: %s\n", path);
+    delete track;
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  track->_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (track->_size >= FIXED_HEADER_SIZE) {
+    char * data = new char[track->_size];
+    if (fread(data, 1, track->_size, file) == track->_size)
+      track->_map = data;
+    else
+      delete[] data;
+  }
+  fclose(file);
+#endif
+
+  if (track->_map == NULL) {
+    log_msg("can't read track file: %s\n", path);
+    delete track;
+    return NULL;
+  }
+
+  /* header */
+  const char * base = (const char *) track->_map;
+  int32_t version, byte_order, emission_slots, covar_slots, has_missing, n_columns;
+  int64_t length;
+
+  memcpy(&version, base + 8, 4);
+  memcpy(&byte_order, base + 12, 4);
+  memcpy(&length, base + 16, 8);
+  memcpy(&emission_slots, base + 24, 4);
+  memcpy(&covar_slots, base + 28, 4);
+  memcpy(&has_missing, base + 32, 4);
+  memcpy(&n_columns, base + 36, 4);
+
+  if (memcmp(base, MAGIC, 8) != 0 || version != VERSION || byte_order != BYTE_ORDER_MARK) {
+    log_msg("not a track file (or different version/byte order): %s\n", path);
+    delete track;
+    return NULL;
+  }
+
+  size_t dims_end = FIXED_HEADER_SIZE + 4 * ((size_t) emission_slots + covar_slots);
+  if (length <= 0 || length > INT_MAX || emission_slots <= 0 || covar_slots < 0 || n_columns < emission_slots || dims_end > track->_size) {
+    log_msg("invalid track header: %s\n", path);
+    delete track;
+    return NULL;
+  }
+
+  track->_length = (int) length;
+  track->_emission_slots = emission_slots;
+  track->_covar_slots = covar_slots;
+  track->_e_slot_dim = new int[emission_slots];
+  track->_c_slot_dim = new int[covar_slots];
+  for (int i = 0; i < emission_slots; ++i) {
+    int32_t dim;
+    memcpy(&dim, base + FIXED_HEADER_SIZE + 4 * i, 4);
+    track->_e_slot_dim[i] = dim;
+    track->_emission_size += dim;
+  }
+  for (int i = 0; i < covar_slots; ++i) {
+    int32_t dim;
+    memcpy(&dim, base + FIXED_HEADER_SIZE + 4 * (emission_slots + i), 4);
+    track->_c_slot_dim[i] = dim;
+    track->_covar_size += dim;
+  }
+
+  size_t table = align8(dims_end);
+  size_t missing_entry = table + COLUMN_ENTRY_SIZE * (size_t) n_columns;
+  if (n_columns != track->_emission_size + track->_covar_size || missing_entry + 8 > track->_size) {
+    log_msg("invalid track header: %s\n", path);
+    delete track;
+    return NULL;
+  }
+
+  /* column table */
+  track->_n_columns = n_columns;
+  track->_types = new int[n_columns];
+  track->_columns = new const char*[n_columns];
+  for (int c = 0; c < n_columns; ++c) {
+    int32_t type;
+    int64_t offset;
+    memcpy(&type, base + table + COLUMN_ENTRY_SIZE * c, 4);
+    memcpy(&offset, base + table + COLUMN_ENTRY_SIZE * c + 8, 8);
+
+    size_t size = type_size(type);
+    if (size == 0 || offset <= 0 || offset % 8 != 0 || (size_t) offset + size * track->_length > track->_size) {
+      log_msg("invalid column %d in track file: %s\n", c + 1, path);
+      delete track;
+      return NULL;
+    }
+    track->_types[c] = type;
+    track->_columns[c] = base + offset;
+  }
+
+  /* emission slot types & row layout */
+  track->_e_slot_type = new int[emission_slots];
+  track->_e_offsets = new int[emission_slots];
+  for (int i = 0, c = 0; i < emission_slots; c += track->_e_slot_dim[i], ++i) {
+    int type = (track->_e_slot_dim[i] > 0 ? track->_types[c] : FLOAT64);
+    for (int d = 1; d < track->_e_slot_dim[i]; ++d)
+      if (track->_types[c + d] != type)
+        type = FLOAT64;
+    track->_e_slot_type[i] = element_type(type);
+  }
+  track->_e_row_size = Iter::emission_layout(emission_slots, track->_e_slot_dim, track->_e_slot_type, track->_e_offsets);
+
+  /* missing data bitmaps */
+  int64_t missing_offset;
+  memcpy(&missing_offset, base + missing_entry, 8);
+  if (has_missing) {
+    track->_missing_words = Iter::bitmap_words(track->_length);
+    if (missing_offset <= 0 || missing_offset % 8 != 0 ||
+        (size_t) missing_offset + 8 * track->_missing_words * emission_slots > track->_size) {
+      log_msg("invalid missing data flags in track file: %s\n", path);
+      delete track;
+      return NULL;
+    }
+    track->_missing = (const uint64_t *) (base + missing_offset);
+  }
+
+#ifndef _WIN32
+  /* tracks are mostly read front to back */
+  madvise(track->_map, track->_size, MADV_SEQUENTIAL);
+#endif
+
+  return track;
+}
+
+/* writes size bytes, followed by zeros up to the next multiple of 8 */
+static bool write_padded(FILE * file, const void * data, size_t size, size_t & offset) {
+  static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  size_t padding = align8(offset + size) - offset - size;
+
+  if (size > 0 && fwrite(data, 1, size, file) != size)
+    return false;
+  if (padding > 0 && fwrite(zeros, 1, padding, file) != padding)
+    return false;
+  offset += size + padding;
+  return true;
+}
+
+/* encodes one value, returns false if it doesn't fit type */
+static bool encode(double value, int type, char * out) {
+  switch (type) {
+    case TrackFile::UINT16:
+    case TrackFile::UINT32: {
+      double max = (type == TrackFile::UINT16 ? 65535.0 : 4294967295.0);
+      if (!(value >= 0 && value <= max && value == floor(value)))
+        return false;
+      if (type == TrackFile::UINT16) {
+        uint16_t v = (uint16_t) value;
+        memcpy(out, &v, 2);
+      } else {
+        uint32_t v = (uint32_t) value;
+        memcpy(out, &v, 4);
+      }
+      return true;
+    }
+    case TrackFile::FLOAT32: {
+      float v = (float) value;
+      memcpy(out, &v, 4);
+      return true;
+    }
+    case TrackFile::FLOAT64:
+      memcpy(out, &value, 8);
+      return true;
+  }
+  return false;
+}
+
+bool TrackFile::write(const char * path, int length,
+                      int emission_slots, const int * e_slot_dim, const double * emissions, const int * e_types,
+                      int covar_slots, const int * c_slot_dim, const double * covars, const int * c_types,
+                      const int * missing) {
+  const int block = 4096; /* positions per fwrite */
+  int emission_size = 0, covar_size = 0;
+  std::vector<int> types;
+  std::vector<int> slot_of; /* emission slot of each emission column */
+
+  for (int i = 0; i < emission_slots; ++i)
+    for (int d = 0; d < e_slot_dim[i]; ++d, ++emission_size) {
+      types.push_back(e_types != NULL ? e_types[emission_size] : FLOAT64);
+      slot_of.push_back(i);
+    }
+  for (int i = 0; i < covar_slots; ++i)
+    for (int d = 0; d < c_slot_dim[i]; ++d, ++covar_size)
+      types.push_back(c_types != NULL ? c_types[covar_size] : FLOAT64);
+  const int n_columns = emission_size + covar_size;
+
+  for (int c = 0; c < n_columns; ++c)
+    if (type_size(types[c]) == 0) {
+      log_msg("invalid column type for column %d: %d\n", c + 1, types[c]);
+      return false;
+    }
+
+  /* layout */
+  size_t table = align8(FIXED_HEADER_SIZE + 4 * ((size_t) emission_slots + covar_slots));
+  size_t offset = align8(table + COLUMN_ENTRY_SIZE * (size_t) n_columns + 8);
+  std::vector<int64_t> offsets;
+  for (int c = 0; c < n_columns; ++c) {
+    offsets.push_back(offset);
+    offset = align8(offset + type_size(types[c]) * (size_t) length);
+  }
+  int64_t missing_offset = (missing != NULL ? (int64_t) offset : 0);
+
+  FILE * file = fopen(path, "wb");
+  if (file == NULL) {
+    log_msg("can't create track file: %s\n", path);
+    return false;
+  }
+
+  /* header */
+  std::vector<char> header(table + COLUMN_ENTRY_SIZE * n_columns + 8, 0);
+  char * h = &header[0];
+  int64_t length64 = length;
+  int32_t has_missing = (missing != NULL ? 1 : 0);
+  int32_t n_columns32 = n_columns;
+
+  memcpy(h, MAGIC, 8);
+  memcpy(h + 8, &VERSION, 4);
+  memcpy(h + 12, &BYTE_ORDER_MARK, 4);
+  memcpy(h + 16, &length64, 8);
+  memcpy(h + 24, &emission_slots, 4);
+  memcpy(h + 28, &covar_slots, 4);
+  memcpy(h + 32, &has_missing, 4);
+  memcpy(h + 36, &n_columns32, 4);
+  for (int i = 0; i < emission_slots; ++i)
+    memcpy(h + FIXED_HEADER_SIZE + 4 * i, e_slot_dim + i, 4);
+  for (int i = 0; i < covar_slots; ++i)
+    memcpy(h + FIXED_HEADER_SIZE + 4 * (emission_slots + i), c_slot_dim + i, 4);
+  for (int c = 0; c < n_columns; ++c) {
+    int32_t type = types[c];
+    memcpy(h + table + COLUMN_ENTRY_SIZE * c, &type, 4);
+    memcpy(h + table + COLUMN_ENTRY_SIZE * c + 8, &offsets[c], 8);
+  }
+  memcpy(h + table + COLUMN_ENTRY_SIZE * n_columns, &missing_offset, 8);
+
+  size_t written = 0;
+  bool ok = write_padded(file, h, header.size(), written);
+
+  /* columns */
+  std::vector<char> buffer(8 * block);
+  for (int c = 0; c < n_columns && ok; ++c) {
+    const bool is_emission = (c < emission_size);
+    const double * data = (is_emission ? emissions + c : covars + (c - emission_size));
+    const int step = (is_emission ? emission_size : covar_size);
+    const size_t size = type_size(types[c]);
+
+    for (int first = 0; first < length && ok; first += block) {
+      const int count = (length - first < block ? length - first : block);
+
+      for (int i = 0; i < count; ++i) {
+        const int pos = first + i;
+        double value = data[(size_t) pos * step];
+
+        if (is_emission && missing != NULL && missing[(size_t) pos * emission_slots + slot_of[c]] != 0)
+          value = 0;
+
+        if (!encode(value, types[c], &buffer[i * size])) {
+          log_msg("value %g at position %d doesn't fit the type of column %d\n", value, pos + 1, c + 1);
+          ok = false;
+          break;
+        }
+      }
+
+      if (ok)
+        ok = (fwrite(&buffer[0], size, count, file) == (size_t) count);
+    }
+
+    if (ok) {
+      size_t column_size = size * (size_t) length;
+      ok = write_padded(file, NULL, 0, column_size);
+      written += column_size;
+    }
+  }
+
+  /* missing data bitmaps */
+  if (missing != NULL && ok) {
+    std::vector<uint64_t> words(Iter::bitmap_words(length));
+
+    for (int s = 0; s < emission_slots && ok; ++s) {
+      for (size_t w = 0; w < words.size(); ++w)
+        words[w] = 0;
+      for (int i = 0; i < length; ++i)
+        if (missing[(size_t) i * emission_slots + s] != 0)
+          words[i / 64] |= ((uint64_t) 1) << (i % 64);
+      ok = (fwrite(&words[0], 8, words.size(), file) == words.size());
+    }
+  }
+
+  if (fclose(file) != 0)
+    ok = false;
+  if (!ok) {
+    log_msg("failed to write track file: %s\n", path);
+    remove(path);
+  }
+  return ok;
+}
+
+/* out[i * step] = in[start + i] */
+template<typename From, typename To>
+static void copy_column(const void * column, int start, int count, char * out, size_t step) {
+  const From * in = (const From *) column + start;
+
+  for (int i = 0; i < count; ++i)
+    *((To *) (out + i * step)) = (To) in[i];
+}
+
+template<typename To>
+static void copy_column(int type, const void * column, int start, int count, char * out, size_t step) {
+  switch (type) {
+    case TrackFile::UINT16: copy_column<uint16_t, To>(column, start, count, out, step); break;
+    case TrackFile::UINT32: copy_column<uint32_t, To>(column, start, count, out, step); break;
+    case TrackFile::FLOAT32: copy_column<float, To>(column, start, count, out, step); break;
+    case TrackFile::FLOAT64: copy_column<double, To>(column, start, count, out, step); break;
+  }
+}
+
+void TrackFile::decode(int start, int count, void * emissions, double * covars, int * missing) const {
+  assert(start >= 0 && count >= 0 && start + count <= _length);
+
+  if (emissions != NULL) {
+    for (int s = 0, c = 0; s < _emission_slots; ++s) {
+      const int size = Iter::element_size(_e_slot_type[s]);
+
+      for (int d = 0; d < _e_slot_dim[s]; ++d, ++c) {
+        char * out = (char *) emissions + _e_offsets[s] + d * size;
+
+        switch (_e_slot_type[s]) {
+          case Iter::UINT16: copy_column<uint16_t>(_types[c], _columns[c], start, count, out, _e_row_size); break;
+          case Iter::UINT32: copy_column<uint32_t>(_types[c], _columns[c], start, count, out, _e_row_size); break;
+          case Iter::FLOAT32: copy_column<float>(_types[c], _columns[c], start, count, out, _e_row_size); break;
+          default: copy_column<double>(_types[c], _columns[c], start, count, out, _e_row_size);
+        }
+      }
+    }
+  }
+
+  if (covars != NULL) {
+    for (int c = 0; c < _covar_size; ++c) {
+      const int column = _emission_size + c;
+      copy_column<double>(_types[column], _columns[column], start, count, (char *) (covars + c), sizeof(double) * _covar_size);
+    }
+  }
+
+  if (missing != NULL && _missing != NULL) {
+    for (int s = 0; s < _emission_slots; ++s) {
+      const uint64_t * bits = _missing + s * _missing_words;
+      for (int i = 0; i < count; ++i) {
+        const int pos = start + i;
+        missing[(size_t) i * _emission_slots + s] = (int) ((bits[pos / 64] >> (pos % 64)) & 1);
+      }
+    }
+  }
+}
+
+int TrackIter::window(TrackFile const & track, int start, int count) {
+  assert(start >= 0 && start < track.length());
+  if (count < 0 || start + count > track.length())
+    count = track.length() - start;
+  return count;
+}
+
+/* single emission column: its data already is an Iter emission array */
+bool TrackIter::in_place(TrackFile const & track) {
+  return track.emission_size() == 1;
+}
+
+void * TrackIter::emission_buffer(TrackFile const & track, int start, int count) {
+  if (in_place(track))
+    return (char *) track.column(0) + (size_t) start * Iter::element_size(track.e_slot_type()[0]);
+  /* zero filled: RunIter compares whole rows, padding included */
+  return new char[(size_t) window(track, start, count) * track.emission_row_size()]();
+}
+
+double * TrackIter::covar_buffer(TrackFile const & track, int start, int count) {
+  int size = track.column_count() - track.emission_size();
+  if (size == 0)
+    return NULL;
+  return new double[(size_t) window(track, start, count) * size];
+}
+
+TrackIter::TrackIter(TrackFile const & track, int start, int count) :
+  Iter(window(track, start, count), track.emission_slots(), const_cast<int*>(track.e_slot_dim()), const_cast<int*>(track.e_slot_type()),
+       emission_buffer(track, start, count), track.covar_slots(), const_cast<int*>(track.c_slot_dim()), covar_buffer(track, start, count)),
+  _start(start), _owns_emissions(!in_place(track)) {
+  track.decode(start, _length, (_owns_emissions ? _emission_start : NULL), _covar_start, NULL);
+  if (track.has_missing())
+    share_missing_bits(track.missing_bits(), track.missing_words(), start);
+}
+
+TrackIter::~TrackIter() {
+  if (_owns_emissions)
+    delete[] _emission_start;
+  if (_covar_start != NULL)
+    delete[] _covar_start;
+}
@@ -0,0 +1,129 @@
+#ifndef TRACK_HPP
+#define TRACK_HPP
+
+#include <cstddef>
+#include <stdint.h>
+#include "iter.hpp"
+
+//
+// Binary track files.
+//
+// A track holds the emissions, covariates and missing data flags of one
+// sequence in columnar form: one typed column per emission and covariate
+// dimension (uint16/uint32 counts, float32/float64 values) and one bit
+// per position and emission slot for the missing data flags. Files are
+// memory mapped, so opening a track is immediate and only the positions
+// actually used are read from disk.
+//
+// Layout (native byte order, all offsets 8 byte aligned):
+//   header: magic "QHMMTRK", version, byte order mark, length, slot counts,
+//           missing data flag, column count, slot dimensions
+//   column table: type & offset per column (emission columns first)
+//   missing offset (0 = no missing data flags)
+//   column data; missing data bitmaps (one per emission slot, 64 bit words)
+//
+class TrackFile {
+public:
+  enum ColumnType { UINT16 = 1, UINT32 = 2, FLOAT32 = 3, FLOAT64 = 4 };
+
+  // returns NULL (reason is logged) if path can't be mapped or isn't a track
+  static TrackFile * open(const char * path);
+  ~TrackFile();
+
+  // converter: writes length positions in Iter layout to path
+  // e_types/c_types: ColumnType per emission/covariate column (NULL = FLOAT64)
+  // missing values are stored as 0
+  // returns false (reason is logged) if a value doesn't fit its column type or
+  // the file can't be written
+  static bool write(const char * path, int length,
+                    int emission_slots, const int * e_slot_dim, const double * emissions, const int * e_types,
+                    int covar_slots, const int * c_slot_dim, const double * covars, const int * c_types,
+                    const int * missing = NULL);
+
+  int length() const { return _length; }
+  int emission_slots() const { return _emission_slots; }
+  const int * e_slot_dim() const { return _e_slot_dim; }
+  int covar_slots() const { return _covar_slots; }
+  const int * c_slot_dim() const { return _c_slot_dim; }
+  bool has_missing() const { return _missing != NULL; }
+  // missing data bitmaps (see Iter::share_missing_bits)
+  const uint64_t * missing_bits() const { return _missing; }
+  size_t missing_words() const { return _missing_words; }
+
+  // Iter::ElementType of each emission slot (column type if all columns of
+  // the slot share it, FLOAT64 otherwise)
+  const int * e_slot_type() const { return _e_slot_type; }
+  int emission_size() const { return _emission_size; } // emission columns
+  int emission_row_size() const { return _e_row_size; } // bytes
+
+  // emission columns first, then covariate columns
+  int column_count() const { return _n_columns; }
+  int column_type(int column) const { return _types[column]; }
+  const void * column(int column) const { return _columns[column]; }
+
+  // decodes positions [start, start + count) in Iter layout, with emission
+  // rows laid out by Iter::emission_layout for e_slot_type()
+  // (emissions, covars, missing: ignored if NULL)
+  void decode(int start, int count, void * emissions, double * covars, int * missing) const;
+
+private:
+  TrackFile();
+
+  void * _map;
+  size_t _size;
+  bool _mapped; // false: _map is a heap copy (no mmap support)
+
+  int _length;
+  int _emission_slots;
+  int _covar_slots;
+  int * _e_slot_dim;
+  int * _c_slot_dim;
+  int * _e_slot_type;
+  int * _e_offsets; // emission row layout
+  int _e_row_size;
+  int _emission_size; // emission columns
+  int _covar_size; // covariate columns
+
+  int _n_columns;
+  int * _types;
+  const char ** _columns;
+  const uint64_t * _missing; // bitmaps, NULL if none
+  size_t _missing_words; // words per emission slot
+
+  TrackFile(const TrackFile &);
+  TrackFile & operator=(const TrackFile &);
+};
+
+//
+// Iter over positions [start, start + count) of a track.
+//
+// The window is decoded into buffers owned by the iterator, so a track
+// larger than memory can be processed in chunks (e.g. feeding a
+// PosteriorStream) while the rest of the file stays on disk. Emission slots
+// keep the column types (see TrackFile::e_slot_type). Missing data bitmaps,
+// and the emissions of a track with a single emission column, are read in
+// place from the mapped file, so the iterator must not outlive the TrackFile.
+//
+class TrackIter : public Iter {
+public:
+  // count < 0: up to the end of the track
+  TrackIter(TrackFile const & track, int start = 0, int count = -1);
+  virtual ~TrackIter();
+
+  // first track position of the window
+  int start() const { return _start; }
+
+private:
+  const int _start;
+  const bool _owns_emissions;
+
+  static int window(TrackFile const & track, int start, int count);
+  static bool in_place(TrackFile const & track);
+  static void * emission_buffer(TrackFile const & track, int start, int count);
+  static double * covar_buffer(TrackFile const & track, int start, int count);
+
+  TrackIter(const TrackIter &);
+  TrackIter & operator=(const TrackIter &);
+};
+
+#endif
@@ -1,12 +1,19 @@
 #include "trans_post_iter.hpp"
 #include "em_seq.hpp"
+#include "checkpoint.hpp"
 
-TransitionPosteriorIterator::TransitionPosteriorIterator(std::vector<TransitionFunction*> & group, const std::vector<EMSequence*> * seqs) {
+TransitionPosteriorIterator::TransitionPosteriorIterator(std::vector<TransitionFunction*> & group, const std::vector<EMSequence*> * seqs, int first, int last) {
   
   // initialize sequence iterator
-  _seqs = seqs;
-  _seq_iter = seqs->begin();
+  _seq_begin = seqs->begin() + first;
+  _seq_end = (last < 0 ? seqs->end() : seqs->begin() + last);
+  _seq_iter = _seq_begin;
   _iter = NULL;
+  _seg_iter = NULL;
+  _seg_capacity = 0;
+  _seg_fw = NULL;
+  _seg_bk = NULL;
+  _seg_logPx = NULL;
   
   // initialize group information
   _group_size = group.size();
@@ -29,6 +36,13 @@ TransitionPosteriorIterator::TransitionPosteriorIterator(std::vector<TransitionF
 TransitionPosteriorIterator::~TransitionPosteriorIterator() {
   delete[] _trans_post;
   delete[] _group_ids;
+  if (_seg_iter != NULL)
+    delete _seg_iter;
+  if (_seg_fw != NULL) {
+    delete[] _seg_fw;
+    delete[] _seg_bk;
+    delete[] _seg_logPx;
+  }
 #ifdef _OPENMP
   // created in "change_sequence()
   if (_iter != NULL)
@@ -37,7 +51,7 @@ TransitionPosteriorIterator::~TransitionPosteriorIterator() {
 }
 
 void TransitionPosteriorIterator::reset() {
-  _seq_iter = _seqs->begin();
+  _seq_iter = _seq_begin;
   changed_sequence();
   next(); /* will update values for first transition
            and cause iterator to be over second position
@@ -49,15 +63,33 @@ bool TransitionPosteriorIterator::next() {
   bool res = _iter->next();
   
   // try to move to next sequence(s)
-  while (!res && _seq_iter != _seqs->end() && (++_seq_iter != _seqs->end())) {
+  while (!res && _seq_iter != _seq_end && (++_seq_iter != _seq_end)) {
     changed_sequence();
     res = _iter->next();
   }
   
   if (res) {
-    double logPxi = _local_logPx[_iter->index()]; // NOTE: RHMM used local Px at src not target ...
-    (*_seq_iter)->hmm()->transition_posterior(*_iter, _fw, _bk, logPxi, _group_size, _group_ids, _n_targets, _trans_post);
+    int index = _iter->index();
+    int n_states = (*_seq_iter)->hmm()->state_count();
+    const double * fw_src;
+    const double * bk_tgt;
+    const double * e_tgt;
+    double logPxi;
+    
+    if (_checkpoints != NULL) {
+      update_segment(index);
+      fw_src = (index == _seg_start ? _checkpoints->forward_checkpoint(_seg - 1) : _seg_fw + n_states * (index - 1 - _seg_start));
+      bk_tgt = _seg_bk + n_states * (index - _seg_start);
+      e_tgt = NULL;
+      logPxi = _seg_logPx[index - _seg_start];
+    } else {
+      fw_src = _fw + n_states * (index - 1);
+      bk_tgt = _bk + n_states * index;
+      e_tgt = (_emissions != NULL ? _emissions + n_states * index : NULL);
+      logPxi = _local_logPx[index]; // NOTE: RHMM used local Px at src not target ...
+    }
     
+    (*_seq_iter)->hmm()->transition_posterior(*_iter, fw_src, bk_tgt, logPxi, _group_size, _group_ids, _n_targets, _trans_post, e_tgt);
   }
   return res;
 }
@@ -75,5 +107,44 @@ void TransitionPosteriorIterator::changed_sequence() {
   _iter->resetFirst();
   _fw = (*_seq_iter)->forward();
   _bk = (*_seq_iter)->backward();
-  _local_logPx = (*_seq_iter)->local_loglik();
+  _emissions = (*_seq_iter)->emissions();
+  _checkpoints = (*_seq_iter)->checkpoints();
+  _local_logPx = (_checkpoints == NULL ? (*_seq_iter)->local_loglik() : NULL);
+  
+  if (_seg_iter != NULL) {
+    delete _seg_iter;
+    _seg_iter = NULL;
+  }
+  _seg = -1;
+}
+
+void TransitionPosteriorIterator::update_segment(int index) {
+  int seg = _checkpoints->segment_of(index);
+  if (seg == _seg)
+    return;
+  
+  /* (re)allocate segment buffers */
+  int n_states = (*_seq_iter)->hmm()->state_count();
+  int seg_length = _checkpoints->segment_length();
+  if (n_states * seg_length > _seg_capacity) {
+    if (_seg_fw != NULL) {
+      delete[] _seg_fw;
+      delete[] _seg_bk;
+      delete[] _seg_logPx;
+    }
+    _seg_capacity = n_states * seg_length;
+    _seg_fw = new double[_seg_capacity];
+    _seg_bk = new double[_seg_capacity];
+    _seg_logPx = new double[seg_length];
+  }
+  
+  /* private iterator copy: segment recomputation moves the iterator */
+  if (_seg_iter == NULL)
+    _seg_iter = (*_seq_iter)->iter().shallowCopy();
+  
+  /* shared with the other iterators over this sequence */
+  (*_seq_iter)->segment(*_seg_iter, seg, _seg_fw, _seg_bk, NULL, _seg_logPx);
+  
+  _seg = seg;
+  _seg_start = _checkpoints->segment_start(seg);
 }
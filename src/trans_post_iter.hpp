@@ -4,12 +4,15 @@
 #include "iter.hpp"
 #include "base_classes.hpp"
 
+class FwBkCheckpoints;
+
 class EMSequence;
 
 // Iterator for posterior transitions
 class TransitionPosteriorIterator {
 public:
-  TransitionPosteriorIterator(std::vector<TransitionFunction*> & group, const std::vector<EMSequence*> * seqs);
+  // first, last: only visit sequences [first, last) (last < 0 for all)
+  TransitionPosteriorIterator(std::vector<TransitionFunction*> & group, const std::vector<EMSequence*> * seqs, int first = 0, int last = -1);
   ~TransitionPosteriorIterator();
 
   bool next();
@@ -39,6 +42,7 @@ public:
 private:
   const double * _fw;
   const double * _bk;
+  const double * _emissions; // NULL if not cached
   const double * _local_logPx;
   Iter * _iter;
   unsigned int _group_size;
@@ -46,10 +50,22 @@ private:
   int _n_targets;
   double * _trans_post;
   
-  const std::vector<EMSequence*> * _seqs;
+  std::vector<EMSequence*>::const_iterator _seq_begin;
+  std::vector<EMSequence*>::const_iterator _seq_end;
   std::vector<EMSequence*>::const_iterator _seq_iter;
   
+  // checkpointed sequences: forward/backward for the current segment only
+  const FwBkCheckpoints * _checkpoints;
+  Iter * _seg_iter;
+  int _seg;
+  int _seg_start;
+  int _seg_capacity;
+  double * _seg_fw;
+  double * _seg_bk;
+  double * _seg_logPx;
+  
   void changed_sequence();
+  void update_segment(int index);
 };
 
 #endif
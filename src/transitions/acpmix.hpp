@@ -124,7 +124,6 @@ public:
     if (_is_fixed_alpha)
       return;
     
-    TransitionPosteriorIterator * piter = sequences->transition_iterator(*group);
     /* use Newton's method to fit alpha */
     double alpha = _alpha;
     bool hit_edge = false;
@@ -135,11 +134,10 @@ public:
       double fx = 0;
       double gx = 0;
       
-      compute_fx_gx(alpha, piter, group, &fx, &gx);
+      compute_fx_gx(alpha, sequences, group, &fx, &gx);
       
       if (QHMM_isinf(gx) || QHMM_isinf(gx)) {
         log_state_msg(_stateID, "alpha update failed: iter alpha: %g prev alpha: %g\n", alpha, _alpha);
-        delete piter;
         return;
       }
       
@@ -171,8 +169,6 @@ public:
       
       tf->update_log_probs(alpha);
     }
-    
-    delete piter;
   }
 
 
@@ -210,52 +206,70 @@ private:
     _log_prior_weight = log(1.0 - _gamma);
   }
 
-  void compute_fx_gx(double alpha, TransitionPosteriorIterator * piter, std::vector<TransitionFunction*> * group, double * out_fx, double * out_gx) {
-    double fx = 0;
-    double gx = 0;
+  // Newton's method terms for alpha (see compute_fx_gx)
+  class FxGxSum : public TransitionPosteriorSum {
+  public:
+    FxGxSum(const ACPMix * func, double alpha, std::vector<TransitionFunction*> * group) : _func(func), _alpha(alpha), _group(group) {}
     
-    piter->reset();
+    virtual void add(TransitionPosteriorIterator & piter, double * sums) const {
+      double fx = 0;
+      double gx = 0;
+      
+      do {
+        // NOTE: assume all states in the group have the save _covar_slot
     
-    do {
-      // NOTE: assume all states in the group have the save _covar_slot
+        for (int tgt_idx = 0; tgt_idx < _func->_n_targets; ++tgt_idx) {
+          double log_prior = piter.covar_i(_func->_covar_slot, tgt_idx);
+          double prior = exp(log_prior);
       
-      for (int tgt_idx = 0; tgt_idx < _n_targets; ++tgt_idx) {
-        double log_prior = piter->covar_i(_covar_slot, tgt_idx);
-        double prior = exp(log_prior);
+          for (unsigned int gidx = 0; gidx < _group->size(); ++gidx) {
+            double post = piter.posterior(gidx, tgt_idx);
         
-        for (unsigned int gidx = 0; gidx < group->size(); ++gidx) {
-          double post = piter->posterior(gidx, tgt_idx);
-          
-          /* NOTE: Since this is intended to compute the ratio fx/gx
-           *       I'm simplifying the expressions by dividing both by gamma.
-           */
-          ACPMix * gState = (ACPMix*) (*group)[gidx]->inner();
-          
-          bool is_self = gState->_stateID == gState->_targets[tgt_idx];
-          if (is_self) {
-            double denom = (_gamma * alpha + (1.0 - _gamma) * prior);
-            fx += post / denom;
-            gx -= post * _gamma / (denom * denom);
-          } else {
-            double denom = (_gamma * (1.0 - alpha) + (_n_targets - 1) * (1.0 - _gamma) * prior);
-            fx -= post / denom;
-            gx -= post * _gamma / (denom * denom);
-          }
+            /* NOTE: Since this is intended to compute the ratio fx/gx
+             *       I'm simplifying the expressions by dividing both by gamma.
+             */
+            ACPMix * gState = (ACPMix*) (*_group)[gidx]->inner();
+        
+            bool is_self = gState->_stateID == gState->_targets[tgt_idx];
+            if (is_self) {
+              double denom = (_func->_gamma * _alpha + (1.0 - _func->_gamma) * prior);
+              fx += post / denom;
+              gx -= post * _func->_gamma / (denom * denom);
+            } else {
+              double denom = (_func->_gamma * (1.0 - _alpha) + (_func->_n_targets - 1) * (1.0 - _func->_gamma) * prior);
+              fx -= post / denom;
+              gx -= post * _func->_gamma / (denom * denom);
+            }
+        
+            if (QHMM_isinf(fx) || QHMM_isinf(gx)) {
+              log_state_msg(gState->_stateID, "alpha iter failed: fx: %g gx:%g prior: %g post: %g\n", fx, gx, prior, post);
+              sums[0] += fx;
+              sums[1] += gx;
           
-          if (QHMM_isinf(fx) || QHMM_isinf(gx)) {
-            log_state_msg(gState->_stateID, "alpha iter failed: fx: %g gx:%g prior: %g post: %g\n", fx, gx, prior, post);
-            *out_fx = fx;
-            *out_gx = gx;
-            
-            return;
+              return;
+            }
           }
         }
-      }
-    } while (piter->next());
+      } while (piter.next());
+      
+      sums[0] += fx;
+      sums[1] += gx;
+    }
+    
+  private:
+    const ACPMix * _func;
+    double _alpha;
+    std::vector<TransitionFunction*> * _group;
+  };
+  
+  void compute_fx_gx(double alpha, EMSequences * sequences, std::vector<TransitionFunction*> * group, double * out_fx, double * out_gx) {
+    double sums[2];
+    
+    sequences->transition_sums(group, FxGxSum(this, alpha, group), 2, sums);
     
     /* update output values */
-    *out_fx = fx;
-    *out_gx = gx;
+    *out_fx = sums[0];
+    *out_gx = sums[1];
   }
 
   int ratio_sign(double a, double b) {
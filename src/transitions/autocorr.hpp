@@ -126,17 +126,33 @@ class AutoCorr : public TransitionFunction {
     double expected_self_count = _pseudoCount;
     double expected_total_count = 2*_pseudoCount;
 
-    TransitionPosteriorIterator * piter = sequences->transition_iterator(*group);
+    const double * counts = sequences->transition_counts();
 
     // sum expected counts
-    do {
+    if (counts != NULL) {
       for (unsigned int gidx = 0; gidx < group->size(); ++gidx) {
-        expected_self_count += piter->posterior(gidx, 0);
+        TransitionFunction * tf = (*group)[gidx];
+        const double * counts_k = counts + tf->stateID() * _n_states;
+        
+        expected_self_count += counts_k[tf->targets()[0]];
         
         for (int tgt_idx = 0; tgt_idx < _n_targets; ++tgt_idx)
-          expected_total_count += piter->posterior(gidx, tgt_idx);
+          expected_total_count += counts_k[tf->targets()[tgt_idx]];
       }
-    } while (piter->next());
+    } else {
+      TransitionPosteriorIterator * piter = sequences->transition_iterator(*group);
+      
+      do {
+        for (unsigned int gidx = 0; gidx < group->size(); ++gidx) {
+          expected_self_count += piter->posterior(gidx, 0);
+          
+          for (int tgt_idx = 0; tgt_idx < _n_targets; ++tgt_idx)
+            expected_total_count += piter->posterior(gidx, tgt_idx);
+        }
+      } while (piter->next());
+      
+      delete piter;
+    }
     
     // estimate parameters
     double alpha = expected_self_count / expected_total_count;
@@ -147,10 +163,11 @@ class AutoCorr : public TransitionFunction {
       
       tf->update_log_probs(alpha);
     }
-    
-    delete piter;
   }
 
+  // only needs the total expected counts
+  virtual bool usesCounts() const { return true; }
+
     
   private:
     double * _log_probs;
@@ -216,6 +233,15 @@ class AutoCorrCovar : public TransitionFunction {
         return -std::numeric_limits<double>::infinity();
     }
 
+    virtual void log_probabilities(Iter const & iter, double * out) const {
+      double alpha = iter.covar(_covar_slot);
+      double log_other = log(1.0 - alpha) - _log_base;
+
+      for (int i = 1; i < _n_targets; ++i)
+        out[_targets[i]] = log_other;
+      out[_stateID] = log(alpha);
+    }
+
     virtual bool setCovarSlots(int * slots, int length) {
       if (length != 1)
         return false;
@@ -337,17 +363,33 @@ class AutoCorrWCovar : public TransitionFunction {
     double expected_self_count = _pseudoCount;
     double expected_total_count = 2*_pseudoCount;
 
-    TransitionPosteriorIterator * piter = sequences->transition_iterator(*group);
+    const double * counts = sequences->transition_counts();
 
     // sum expected counts
-    do {
+    if (counts != NULL) {
       for (unsigned int gidx = 0; gidx < group->size(); ++gidx) {
-        expected_self_count += piter->posterior(gidx, 0);
+        TransitionFunction * tf = (*group)[gidx];
+        const double * counts_k = counts + tf->stateID() * _n_states;
+        
+        expected_self_count += counts_k[tf->targets()[0]];
         
         for (int tgt_idx = 0; tgt_idx < _n_targets; ++tgt_idx)
-          expected_total_count += piter->posterior(gidx, tgt_idx);
+          expected_total_count += counts_k[tf->targets()[tgt_idx]];
       }
-    } while (piter->next());
+    } else {
+      TransitionPosteriorIterator * piter = sequences->transition_iterator(*group);
+      
+      do {
+        for (unsigned int gidx = 0; gidx < group->size(); ++gidx) {
+          expected_self_count += piter->posterior(gidx, 0);
+          
+          for (int tgt_idx = 0; tgt_idx < _n_targets; ++tgt_idx)
+            expected_total_count += piter->posterior(gidx, tgt_idx);
+        }
+      } while (piter->next());
+      
+      delete piter;
+    }
     
     // estimate parameters
     double alpha = expected_self_count / expected_total_count;
@@ -358,10 +400,11 @@ class AutoCorrWCovar : public TransitionFunction {
       
       tf->update_log_probs(alpha);
     }
-    
-    delete piter;
   }
 
+  // only needs the total expected counts
+  virtual bool usesCounts() const { return true; }
+
     
   private:
     double * _log_probs;
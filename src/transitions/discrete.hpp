@@ -37,6 +37,8 @@ public:
     int fixedCount = 0;
 
     for (int i = 0; i < params.length(); ++i) {
+      if (!(params[i] >= 0 && params[i] <= 1))
+        return false;
       sum = sum + params[i];
       fixedCount += (params.isFixed(i) ? 1 : 0);
     }
@@ -112,19 +114,32 @@ public:
 
     // sufficient statistics are the per target expected counts
     double expected_counts[_n_targets];
-
-    TransitionPosteriorIterator * piter = sequences->transition_iterator(*group);
+    const double * counts = sequences->transition_counts();
 
     // initialize
     for (int i = 0; i < _n_targets; ++i)
       expected_counts[i] = _pseudoCount;
 
     // sum expected counts
-    do {
-      for (unsigned int gidx = 0; gidx < group->size(); ++gidx)
+    if (counts != NULL) {
+      for (unsigned int gidx = 0; gidx < group->size(); ++gidx) {
+        TransitionFunction * tf = (*group)[gidx];
+        const double * counts_k = counts + tf->stateID() * _n_states;
+        
         for (int tgt_idx = 0; tgt_idx < _n_targets; ++tgt_idx)
-          expected_counts[tgt_idx] += piter->posterior(gidx, tgt_idx);
-    } while (piter->next());
+          expected_counts[tgt_idx] += counts_k[tf->targets()[tgt_idx]];
+      }
+    } else {
+      TransitionPosteriorIterator * piter = sequences->transition_iterator(*group);
+      
+      do {
+        for (unsigned int gidx = 0; gidx < group->size(); ++gidx)
+          for (int tgt_idx = 0; tgt_idx < _n_targets; ++tgt_idx)
+            expected_counts[tgt_idx] += piter->posterior(gidx, tgt_idx);
+      } while (piter->next());
+      
+      delete piter;
+    }
 
     // estimate parameters
     double scaleFactor = 1.0 - _fixedTotal;
@@ -146,10 +161,11 @@ public:
           tf->_log_probs[tf->_targets[i]] = _log_probs[_targets[i]];
       }
     }
-
-    delete piter;
   }
 
+  // only needs the total expected counts
+  virtual bool usesCounts() const { return true; }
+
 private:
   double * _log_probs;
   bool _all_fixed;
@@ -116,13 +116,25 @@ public:
 
     return log_num - _logsum->compute();
   }
+
+  virtual void log_probabilities(Iter const & iter, double * out) const {
+    double x = iter.covar(_covar_slot);
+    
+    _logsum->clear();
+    _logsum->store(0);
+    for (int i = 0; i < _n_targets - 1; ++i)
+      _logsum->store(_betas[i*2] + _betas[i*2 + 1] * x);
+    double log_denom = _logsum->compute();
+    
+    out[_targets[0]] = -log_denom;
+    for (int i = 1; i < _n_targets; ++i)
+      out[_targets[i]] = _betas[(i - 1)*2] + _betas[(i - 1)*2 + 1] * x - log_denom;
+  }
   
   virtual void updateParams(EMSequences * sequences, std::vector<TransitionFunction*> * group) {
     if (_is_fixed)
       return;
     
-    TransitionPosteriorIterator * piter = sequences->transition_iterator(*group);
-    
     // optimize parameters
     int fail = 0;
     int n_betas = 2*(_n_targets - 1);
@@ -133,8 +145,7 @@ public:
       betas[i] = _betas[i];
     
     udata.group = group;
-    udata.piter = piter;
-    udata.logsum = _logsum;
+    udata.sequences = sequences;
     udata.covar_slot = _covar_slot;
     udata.n_targets = _n_targets;
     
@@ -151,7 +162,6 @@ public:
         tf->_betas[i] = betas[i];
     }
     
-    delete piter;
     delete[] betas;
   }
   
@@ -175,40 +185,55 @@ private:
   
   struct opt_data {
     std::vector<TransitionFunction*> * group;
-    TransitionPosteriorIterator * piter;
-    LogSum * logsum;
+    EMSequences * sequences;
     int covar_slot;
     int n_targets;
   };
   
+  // expected log-likelihood of the transitions for a set of betas
+  class LogLikSum : public TransitionPosteriorSum {
+  public:
+    LogLikSum(const double * betas, int covar_slot, int n_targets, unsigned int size) : _betas(betas), _covar_slot(covar_slot), _n_targets(n_targets), _size(size) {}
+    
+    virtual void add(TransitionPosteriorIterator & piter, double * sums) const {
+      LogSum * logsum = LogSum::create(_n_targets);
+      double result = 0;
+      
+      do {
+        double x = piter.covar(_covar_slot);
+        double sum;
+        
+        logsum->clear();
+        logsum->store(0);
+        for (int i = 0; i < _n_targets - 1; ++i)
+          logsum->store(_betas[i*2] + _betas[i*2 + 1] * x);
+        
+        sum = logsum->compute();
+        
+        for (unsigned int gidx = 0; gidx < _size; ++gidx) {
+          for (int tgt_idx = 0; tgt_idx < _n_targets; ++tgt_idx) {
+            double post = piter.posterior(gidx, tgt_idx);
+            result += post * ((*logsum)[tgt_idx] - sum);
+          }
+        }
+      } while (piter.next());
+      
+      delete logsum;
+      sums[0] += result;
+    }
+    
+  private:
+    const double * _betas;
+    int _covar_slot;
+    int _n_targets;
+    unsigned int _size;
+  };
+  
   static double optfunc(int n, double * betas, void * udata) {
     struct opt_data * data = (struct opt_data*) udata;
-    double result = 0;
-    LogSum * logsum = data->logsum;
-    unsigned int size = data->group->size();
-    int n_targets = data->n_targets;
-    TransitionPosteriorIterator * piter = data->piter;
-    
-    piter->reset();
+    double result;
     
-    do {
-      double x = piter->covar(data->covar_slot);
-      double sum;
-      
-      logsum->clear();
-      logsum->store(0);
-      for (int i = 0; i < n_targets - 1; ++i)
-        logsum->store(betas[i*2] + betas[i*2 + 1] * x);
-      
-      sum = logsum->compute();
-      
-      for (unsigned int gidx = 0; gidx < size; ++gidx) {
-        for (int tgt_idx = 0; tgt_idx < n_targets; ++tgt_idx) {
-          double post = piter->posterior(gidx, tgt_idx);
-          result += post * ((*logsum)[tgt_idx] - sum);
-        }
-      }
-    } while (piter->next());
+    data->sequences->transition_sums(data->group, LogLikSum(betas, data->covar_slot, data->n_targets, data->group->size()), 1, &result);
     
     return -result;
   }
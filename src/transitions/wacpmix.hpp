@@ -133,7 +133,6 @@ public:
     if (_is_fixed_alpha)
       return;
     
-    TransitionPosteriorIterator * piter = sequences->transition_iterator(*group);
     /* use Newton's method to fit alpha */
     double alpha = _alpha;
     bool hit_edge = false;
@@ -144,11 +143,10 @@ public:
       double fx = 0;
       double gx = 0;
       
-      compute_fx_gx(alpha, piter, group, &fx, &gx);
+      compute_fx_gx(alpha, sequences, group, &fx, &gx);
       
       if (QHMM_isinf(gx) || QHMM_isinf(gx)) {
         log_state_msg(_stateID, "alpha update failed: iter alpha: %g prev alpha: %g\n", alpha, _alpha);
-        delete piter;
         return;
       }
       
@@ -180,8 +178,6 @@ public:
       
       tf->update_log_probs(alpha);
     }
-    
-    delete piter;
   }
 
 
@@ -221,55 +217,73 @@ private:
     _log_prior_weight = log(1.0 - _gamma);
   }
 
-  void compute_fx_gx(double alpha, TransitionPosteriorIterator * piter, std::vector<TransitionFunction*> * group, double * out_fx, double * out_gx) {
-    double fx = 0;
-    double gx = 0;
+  // Newton's method terms for alpha (see compute_fx_gx)
+  class FxGxSum : public TransitionPosteriorSum {
+  public:
+    FxGxSum(const WACPMix * func, double alpha, std::vector<TransitionFunction*> * group) : _func(func), _alpha(alpha), _group(group) {}
     
-    piter->reset();
+    virtual void add(TransitionPosteriorIterator & piter, double * sums) const {
+      double fx = 0;
+      double gx = 0;
+      
+      do {
+        // NOTE: assume all states in the group have the save _covar_slot
+        double log_prior_self = piter.covar_i(_func->_prior_covar_slot, 0);
+        double log_prior_other = piter.covar_i(_func->_prior_covar_slot, 1);
+        double prior_self = exp(log_prior_self);
+        double prior_other = exp(log_prior_other);
     
-    do {
-      // NOTE: assume all states in the group have the save _covar_slot
-      double log_prior_self = piter->covar_i(_prior_covar_slot, 0);
-      double log_prior_other = piter->covar_i(_prior_covar_slot, 1);
-      double prior_self = exp(log_prior_self);
-      double prior_other = exp(log_prior_other);
+        for (int tgt_idx = 0; tgt_idx < _func->_n_targets; ++tgt_idx) {
       
-      for (int tgt_idx = 0; tgt_idx < _n_targets; ++tgt_idx) {
+          for (unsigned int gidx = 0; gidx < _group->size(); ++gidx) {
+            double post = piter.posterior(gidx, tgt_idx);
         
-        for (unsigned int gidx = 0; gidx < group->size(); ++gidx) {
-          double post = piter->posterior(gidx, tgt_idx);
-          
-          /* NOTE: Since this is intended to compute the ratio fx/gx
-           *       I'm simplifying the expressions by dividing both by gamma.
-           */
-          WACPMix * gState = (WACPMix*) (*group)[gidx]->inner();
-          
-          bool is_self = gState->_stateID == gState->_targets[tgt_idx];
-          if (is_self) {
-            double denom = (_gamma * alpha + (1.0 - _gamma) * prior_self);
-            fx += post / denom;
-            gx -= post * _gamma / (denom * denom);
-          } else {
-            double denom = (_gamma * (1.0 - alpha) + (1.0 - _gamma) * prior_other);
-            fx -= post / denom;
-            gx -= post * _gamma / (denom * denom);
-          }
+            /* NOTE: Since this is intended to compute the ratio fx/gx
+             *       I'm simplifying the expressions by dividing both by gamma.
+             */
+            WACPMix * gState = (WACPMix*) (*_group)[gidx]->inner();
+        
+            bool is_self = gState->_stateID == gState->_targets[tgt_idx];
+            if (is_self) {
+              double denom = (_func->_gamma * _alpha + (1.0 - _func->_gamma) * prior_self);
+              fx += post / denom;
+              gx -= post * _func->_gamma / (denom * denom);
+            } else {
+              double denom = (_func->_gamma * (1.0 - _alpha) + (1.0 - _func->_gamma) * prior_other);
+              fx -= post / denom;
+              gx -= post * _func->_gamma / (denom * denom);
+            }
+        
+            if (QHMM_isinf(gx) || QHMM_isinf(gx)) {
+              double prior = (is_self ? prior_self : prior_other);
+              log_state_msg(gState->_stateID, "alpha iter failed: fx: %g gx:%g prior: %g post: %g\n", fx, gx, prior, post);
+              sums[0] += fx;
+              sums[1] += gx;
           
-          if (QHMM_isinf(gx) || QHMM_isinf(gx)) {
-            double prior = (is_self ? prior_self : prior_other);
-            log_state_msg(gState->_stateID, "alpha iter failed: fx: %g gx:%g prior: %g post: %g\n", fx, gx, prior, post);
-            *out_fx = fx;
-            *out_gx = gx;
-            
-            return;
+              return;
+            }
           }
         }
-      }
-    } while (piter->next());
+      } while (piter.next());
+      
+      sums[0] += fx;
+      sums[1] += gx;
+    }
+    
+  private:
+    const WACPMix * _func;
+    double _alpha;
+    std::vector<TransitionFunction*> * _group;
+  };
+  
+  void compute_fx_gx(double alpha, EMSequences * sequences, std::vector<TransitionFunction*> * group, double * out_fx, double * out_gx) {
+    double sums[2];
+    
+    sequences->transition_sums(group, FxGxSum(this, alpha, group), 2, sums);
     
     /* update output values */
-    *out_fx = fx;
-    *out_gx = gx;
+    *out_fx = sums[0];
+    *out_gx = sums[1];
   }
 
   int ratio_sign(double a, double b) {
@@ -0,0 +1,93 @@
+#include "workspace.hpp"
+
+const size_t Workspace::MIN_BLOCK_SIZE = 4096;
+const size_t Workspace::ALIGNMENT = 64;
+
+Workspace::Workspace() : _block(0), _used(0), _n_logsums(0) {}
+
+Workspace::~Workspace() {
+  for (size_t i = 0; i < _blocks.size(); ++i)
+    delete[] _blocks[i];
+  for (size_t i = 0; i < _logsums.size(); ++i)
+    delete _logsums[i];
+}
+
+double * Workspace::doubles(size_t count) {
+  return (double*) allocate(sizeof(double) * count);
+}
+
+int * Workspace::ints(size_t count) {
+  return (int*) allocate(sizeof(int) * count);
+}
+
+LogSum * Workspace::logsum(unsigned int capacity, bool optimize) {
+  LogSum * result;
+
+  if (_n_logsums < _logsums.size()) {
+    result = _logsums[_n_logsums];
+
+    /* implementation depends on capacity & optimize (see LogSum::create) */
+    if (result->capacity() != capacity || _logsum_optimize[_n_logsums] != optimize) {
+      delete result;
+      result = LogSum::create(capacity, optimize);
+      _logsums[_n_logsums] = result;
+      _logsum_optimize[_n_logsums] = optimize;
+    }
+  } else {
+    result = LogSum::create(capacity, optimize);
+    _logsums.push_back(result);
+    _logsum_optimize.push_back(optimize);
+  }
+  ++_n_logsums;
+
+  result->clear();
+  return result;
+}
+
+void Workspace::reset() {
+  _block = 0;
+  _used = 0;
+  _n_logsums = 0;
+  merge_blocks();
+}
+
+void Workspace::merge_blocks() {
+  if (_blocks.size() < 2)
+    return;
+
+  size_t size = 0;
+  for (size_t i = 0; i < _blocks.size(); ++i) {
+    size += _sizes[i];
+    delete[] _blocks[i];
+  }
+
+  _blocks.assign(1, new char[size + ALIGNMENT]);
+  _sizes.assign(1, size);
+}
+
+void * Workspace::allocate(size_t bytes) {
+  /* keep all arrays aligned */
+  bytes = (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+  /* find a block with enough space, later blocks are unused */
+  while (_block < _blocks.size() && _used + bytes > _sizes[_block]) {
+    ++_block;
+    _used = 0;
+  }
+
+  if (_block == _blocks.size()) {
+    size_t size = (bytes > MIN_BLOCK_SIZE ? bytes : MIN_BLOCK_SIZE);
+
+    _blocks.push_back(new char[size + ALIGNMENT]);
+    _sizes.push_back(size);
+    _used = 0;
+  }
+
+  /* block start aligned to ALIGNMENT */
+  char * base = _blocks[_block];
+  size_t offset = (ALIGNMENT - ((size_t) base) % ALIGNMENT) % ALIGNMENT;
+  void * result = base + offset + _used;
+  _used += bytes;
+
+  return result;
+}
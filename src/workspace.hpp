@@ -0,0 +1,97 @@
+#ifndef WORKSPACE_HPP
+#define WORKSPACE_HPP
+
+#include <cstddef>
+#include <vector>
+#include "logsum.hpp"
+
+//
+// Reusable scratch memory for HMM calls.
+//
+// Arrays are handed out from a stack of memory blocks and returned when the
+// enclosing Scope is closed (also when an exception is thrown), so a
+// Workspace that is reused across calls stops allocating once it has grown
+// to the largest call (blocks are merged into one when the outermost Scope
+// closes, so the memory kept is about the largest call). LogSum objects are
+// pooled in the same way.
+//
+// Only meant for O(n_states) / O(n_states^2) scratch buffers: memory in the
+// order of the sequence length should not be kept alive by a Workspace.
+//
+// A Workspace must not be shared by concurrent calls (use one per thread).
+//
+class Workspace {
+public:
+  Workspace();
+  ~Workspace();
+
+  // scratch arrays, valid until the enclosing Scope is closed
+  double * doubles(size_t count);
+  int * ints(size_t count);
+
+  // LogSum for capacity values (cleared), valid until the enclosing Scope is closed
+  // optimize: see LogSum::create
+  LogSum * logsum(unsigned int capacity, bool optimize = true);
+
+  // releases all memory (blocks are merged and kept for reuse)
+  void reset();
+
+  class Scope;
+  friend class Scope;
+
+  // Scratch memory scope: memory taken from the workspace inside the scope is
+  // returned on exit. With a NULL workspace, a private one is used instead
+  // (same behaviour as plain allocations).
+  class Scope {
+  public:
+    Scope(Workspace * ws) : _local(ws == NULL ? new Workspace() : NULL), _ws(ws != NULL ? ws : _local),
+                            _block(_ws->_block), _used(_ws->_used), _n_logsums(_ws->_n_logsums) {}
+    ~Scope() {
+      if (_local != NULL) {
+        delete _local;
+        return;
+      }
+      _ws->_block = _block;
+      _ws->_used = _used;
+      _ws->_n_logsums = _n_logsums;
+      if (_block == 0 && _used == 0)
+        _ws->merge_blocks();
+    }
+
+    Workspace * get() const { return _ws; }
+    Workspace * operator->() const { return _ws; }
+
+  private:
+    Workspace * const _local;
+    Workspace * const _ws;
+    const size_t _block;
+    const size_t _used;
+    const size_t _n_logsums;
+
+    Scope(const Scope &);
+    Scope & operator=(const Scope &);
+  };
+
+private:
+  static const size_t MIN_BLOCK_SIZE; // bytes
+  static const size_t ALIGNMENT; // bytes
+
+  std::vector<char*> _blocks;
+  std::vector<size_t> _sizes;
+  size_t _block; // current block
+  size_t _used; // bytes used in current block
+
+  std::vector<LogSum*> _logsums;
+  std::vector<bool> _logsum_optimize;
+  size_t _n_logsums; // in use
+
+  void * allocate(size_t bytes);
+  // replaces all blocks by a single one of the same total size (no memory in use)
+  void merge_blocks();
+
+  // no copies
+  Workspace(const Workspace &);
+  Workspace & operator=(const Workspace &);
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "catch.hpp"
+#include "test_models.hpp"
+#include <em_base.hpp>
+#include <em_seq.hpp>
+
+// posteriors seen by a PosteriorIterator over all sequences
+static std::vector<double> iterator_posteriors(EMSequences & seqs, int state) {
+  std::vector<double> result;
+  PosteriorIterator * piter = seqs.iterator(state, 0);
+
+  do {
+    Iter & iter = piter->iter();
+    const double * post = piter->posterior();
+
+    for (int i = 0; i < iter.length(); ++i)
+      result.push_back(post[i]);
+  } while (piter->next());
+
+  delete piter;
+  return result;
+}
+
+TEST_CASE("checkpointed posterior iterators share recomputed segments") {
+  const int n_states = 3;
+  TestModel model(n_states);
+  std::vector<double> data1 = test_counts(500, n_states, 1);
+  std::vector<double> data2 = test_counts(230, n_states, 2);
+  int dim = 1;
+  Iter iter1(data1.size(), 1, &dim, &data1[0], 0, NULL, NULL);
+  Iter iter2(data2.size(), 1, &dim, &data2[0], 0, NULL, NULL);
+  std::vector<Iter*> iters;
+  iters.push_back(&iter1);
+  iters.push_back(&iter2);
+
+  EMSequences full(model.hmm, iters);
+  double loglik = full.updateFwBk();
+
+  // single cached segment and all segments cached
+  size_t limits[2] = { 0, EMSequences::EMISSION_CACHE_LIMIT };
+  for (int c = 0; c < 2; ++c) {
+    EMSequences checkpointed(model.hmm, iters, limits[c], true, 40);
+    CHECK( checkpointed.updateFwBk() == Approx(loglik) );
+
+    for (int state = 0; state < n_states; ++state) {
+      std::vector<double> expected = iterator_posteriors(full, state);
+      std::vector<double> post = iterator_posteriors(checkpointed, state);
+
+      REQUIRE( post.size() == expected.size() );
+      for (unsigned int i = 0; i < post.size(); ++i)
+        REQUIRE( post[i] == Approx(expected[i]).epsilon(1e-9) );
+    }
+  }
+}
+
+TEST_CASE("checkpointed forward/backward matches the full matrices") {
+  const int n_states = 4;
+  const int length = 1000;
+  TestModel model(n_states);
+  std::vector<double> data = test_counts(length, n_states);
+  int dim = 1;
+  Iter iter(length, 1, &dim, &data[0], 0, NULL, NULL);
+
+  std::vector<double> fw(n_states * length), bk(n_states * length), post(n_states * length);
+  double loglik = model.hmm->forward(iter, &fw[0]);
+  double bk_loglik = model.hmm->backward(iter, &bk[0]);
+  model.hmm->state_posterior(iter, &fw[0], &bk[0], &post[0]);
+
+  CHECK( bk_loglik == Approx(loglik) );
+
+  // default (sqrt(length)), uneven last segment and a single segment
+  int seg_lengths[3] = { 0, 77, length };
+  for (int s = 0; s < 3; ++s) {
+    FwBkCheckpoints checkpoints(model.hmm, length, seg_lengths[s]);
+    std::vector<double> cp_post(n_states * length);
+
+    CHECK( checkpoints.forward(iter) == Approx(loglik).epsilon(1e-12) );
+    checkpoints.backward(iter);
+    checkpoints.state_posterior(iter, &cp_post[0]);
+
+    for (int i = 0; i < n_states * length; ++i)
+      REQUIRE( cp_post[i] == Approx(post[i]).epsilon(1e-9) );
+
+    // segment columns are the forward/backward columns
+    int seg = checkpoints.segment_count() / 2;
+    int start = checkpoints.segment_start(seg);
+    std::vector<double> seg_fw(n_states * checkpoints.segment_length());
+    std::vector<double> seg_bk(n_states * checkpoints.segment_length());
+    checkpoints.segment_forward(iter, seg, &seg_fw[0]);
+    checkpoints.segment_backward(iter, seg, &seg_bk[0]);
+    for (int i = 0; i < n_states * checkpoints.segment_size(seg); ++i) {
+      REQUIRE( seg_fw[i] == Approx(fw[n_states * start + i]) );
+      REQUIRE( seg_bk[i] == Approx(bk[n_states * start + i]) );
+    }
+  }
+}
@@ -0,0 +1,139 @@
+#include "catch.hpp"
+#include "test_models.hpp"
+#include <param_record.hpp>
+#include <limits>
+
+// sequences of different lengths over the counts of a TestModel
+class TestSequences {
+public:
+  TestSequences(int n_states, int n_seqs) {
+    int dim = 1;
+
+    for (int i = 0; i < n_seqs; ++i)
+      data.push_back(test_counts(200 + 150 * i, n_states, i + 1));
+    for (int i = 0; i < n_seqs; ++i)
+      iters.push_back(new Iter(data[i].size(), 1, &dim, &data[i][0], 0, NULL, NULL));
+  }
+
+  ~TestSequences() {
+    for (unsigned int i = 0; i < iters.size(); ++i)
+      delete iters[i];
+  }
+
+  std::vector<std::vector<double> > data;
+  std::vector<Iter*> iters;
+};
+
+// free parameters after the last EM iteration (releases the result)
+static std::vector<double> final_params(EMResult & result) {
+  std::vector<double> params;
+
+  for (unsigned int i = 0; i < result.param_trace->size(); ++i) {
+    ParamRecord * record = (*result.param_trace)[i];
+    for (int j = 0; j < record->paramSize(); ++j)
+      params.push_back(record->value(record->size() - 1, j));
+  }
+
+  delete result.log_likelihood;
+  delete result.estep_time;
+  delete result.sequence_time;
+  HMM::delete_records(result.param_trace);
+  return params;
+}
+
+static std::vector<double> em_params(EMOptions const & options, std::vector<double> * loglik = NULL) {
+  TestModel model(3);
+  TestSequences seqs(3, 4);
+
+  EMResult result = model.hmm->em(seqs.iters, options);
+  if (loglik != NULL)
+    *loglik = *result.log_likelihood;
+  return final_params(result);
+}
+
+TEST_CASE("incremental EM reaches the plain EM fixed point") {
+  EMOptions options(1e-10);
+  std::vector<double> expected = em_params(options);
+
+  int batches[2] = { 2, 4 };
+  for (int b = 0; b < 2; ++b) {
+    options.n_batches = batches[b];
+    std::vector<double> params = em_params(options);
+
+    REQUIRE( params.size() == expected.size() );
+    for (unsigned int i = 0; i < params.size(); ++i)
+      CHECK( params[i] == Approx(expected[i]).epsilon(1e-4) );
+  }
+}
+
+TEST_CASE("incremental EM rejects stale checkpointed sequences") {
+  EMOptions options(1e-6);
+  options.checkpoint = true;
+  options.n_batches = 2;
+
+  CHECK_THROWS_AS( em_params(options), QHMMException );
+}
+
+TEST_CASE("accelerated EM reaches the plain EM fixed point") {
+  EMOptions options(1e-10);
+  std::vector<double> expected = em_params(options);
+
+  options.accelerate = true;
+  std::vector<double> loglik;
+  std::vector<double> params = em_params(options, &loglik);
+
+  REQUIRE( params.size() == expected.size() );
+  for (unsigned int i = 0; i < params.size(); ++i)
+    CHECK( params[i] == Approx(expected[i]).epsilon(1e-4) );
+
+  // rejected extrapolations are not recorded
+  REQUIRE( loglik.size() > 1 );
+  for (unsigned int i = 1; i < loglik.size(); ++i)
+    REQUIRE( loglik[i] >= loglik[i - 1] );
+}
+
+TEST_CASE("rejected extrapolations leave the parameters at theta2") {
+  TestModel model(3);
+  ParamVector params(model.transitions->groups(), model.emissions->groups());
+  const int n = params.size();
+  std::vector<double> theta2(n), theta_x(n), current(n);
+
+  // transition probabilities of the 3 states, then the 3 Poisson means
+  REQUIRE( n == 3 * 3 + 3 );
+  params.get(&theta2[0]);
+  theta2[0] = 0.9;
+  theta2[1] = 0.06;
+  theta2[2] = 0.04;
+  theta2[n - 1] = 6.5;
+  REQUIRE( params.set(&theta2[0]) );
+  params.get(&theta2[0]); // as stored (Discrete keeps log probabilities)
+
+  SECTION("Discrete probability pushed outside [0,1]") {
+    theta_x = theta2;
+    theta_x[0] = 1.2;
+    theta_x[1] = -0.1;
+    theta_x[2] = -0.1;
+    theta_x[n - 1] = 7;
+    CHECK( !params.set(&theta_x[0]) );
+  }
+
+  SECTION("valid transitions with an invalid emission") {
+    // groups are validated before any is changed
+    theta_x = theta2;
+    theta_x[0] = 0.8;
+    theta_x[1] = 0.1;
+    theta_x[2] = 0.1;
+    theta_x[n - 1] = -1;
+    CHECK( !params.set(&theta_x[0]) );
+  }
+
+  SECTION("NaN parameter") {
+    theta_x = theta2;
+    theta_x[4] = std::numeric_limits<double>::quiet_NaN();
+    CHECK( !params.set(&theta_x[0]) );
+  }
+
+  params.get(&current[0]);
+  for (int i = 0; i < n; ++i)
+    REQUIRE( current[i] == theta2[i] );
+}
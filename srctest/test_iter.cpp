@@ -55,3 +55,103 @@ TEST_CASE("iterator over unmappable regions") {
   
   delete iter;
 }
+
+TEST_CASE("iterator over typed emission slots") {
+  // slot 0: uint16 counts, slot 1: double values
+  int slot_dim[2] = { 1, 1 };
+  int slot_type[2] = { Iter::UINT16, Iter::FLOAT64 };
+  int offsets[2];
+  int length = 3;
+  
+  int row_size = Iter::emission_layout(2, slot_dim, slot_type, offsets);
+  
+  REQUIRE( offsets[0] == 0 );
+  REQUIRE( offsets[1] == 8 );
+  REQUIRE( row_size == 16 );
+  
+  struct { uint16_t count; double value; } data[3] = { { 7, 0.5 }, { 0, 1.5 }, { 65535, 2.5 } };
+  int missing[6] = { 0, 0, 1, 0, 0, 0 };
+  
+  Iter * iter = new Iter(length, 2, slot_dim, slot_type, data, 0, NULL, NULL, missing);
+  
+  REQUIRE( iter->emission_type(0) == Iter::UINT16 );
+  REQUIRE( iter->count(0) == 7 );
+  REQUIRE( iter->emission(1) == 0.5 );
+  CHECK( iter->next() );
+  CHECK( iter->next() );
+  REQUIRE( iter->count(0) == 65535 );
+  REQUIRE( iter->emission(0) == 65535 );
+  REQUIRE( iter->emission(1) == 2.5 );
+  
+  iter->resetFirst();
+  const uint16_t * counts = iter->emission_block<uint16_t>(0, 0);
+  REQUIRE( counts[2 * iter->emission_step<uint16_t>()] == 65535 );
+  
+  SECTION("subiterators keep slot types") {
+    std::vector<Iter> * sub_iters = iter->sub_iterators(0);
+    
+    REQUIRE( sub_iters->size() == 2 );
+    REQUIRE( sub_iters->at(1).emission_type(0) == Iter::UINT16 );
+    REQUIRE( sub_iters->at(1).count(0) == 65535 );
+    REQUIRE( sub_iters->at(1).emission(1) == 2.5 );
+    
+    delete sub_iters;
+  }
+  
+  delete iter;
+}
+
+TEST_CASE("iterator over shared missing data bitmaps") {
+  double data[130];
+  int slot_dim[2] = { 1, 1 };
+  int length = 65;
+  
+  for (int i = 0; i < 130; ++i)
+    data[i] = i;
+  
+  // slot 0 missing at 0..2 and 60..64, slot 1 missing at 1..63 (bitmaps offset by 3 bits)
+  uint64_t bits[4] = { 0, 0, 0, 0 };
+  for (int i = 0; i < length; ++i) {
+    int bit = i + 3;
+    if (i <= 2 || i >= 60)
+      bits[bit / 64] |= ((uint64_t) 1) << (bit % 64);
+    if (i >= 1 && i <= 63)
+      bits[2 + bit / 64] |= ((uint64_t) 1) << (bit % 64);
+  }
+  
+  Iter * iter = new Iter(length, 2, slot_dim, data, 0, NULL, NULL);
+  REQUIRE_FALSE( iter->has_missing() );
+  
+  iter->share_missing_bits(bits, 2, 3);
+  REQUIRE( iter->has_missing() );
+  REQUIRE( iter->is_missing_at(0, 2) );
+  REQUIRE_FALSE( iter->is_missing_at(0, 3) );
+  REQUIRE( iter->is_missing_at(1, 63) );
+  REQUIRE_FALSE( iter->is_missing_at(1, 64) );
+  
+  iter->seek(1);
+  REQUIRE( iter->all_missing() );
+  REQUIRE_FALSE( iter->all_missing(2) );
+  REQUIRE( iter->all_missing(60) );
+  
+  SECTION("subiterators skip missing stretches") {
+    std::vector<Iter> * sub_iters = iter->sub_iterators(0);
+    
+    REQUIRE( sub_iters->size() == 1 );
+    REQUIRE( sub_iters->at(0).iter_offset() == 3 );
+    REQUIRE( sub_iters->at(0).length() == 57 );
+    REQUIRE( sub_iters->at(0).emission(0) == 6 );
+    
+    delete sub_iters;
+    
+    sub_iters = iter->sub_iterators(1);
+    
+    REQUIRE( sub_iters->size() == 2 );
+    REQUIRE( sub_iters->at(0).length() == 1 );
+    REQUIRE( sub_iters->at(1).iter_offset() == 64 );
+    
+    delete sub_iters;
+  }
+  
+  delete iter;
+}
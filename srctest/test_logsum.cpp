@@ -0,0 +1,77 @@
+#include "catch.hpp"
+#include <logsum.hpp>
+#include <cmath>
+#include <limits>
+
+static const double NEG_INF = -std::numeric_limits<double>::infinity();
+
+// values in [offset - spread, offset], with every inf_every-th entry -Inf
+// (0 = none)
+static std::vector<double> random_values(int count, double offset, double spread, int inf_every, unsigned int & seed) {
+  std::vector<double> values(count);
+
+  for (int i = 0; i < count; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    values[i] = offset - spread * ((seed >> 8) % 1000000) / 1000000.0;
+    if (inf_every > 0 && i % inf_every == inf_every - 1)
+      values[i] = NEG_INF;
+  }
+
+  return values;
+}
+
+static double compute(LogSum * logsum, const std::vector<double> & values) {
+  logsum->clear();
+  for (unsigned int i = 0; i < values.size(); ++i)
+    logsum->store(values[i]);
+  return logsum->compute();
+}
+
+// vectorized kernel (createType type) against the scalar LogSum
+static void compare_kernel(int type, bool optimize) {
+  // around LOGSUM_VEC_MIN_COUNT (12) and the padding to multiples of 8
+  int counts[] = { 1, 2, 7, 8, 9, 11, 12, 13, 15, 16, 17, 23, 24, 25, 40, 64, 65 };
+  double spreads[] = { 1, 12, 50, 800 };
+  int inf_every[] = { 0, 1, 2, 5 };
+  unsigned int seed = 7;
+
+  for (unsigned int c = 0; c < sizeof(counts) / sizeof(int); ++c) {
+    LogSum * vec = LogSum::createType(type, counts[c], optimize);
+    LogSum * scalar = LogSum::createType(2, counts[c], optimize);
+
+    for (unsigned int s = 0; s < sizeof(spreads) / sizeof(double); ++s)
+      for (unsigned int f = 0; f < sizeof(inf_every) / sizeof(int); ++f)
+        for (int r = 0; r < 20; ++r) {
+          std::vector<double> values = random_values(counts[c], 100 * (r - 10), spreads[s], inf_every[f], seed);
+          double expected = compute(scalar, values);
+          double result = compute(vec, values);
+
+          INFO( "count " << counts[c] << ", spread " << spreads[s] << ", -Inf every " << inf_every[f] );
+          if (std::isinf(expected))
+            REQUIRE( result == expected );
+          else
+            REQUIRE( result == Approx(expected).epsilon(1e-13).margin(1e-13) );
+        }
+
+    delete vec;
+    delete scalar;
+  }
+}
+
+TEST_CASE("vectorized log sums match the scalar version") {
+  int types[3] = { 3, 4, 5 };
+  const char * names[3] = { "best kernel", "AVX2 kernel", "AVX-512 kernel" };
+
+  for (int t = 0; t < 3; ++t) {
+    if (!LogSum::hasType(types[t])) {
+      WARN( names[t] << " not supported on this CPU, skipped" );
+      continue;
+    }
+
+    SECTION(names[t]) {
+      // optimize = false: the vector threshold is clamped to exp's range (-708)
+      compare_kernel(types[t], true);
+      compare_kernel(types[t], false);
+    }
+  }
+}
@@ -0,0 +1,134 @@
+#include "test_models.hpp"
+#include <transitions/discrete.hpp>
+#include <emissions/poisson.hpp>
+#include <stdexcept>
+#include <algorithm>
+
+TestModel::TestModel(int n_states, bool scaled, bool sparse, bool missing, double stay) {
+  transitions = new HomogeneousTransitions(n_states);
+  for (int k = 0; k < n_states; ++k) {
+    std::vector<int> targets;
+    std::vector<double> probs;
+
+    targets.push_back(k);
+    probs.push_back(stay);
+    if (stay == 1)
+      ; /* no state changes */
+    else if (sparse) {
+      targets.push_back((k + 1) % n_states);
+      probs.push_back(1 - stay);
+    } else
+      for (int l = 1; l < n_states; ++l) {
+        targets.push_back((k + l) % n_states);
+        probs.push_back((1 - stay) / (n_states - 1));
+      }
+
+    Discrete * func = new Discrete(n_states, k, targets.size(), &targets[0]);
+    func->setParams(Params(probs.size(), &probs[0]));
+    transitions->insert(func);
+  }
+  transitions->commitGroups();
+
+  emissions = new Emissions(n_states);
+  for (int k = 0; k < n_states; ++k) {
+    EmissionFunction * func = new Poisson(k, 0, 1 + 3 * k);
+    emissions->insert(missing ? new MissingEmissionFunction(func) : func);
+  }
+  emissions->commitGroups();
+
+  init_log_probs.assign(n_states, -log((double) n_states));
+  hmm = HMM::create(transitions, emissions, &init_log_probs[0], scaled);
+}
+
+TestModel::~TestModel() {
+  delete hmm;
+  delete transitions;
+  delete emissions;
+}
+
+// probability of leaving the state: 1 / (1 + exp(5 - 1.5 * covar)), spread
+// over all other states
+class CovarTransition : public TransitionFunction {
+public:
+  CovarTransition(int n_states, int stateID, int n_targets, int * targets) : TransitionFunction(n_states, stateID, n_targets, targets) {}
+
+  virtual double log_probability(int target) const {
+    throw std::logic_error("called homogeneous version of transition log_probability on non-homogeneous class");
+  }
+
+  virtual double log_probability(Iter const & iter, int target) const {
+    double log_odds = -5 + 1.5 * iter.covar(0);
+    double log_leave = -log1p(exp(-log_odds));
+
+    if (target == _stateID)
+      return -log1p(exp(log_odds));
+    return log_leave - log((double) (_n_states - 1));
+  }
+};
+
+TestCovarModel::TestCovarModel(int n_states, bool scaled) {
+  transitions = new NonHomogeneousTransitions(n_states);
+  for (int k = 0; k < n_states; ++k) {
+    std::vector<int> targets;
+
+    for (int l = 0; l < n_states; ++l)
+      targets.push_back((k + l) % n_states);
+    transitions->insert(new CovarTransition(n_states, k, targets.size(), &targets[0]));
+  }
+  transitions->commitGroups();
+
+  emissions = new Emissions(n_states);
+  for (int k = 0; k < n_states; ++k)
+    emissions->insert(new Poisson(k, 0, 1 + 3 * k));
+  emissions->commitGroups();
+
+  init_log_probs.assign(n_states, -log((double) n_states));
+  hmm = HMM::create(transitions, emissions, &init_log_probs[0], scaled);
+}
+
+TestCovarModel::~TestCovarModel() {
+  delete hmm;
+  delete transitions;
+  delete emissions;
+}
+
+TestTopologyModel::TestTopologyModel(std::vector<std::vector<int> > const & targets, std::vector<EmissionFunction*> const & funcs, std::vector<double> const & init_probs, bool dense) {
+  const int n_states = targets.size();
+
+  transitions = new HomogeneousTransitions(n_states);
+  for (int k = 0; k < n_states; ++k) {
+    std::vector<int> k_targets = targets[k];
+    std::vector<double> probs(k_targets.size(), 1.0 / k_targets.size());
+
+    if (dense)
+      for (int l = 0; l < n_states; ++l)
+        if (std::find(targets[k].begin(), targets[k].end(), l) == targets[k].end()) {
+          k_targets.push_back(l);
+          probs.push_back(0);
+        }
+
+    Discrete * func = new Discrete(n_states, k, k_targets.size(), &k_targets[0]);
+    func->setParams(Params(probs.size(), &probs[0]));
+    transitions->insert(func);
+  }
+  transitions->commitGroups();
+
+  emissions = new Emissions(n_states);
+  for (int k = 0; k < n_states; ++k)
+    emissions->insert(funcs[k]);
+  emissions->commitGroups();
+
+  for (int k = 0; k < n_states; ++k)
+    init_log_probs.push_back(log(init_probs[k]));
+  hmm = HMM::create(transitions, emissions, &init_log_probs[0]);
+}
+
+TestTopologyModel::~TestTopologyModel() {
+  delete hmm;
+  delete transitions;
+  delete emissions;
+}
+
+EmissionFunction * test_poisson(int state, double mean) {
+  return new Poisson(state, 0, mean);
+}
@@ -0,0 +1,89 @@
+#ifndef TEST_MODELS_HPP
+#define TEST_MODELS_HPP
+
+#include <cmath>
+#include <vector>
+#include <hmm.hpp>
+#include <func_table.hpp>
+
+//
+// Small models and data shared by the test cases.
+//
+// TestModel: n_states states with sticky discrete transitions (probability
+// stay of keeping the state, the rest spread over all other states, or only
+// to the next state when sparse) and Poisson emissions with increasing
+// means, optionally wrapped to accept missing data (defined in
+// test_models.cpp, emission headers can only be included once).
+//
+class TestModel {
+public:
+  TestModel(int n_states, bool scaled = false, bool sparse = false, bool missing = false, double stay = 0.95);
+  ~TestModel();
+
+  HMM * hmm;
+  HomogeneousTransitions * transitions;
+  Emissions * emissions;
+  std::vector<double> init_log_probs; // referenced by hmm
+
+private:
+  TestModel(const TestModel &);
+  TestModel & operator=(const TestModel &);
+};
+
+// TestCovarModel: as a dense TestModel, but the probability of leaving a
+// state grows with covariate slot 0 (logistic in the covariate)
+class TestCovarModel {
+public:
+  TestCovarModel(int n_states, bool scaled = false);
+  ~TestCovarModel();
+
+  HMM * hmm;
+  NonHomogeneousTransitions * transitions;
+  Emissions * emissions;
+  std::vector<double> init_log_probs; // referenced by hmm
+
+private:
+  TestCovarModel(const TestCovarModel &);
+  TestCovarModel & operator=(const TestCovarModel &);
+};
+
+// TestTopologyModel: discrete transitions, uniform over the given targets
+// of each state (padded with zero probability transitions to every other
+// state when dense), and the given emission functions (owned by the model)
+class TestTopologyModel {
+public:
+  TestTopologyModel(std::vector<std::vector<int> > const & targets, std::vector<EmissionFunction*> const & funcs, std::vector<double> const & init_probs, bool dense = false);
+  ~TestTopologyModel();
+
+  HMM * hmm;
+  HomogeneousTransitions * transitions;
+  Emissions * emissions;
+  std::vector<double> init_log_probs; // referenced by hmm
+
+private:
+  TestTopologyModel(const TestTopologyModel &);
+  TestTopologyModel & operator=(const TestTopologyModel &);
+};
+
+// Poisson emission on slot 0 (emission headers can only be included once)
+EmissionFunction * test_poisson(int state, double mean);
+
+// counts around the means of a TestModel with n_states states, in stretches
+// of a few positions per state with repeated values
+inline std::vector<double> test_counts(int length, int n_states, unsigned int seed = 1) {
+  std::vector<double> data(length);
+  int state = 0;
+
+  for (int i = 0; i < length; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    if ((seed >> 16) % 16 == 0)
+      state = (seed >> 20) % n_states;
+    data[i] = ((seed >> 24) % 4 == 0 ? (i > 0 ? data[i - 1] : 0) : 1 + 3 * state + (int) ((seed >> 8) % 5) - 2);
+    if (data[i] < 0)
+      data[i] = 0;
+  }
+
+  return data;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include "catch.hpp"
+#include "test_models.hpp"
+
+// forward_parallel/backward_parallel against the serial recursions
+// (n_threads segments of ceil(length / n_threads) positions)
+// both drop log sum terms below LogSum::SUM_LOG_THRESHOLD, but not the same
+// ones (transfer matrices start from unit vectors). With exact = true the
+// data (counts 2 and 3) keeps every term of a dense TestModel above the
+// threshold, so both must agree to rounding; otherwise only up to the
+// truncation.
+static void compare_parallel(bool exact, bool sparse, int length, int n_threads) {
+  const int n_states = 3;
+  const double eps = (exact ? 1e-10 : 1e-4);
+  TestModel model(n_states, false, sparse);
+  std::vector<double> data = test_counts(length, n_states);
+  if (exact)
+    for (int i = 0; i < length; ++i)
+      data[i] = 2 + ((int) data[i]) % 2;
+  int dim = 1;
+  Iter iter(length, 1, &dim, &data[0], 0, NULL, NULL);
+
+  std::vector<double> fw(n_states * length), bk(n_states * length);
+  std::vector<double> p_fw(n_states * length), p_bk(n_states * length);
+
+  double fw_loglik = model.hmm->forward(iter, &fw[0]);
+  double bk_loglik = model.hmm->backward(iter, &bk[0]);
+  double p_fw_loglik = model.hmm->forward_parallel(iter, &p_fw[0], n_threads);
+  double p_bk_loglik = model.hmm->backward_parallel(iter, &p_bk[0], n_threads);
+
+  INFO( "length " << length << ", " << n_threads << " threads" );
+  CHECK( p_fw_loglik == Approx(fw_loglik).epsilon(eps) );
+  CHECK( p_bk_loglik == Approx(bk_loglik).epsilon(eps) );
+
+  for (int i = 0; i < n_states * length; ++i) {
+    REQUIRE( p_fw[i] == Approx(fw[i]).epsilon(eps) );
+    REQUIRE( p_bk[i] == Approx(bk[i]).epsilon(eps) );
+  }
+}
+
+static void compare_segmentations(bool exact, bool sparse) {
+  compare_parallel(exact, sparse, 501, 2);
+  compare_parallel(exact, sparse, 1000, 5);
+  compare_parallel(exact, sparse, 1000, 16);
+  // last segment of length 1
+  compare_parallel(exact, sparse, 7, 3);    // 3 + 3 + 1
+  compare_parallel(exact, sparse, 57, 8);   // 7 x 8 + 1
+  // too short to split
+  compare_parallel(exact, sparse, 5, 4);
+}
+
+TEST_CASE("parallel forward/backward matches the serial recursions") {
+  SECTION("without log sum truncation") {
+    compare_segmentations(true, false);
+  }
+
+  SECTION("dense transitions") {
+    compare_segmentations(false, false);
+  }
+
+  SECTION("sparse transitions") {
+    compare_segmentations(false, true);
+  }
+}
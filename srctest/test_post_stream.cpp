@@ -0,0 +1,113 @@
+#include "catch.hpp"
+#include "test_models.hpp"
+#include <post_stream.hpp>
+
+// pushes data[0 .. length - 1] (with optional missing flags) and collects
+// the released posteriors, checking that positions come out in order
+// newest: index of the newest pushed position when each position was released
+static std::vector<double> stream_posteriors(PosteriorStream & stream, int n_states, const std::vector<double> & data, const int * missing, std::vector<int> * newest = NULL) {
+  std::vector<double> result;
+
+  for (unsigned int i = 0; i <= data.size(); ++i) {
+    int count = (i < data.size() ? stream.push(&data[i], NULL, missing != NULL ? missing + i : NULL) : stream.finish());
+
+    if (count > 0) {
+      REQUIRE( stream.posterior_count() == count );
+      REQUIRE( stream.posterior_start() * n_states == (int) result.size() );
+    }
+    for (int j = 0; j < count; ++j) {
+      for (int k = 0; k < n_states; ++k)
+        result.push_back(stream.posterior()[j * n_states + k]);
+      if (newest != NULL)
+        newest->push_back(i < data.size() ? i : data.size() - 1);
+    }
+  }
+
+  REQUIRE( result.size() == n_states * data.size() );
+  return result;
+}
+
+// posteriors of positions 0 .. length - 1 (state_posterior layout)
+static std::vector<double> full_posteriors(HMM * hmm, Iter & iter, double * loglik = NULL) {
+  const int n_states = hmm->state_count();
+  const int length = iter.length();
+  std::vector<double> fw(n_states * length), bk(n_states * length), post(n_states * length);
+
+  double value = hmm->forward(iter, &fw[0]);
+  hmm->backward(iter, &bk[0]);
+  hmm->state_posterior(iter, &fw[0], &bk[0], &post[0]);
+  if (loglik != NULL)
+    *loglik = value;
+  return post;
+}
+
+TEST_CASE("posterior stream") {
+  const int n_states = 3;
+  const int length = 300;
+  TestModel model(n_states, false, false, true);
+  std::vector<double> data = test_counts(length, n_states);
+  int dim = 1;
+
+  SECTION("lag covering the sequence reproduces state_posterior") {
+    Iter iter(length, 1, &dim, &data[0], 0, NULL, NULL);
+    double loglik;
+    std::vector<double> expected = full_posteriors(model.hmm, iter, &loglik);
+    int lags[2] = { length, length + 50 };
+
+    for (int l = 0; l < 2; ++l) {
+      PosteriorStream stream(model.hmm, lags[l], 1, &dim);
+      std::vector<double> post = stream_posteriors(stream, n_states, data, NULL);
+
+      CHECK( stream.loglik() == loglik );
+      for (int i = 0; i < length; ++i)
+        for (int k = 0; k < n_states; ++k)
+          REQUIRE( post[i * n_states + k] == expected[k * length + i] );
+    }
+  }
+
+  SECTION("lag 0 gives the filtered marginals") {
+    Iter iter(length, 1, &dim, &data[0], 0, NULL, NULL);
+    std::vector<double> fw(n_states * length);
+    model.hmm->forward(iter, &fw[0]);
+
+    PosteriorStream stream(model.hmm, 0, 1, &dim);
+    std::vector<double> post = stream_posteriors(stream, n_states, data, NULL);
+
+    for (int i = 0; i < length; ++i) {
+      double max = fw[i * n_states];
+      for (int k = 1; k < n_states; ++k)
+        max = std::max(max, fw[i * n_states + k]);
+      double sum = 0;
+      for (int k = 0; k < n_states; ++k)
+        sum += exp(fw[i * n_states + k] - max);
+
+      for (int k = 0; k < n_states; ++k)
+        REQUIRE( post[i * n_states + k] == Approx(exp(fw[i * n_states + k] - max) / sum).margin(1e-4) );
+    }
+  }
+
+  SECTION("window shifts keep data and missing flags") {
+    // missing stretches across the release boundaries (every lag positions)
+    const int lag = 5;
+    std::vector<int> missing(length, 0);
+    for (int i = 13; i < 28; ++i)
+      missing[i] = 1;
+    for (int i = 59; i < 71; ++i)
+      missing[i] = 1;
+    missing[100] = missing[104] = missing[105] = 1;
+
+    PosteriorStream stream(model.hmm, lag, 1, &dim, 0, NULL, true);
+    std::vector<int> newest;
+    std::vector<double> post = stream_posteriors(stream, n_states, data, &missing[0], &newest);
+
+    // each released position is smoothed over the data pushed so far
+    for (int i = 0; i < length; ++i) {
+      Iter prefix(newest[i] + 1, 1, &dim, &data[0], 0, NULL, NULL, &missing[0]);
+      std::vector<double> expected = full_posteriors(model.hmm, prefix);
+
+      REQUIRE( newest[i] >= std::min(i + lag, length - 1) );
+      for (int k = 0; k < n_states; ++k)
+        REQUIRE( post[i * n_states + k] == Approx(expected[k * prefix.length() + i]).margin(1e-12) );
+    }
+  }
+}
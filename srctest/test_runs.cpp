@@ -0,0 +1,105 @@
+#include "catch.hpp"
+#include "test_models.hpp"
+#include <run_iter.hpp>
+
+// counts in runs of up to max_run positions, around the means of n_states states
+static std::vector<double> run_counts(int length, int n_states, int max_run, unsigned int seed = 1) {
+  std::vector<double> data(length);
+
+  for (int i = 0; i < length; ) {
+    seed = seed * 1103515245u + 12345u;
+    int run = 1 + (seed >> 8) % max_run;
+    int state = (seed >> 20) % n_states;
+    double value = 1 + 3 * state + (int) ((seed >> 4) % 3) - 1;
+
+    for (int j = 0; j < run && i < length; ++j, ++i)
+      data[i] = value;
+  }
+
+  return data;
+}
+
+// covariate alternating between 0 and 4 in stretches that do not line up
+// with the runs of the data
+static std::vector<double> run_covars(int length) {
+  std::vector<double> covars(length);
+
+  for (int i = 0; i < length; ++i)
+    covars[i] = ((i / 97) % 2 == 0 ? 0 : 4);
+
+  return covars;
+}
+
+// forward_runs/backward_runs/state_posterior_runs against the per-position
+// scaled engine (run passes do not truncate log sums, see HMM::forward_runs)
+static void compare_runs(HMM * hmm, HMM * scaled, Iter & iter) {
+  const int n_states = hmm->state_count();
+  const int length = iter.length();
+  RunIter riter(iter);
+  const int n_runs = riter.run_count();
+
+  std::vector<double> fw(n_states * length), bk(n_states * length), post(n_states * length);
+  double loglik = scaled->forward(iter, &fw[0]);
+  scaled->backward(iter, &bk[0]);
+  scaled->state_posterior(iter, &fw[0], &bk[0], &post[0]);
+
+  std::vector<double> r_fw(n_states * n_runs), r_bk(n_states * n_runs), r_post(n_states * length);
+  double r_loglik = hmm->forward_runs(riter, &r_fw[0]);
+  double r_bk_loglik = hmm->backward_runs(riter, &r_bk[0]);
+  hmm->state_posterior_runs(riter, &r_fw[0], &r_bk[0], &r_post[0]);
+
+  REQUIRE( riter.sequence_length() == length );
+  CHECK( r_loglik == Approx(loglik).epsilon(1e-9) );
+  CHECK( r_bk_loglik == Approx(loglik).epsilon(1e-9) );
+
+  // run columns hold the last position of each run
+  for (int j = 0; j < n_runs; ++j) {
+    int last = riter.run_start(j) + riter.run_length(j) - 1;
+    for (int k = 0; k < n_states; ++k) {
+      REQUIRE( r_fw[j * n_states + k] == Approx(fw[last * n_states + k]).epsilon(1e-9) );
+      REQUIRE( r_bk[j * n_states + k] == Approx(bk[last * n_states + k]).epsilon(1e-9) );
+    }
+  }
+
+  // state_posterior normalizes with a truncated log sum (terms below
+  // LogSum::SUM_LOG_THRESHOLD are dropped)
+  for (int i = 0; i < n_states * length; ++i)
+    REQUIRE( r_post[i] == Approx(post[i]).margin(1e-4) );
+}
+
+TEST_CASE("run-length passes match the per-position results") {
+  const int n_states = 3;
+  const int length = 5000;
+  int dim = 1;
+
+  SECTION("long runs") {
+    TestModel model(n_states);
+    TestModel scaled(n_states, true);
+    std::vector<double> data = run_counts(length, n_states, 500);
+    Iter iter(length, 1, &dim, &data[0], 0, NULL, NULL);
+
+    compare_runs(model.hmm, scaled.hmm, iter);
+  }
+
+  SECTION("short runs") {
+    TestModel model(n_states, false, true);
+    TestModel scaled(n_states, true, true);
+    std::vector<double> data = run_counts(length, n_states, 4);
+    Iter iter(length, 1, &dim, &data[0], 0, NULL, NULL);
+
+    compare_runs(model.hmm, scaled.hmm, iter);
+  }
+
+  SECTION("runs broken by covariate changes") {
+    TestCovarModel model(n_states);
+    TestCovarModel scaled(n_states, true);
+    std::vector<double> data = run_counts(length, n_states, 500);
+    std::vector<double> covars = run_covars(length);
+    Iter iter(length, 1, &dim, &data[0], 1, &dim, &covars[0]);
+    RunIter riter(iter);
+    RunIter data_runs(Iter(length, 1, &dim, &data[0], 0, NULL, NULL));
+
+    CHECK( riter.run_count() > data_runs.run_count() );
+    compare_runs(model.hmm, scaled.hmm, iter);
+  }
+}
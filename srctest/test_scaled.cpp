@@ -0,0 +1,79 @@
+#include "catch.hpp"
+#include "test_models.hpp"
+#include <limits>
+
+// equal log-space values (both -Inf or both NaN count as equal)
+// the log engine drops log sum terms below LogSum::SUM_LOG_THRESHOLD, so it
+// only agrees with the (exact) scaled engine up to the accumulated truncation
+static bool same_log_value(double a, double b) {
+  if (std::isnan(a) || std::isnan(b))
+    return std::isnan(a) && std::isnan(b);
+  if (std::isinf(a) || std::isinf(b))
+    return a == b;
+  return a == Approx(b).epsilon(1e-4);
+}
+
+// state posteriors are probabilities
+static bool same_posterior(double a, double b) {
+  if (std::isnan(a) || std::isnan(b))
+    return std::isnan(a) && std::isnan(b);
+  return a == Approx(b).margin(1e-3);
+}
+
+// compares the scaled engine with the log engine on the same data
+// inf_column: position whose emissions are all set to -Inf (-1 = none)
+static void compare_engines(bool sparse, int inf_column) {
+  const int n_states = 4;
+  const int length = 600;
+  TestModel log_model(n_states, false, sparse);
+  TestModel scaled_model(n_states, true, sparse);
+  std::vector<double> data = test_counts(length, n_states);
+  int dim = 1;
+  Iter iter(length, 1, &dim, &data[0], 0, NULL, NULL);
+
+  std::vector<double> emissions(n_states * length);
+  const double * log_emissions = NULL;
+  if (inf_column >= 0) {
+    log_model.hmm->emission_matrix(iter, &emissions[0]);
+    for (int k = 0; k < n_states; ++k)
+      emissions[inf_column * n_states + k] = -std::numeric_limits<double>::infinity();
+    log_emissions = &emissions[0];
+  }
+
+  std::vector<double> fw(n_states * length), bk(n_states * length), post(n_states * length);
+  std::vector<double> s_fw(n_states * length), s_bk(n_states * length), s_post(n_states * length);
+
+  double loglik = log_model.hmm->forward(iter, &fw[0], log_emissions);
+  double bk_loglik = log_model.hmm->backward(iter, &bk[0], log_emissions);
+  double s_loglik = scaled_model.hmm->forward(iter, &s_fw[0], log_emissions);
+  double s_bk_loglik = scaled_model.hmm->backward(iter, &s_bk[0], log_emissions);
+
+  CHECK( same_log_value(s_loglik, loglik) );
+  CHECK( same_log_value(s_bk_loglik, bk_loglik) );
+  if (inf_column >= 0)
+    CHECK( std::isinf(s_loglik) );
+
+  log_model.hmm->state_posterior(iter, &fw[0], &bk[0], &post[0]);
+  scaled_model.hmm->state_posterior(iter, &s_fw[0], &s_bk[0], &s_post[0]);
+
+  for (int i = 0; i < n_states * length; ++i) {
+    REQUIRE( same_log_value(s_fw[i], fw[i]) );
+    REQUIRE( same_log_value(s_bk[i], bk[i]) );
+    REQUIRE( same_posterior(s_post[i], post[i]) );
+  }
+}
+
+TEST_CASE("scaled forward/backward matches the log engine") {
+  SECTION("dense transitions") {
+    compare_engines(false, -1);
+  }
+
+  SECTION("sparse transitions") {
+    compare_engines(true, -1);
+  }
+
+  SECTION("column with all emissions -Inf") {
+    compare_engines(false, 300);
+    compare_engines(true, 0);
+  }
+}
@@ -0,0 +1,209 @@
+#include "catch.hpp"
+#include <track.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+// temporary file, removed when done
+class TempPath {
+public:
+  TempPath() {
+    strcpy(path, "/tmp/qhmm_track_XXXXXX");
+    int fd = mkstemp(path);
+    REQUIRE( fd >= 0 );
+    close(fd);
+  }
+  ~TempPath() { remove(path); }
+
+  char path[32];
+};
+
+static std::vector<char> read_file(const char * path) {
+  std::vector<char> bytes;
+  FILE * file = fopen(path, "rb");
+  int c;
+
+  while ((c = fgetc(file)) != EOF)
+    bytes.push_back((char) c);
+  fclose(file);
+  return bytes;
+}
+
+static void write_file(const char * path, const std::vector<char> & bytes, size_t size) {
+  FILE * file = fopen(path, "wb");
+  if (size > 0)
+    fwrite(&bytes[0], 1, size, file);
+  fclose(file);
+}
+
+// emission slots: uint16, uint32, float32, float64 and a slot mixing uint16
+// and float32 columns (read as float64); covariate slots: float32 + float64,
+// uint32. Values are exact in every column type.
+struct TrackData {
+  enum { length = 200, e_slots = 5, c_slots = 2, e_size = 6, c_size = 3 };
+
+  int e_dim[e_slots];
+  int c_dim[c_slots];
+  int e_types[e_size];
+  int c_types[c_size];
+  std::vector<double> emissions;
+  std::vector<double> covars;
+  std::vector<int> missing;
+
+  TrackData() : emissions(length * e_size), covars(length * c_size), missing(length * e_slots, 0) {
+    int e_dim_init[e_slots] = { 1, 1, 1, 1, 2 };
+    int c_dim_init[c_slots] = { 2, 1 };
+    int e_types_init[e_size] = { TrackFile::UINT16, TrackFile::UINT32, TrackFile::FLOAT32, TrackFile::FLOAT64, TrackFile::UINT16, TrackFile::FLOAT32 };
+    int c_types_init[c_size] = { TrackFile::FLOAT32, TrackFile::FLOAT64, TrackFile::UINT32 };
+    std::copy(e_dim_init, e_dim_init + e_slots, e_dim);
+    std::copy(c_dim_init, c_dim_init + c_slots, c_dim);
+    std::copy(e_types_init, e_types_init + e_size, e_types);
+    std::copy(c_types_init, c_types_init + c_size, c_types);
+
+    for (int i = 0; i < length; ++i) {
+      double * e = &emissions[i * e_size];
+      e[0] = i % 7;
+      e[1] = 70000 + i;
+      e[2] = 0.25 * i - 10;
+      e[3] = 1.0 / (i + 1);
+      e[4] = i;
+      e[5] = -0.5 * i;
+
+      double * c = &covars[i * c_size];
+      c[0] = 0.125 * i;
+      c[1] = 1.0 / (i + 3);
+      c[2] = 3 * i;
+
+      // missing stretches across the 64 bit words of the bitmaps
+      for (int s = 0; s < e_slots; ++s)
+        missing[i * e_slots + s] = ((i + 10 * s) % 90 >= 50 ? 1 : 0);
+    }
+  }
+
+  bool write(const char * path, bool with_missing = true) const {
+    return TrackFile::write(path, length, e_slots, e_dim, &emissions[0], e_types,
+                            c_slots, c_dim, &covars[0], c_types, with_missing ? &missing[0] : NULL);
+  }
+
+  // iter over positions [start, start + iter.length()) matches the data
+  void check(Iter & iter, int start) const {
+    iter.resetFirst();
+    for (int i = start; i < start + iter.length(); ++i, iter.next()) {
+      for (int s = 0, c = 0; s < e_slots; ++s)
+        for (int d = 0; d < e_dim[s]; ++d, ++c) {
+          bool is_missing = (missing[i * e_slots + s] != 0);
+          REQUIRE( iter.is_missing(s) == is_missing );
+          REQUIRE( iter.emission_i(s, d) == (is_missing ? 0 : emissions[i * e_size + c]) );
+        }
+
+      for (int s = 0, c = 0; s < c_slots; ++s)
+        for (int d = 0; d < c_dim[s]; ++d, ++c)
+          REQUIRE( iter.covar_i(s, d) == covars[i * c_size + c] );
+    }
+  }
+};
+
+TEST_CASE("track files") {
+  TrackData data;
+  TempPath tmp;
+
+  SECTION("round trip over all column types") {
+    REQUIRE( data.write(tmp.path) );
+    TrackFile * track = TrackFile::open(tmp.path);
+    REQUIRE( track != NULL );
+
+    CHECK( track->length() == data.length );
+    CHECK( track->emission_slots() == data.e_slots );
+    CHECK( track->covar_slots() == data.c_slots );
+    CHECK( track->column_count() == data.e_size + data.c_size );
+    CHECK( track->has_missing() );
+    int slot_types[TrackData::e_slots] = { Iter::UINT16, Iter::UINT32, Iter::FLOAT32, Iter::FLOAT64, Iter::FLOAT64 };
+    for (int s = 0; s < data.e_slots; ++s) {
+      CHECK( track->e_slot_dim()[s] == data.e_dim[s] );
+      CHECK( track->e_slot_type()[s] == slot_types[s] );
+    }
+
+    {
+      TrackIter iter(*track);
+      CHECK( iter.length() == data.length );
+      data.check(iter, 0);
+    }
+    {
+      TrackIter window(*track, 70, 100);
+      CHECK( window.start() == 70 );
+      data.check(window, 70);
+    }
+    {
+      TrackIter tail(*track, 190, 50);
+      CHECK( tail.length() == 10 );
+      data.check(tail, 190);
+    }
+
+    delete track;
+  }
+
+  SECTION("single emission column read in place") {
+    int dim = 1;
+    int type = TrackFile::UINT32;
+    std::vector<double> counts(data.length);
+    for (int i = 0; i < data.length; ++i)
+      counts[i] = (i * 37) % 101;
+
+    REQUIRE( TrackFile::write(tmp.path, data.length, 1, &dim, &counts[0], &type, 0, NULL, NULL, NULL) );
+    TrackFile * track = TrackFile::open(tmp.path);
+    REQUIRE( track != NULL );
+    CHECK( !track->has_missing() );
+
+    TrackIter iter(*track, 5);
+    iter.resetFirst();
+    for (int i = 5; i < data.length; ++i, iter.next()) {
+      REQUIRE( !iter.is_missing(0) );
+      REQUIRE( iter.count(0) == counts[i] );
+    }
+    delete track;
+  }
+
+  SECTION("values that don't fit their column type") {
+    std::vector<double> saved = data.emissions;
+
+    data.emissions[3 * data.e_size] = -1; // uint16
+    CHECK( !data.write(tmp.path) );
+    data.emissions = saved;
+    data.emissions[4 * data.e_size + 1] = 2.5; // uint32
+    CHECK( !data.write(tmp.path) );
+    data.emissions = saved;
+    data.covars[7 * data.c_size + 2] = 4294967296.0; // uint32 covariate
+    CHECK( !data.write(tmp.path) );
+  }
+
+  SECTION("truncated or corrupt files are rejected") {
+    REQUIRE( data.write(tmp.path) );
+    std::vector<char> bytes = read_file(tmp.path);
+
+    // truncated: empty, inside the header, inside the column table,
+    // inside the column data and inside the missing data bitmaps
+    size_t sizes[5] = { 0, 20, 100, bytes.size() / 2, bytes.size() - 8 };
+    for (int t = 0; t < 5; ++t) {
+      write_file(tmp.path, bytes, sizes[t]);
+      INFO( "size " << sizes[t] );
+      CHECK( TrackFile::open(tmp.path) == NULL );
+    }
+
+    // corrupt: magic, version, length (high bytes), first column type
+    size_t fields[4] = { 0, 8, 20, 72 };
+    for (int f = 0; f < 4; ++f) {
+      std::vector<char> corrupt = bytes;
+      corrupt[fields[f]] ^= 0x5a;
+      write_file(tmp.path, corrupt, corrupt.size());
+      INFO( "byte " << fields[f] );
+      CHECK( TrackFile::open(tmp.path) == NULL );
+    }
+
+    // intact copy still opens
+    write_file(tmp.path, bytes, bytes.size());
+    TrackFile * track = TrackFile::open(tmp.path);
+    CHECK( track != NULL );
+    delete track;
+  }
+}
@@ -0,0 +1,136 @@
+#include "catch.hpp"
+#include "test_models.hpp"
+#include <limits>
+
+static void compare_viterbi(TestModel & model, int length, int window) {
+  std::vector<double> data = test_counts(length, model.hmm->state_count());
+  int dim = 1;
+  Iter iter(length, 1, &dim, &data[0], 0, NULL, NULL);
+  std::vector<int> path(length), online(length, -1);
+
+  model.hmm->viterbi(iter, &path[0]);
+  model.hmm->viterbi_online(iter, &online[0], window);
+
+  INFO( "length " << length << ", window " << window );
+  for (int i = 0; i < length; ++i)
+    REQUIRE( online[i] == path[i] );
+}
+
+TEST_CASE("online Viterbi matches Viterbi") {
+  SECTION("paths coalesce within the window") {
+    TestModel dense(4);
+    TestModel sparse(4, false, true);
+    int windows[4] = { 0, 2, 3, 64 };
+
+    for (int w = 0; w < 4; ++w) {
+      compare_viterbi(dense, 3000, windows[w]);
+      compare_viterbi(sparse, 3000, windows[w]);
+    }
+  }
+
+  SECTION("window larger than the sequence") {
+    TestModel model(3);
+    compare_viterbi(model, 1, 0);
+    compare_viterbi(model, 2, 0);
+    compare_viterbi(model, 100, 0);
+  }
+
+  SECTION("paths never coalesce, the window grows") {
+    // without state changes every state keeps its own path
+    TestModel model(3, false, false, false, 1.0);
+    compare_viterbi(model, 1000, 2);
+    compare_viterbi(model, 1000, 5);
+  }
+}
+
+TEST_CASE("sparse Viterbi breaks ties as the dense version") {
+  // state 2 is reached from states 0 and 1, which have the same emissions
+  int targets_init[4][2] = { { 0, 2 }, { 1, 2 }, { 2, 3 }, { 3, 0 } };
+  double means[4] = { 2, 2, 5, 10 };
+  std::vector<std::vector<int> > targets;
+  for (int k = 0; k < 4; ++k)
+    targets.push_back(std::vector<int>(targets_init[k], targets_init[k] + 2));
+  std::vector<double> init_probs(4, 0.25);
+
+  std::vector<EmissionFunction*> dense_funcs, sparse_funcs;
+  for (int k = 0; k < 4; ++k) {
+    dense_funcs.push_back(test_poisson(k, means[k]));
+    sparse_funcs.push_back(test_poisson(k, means[k]));
+  }
+  TestTopologyModel dense(targets, dense_funcs, init_probs, true);
+  TestTopologyModel sparse(targets, sparse_funcs, init_probs);
+  REQUIRE( !dense.transitions->isSparse() );
+  REQUIRE( sparse.transitions->isSparse() );
+
+  double data[8] = { 2, 5, 5, 10, 10, 2, 5, 5 };
+  int expected[8] = { 0, 2, 2, 3, 3, 0, 2, 2 };
+  int dim = 1;
+  for (int length = 3; length <= 8; length += 5) {
+    Iter iter(length, 1, &dim, data, 0, NULL, NULL);
+    std::vector<int> d_path(length), s_path(length), s_online(length);
+
+    dense.hmm->viterbi(iter, &d_path[0]);
+    sparse.hmm->viterbi(iter, &s_path[0]);
+    sparse.hmm->viterbi_online(iter, &s_online[0], 2);
+
+    INFO( "length " << length );
+    for (int i = 0; i < length; ++i) {
+      CHECK( d_path[i] == expected[i] );
+      CHECK( s_path[i] == d_path[i] );
+      CHECK( s_online[i] == d_path[i] );
+    }
+  }
+}
+
+// state k only emits the value k; records whether the path was written up to
+// position watch by the time the last position is evaluated
+class LabelEmission : public EmissionFunction {
+public:
+  LabelEmission(int stateID, const int * path, int watch, int last, bool * early) : EmissionFunction(stateID, 0), _path(path), _watch(watch), _last(last), _early(early) {}
+
+  virtual double log_probability(Iter const & iter) const {
+    if (iter.index() == _last && _path[_watch] >= 0)
+      *_early = true;
+    return (iter.emission(_slotID) == _stateID ? 0 : -std::numeric_limits<double>::infinity());
+  }
+
+private:
+  const int * _path;
+  const int _watch;
+  const int _last;
+  bool * _early;
+};
+
+TEST_CASE("online Viterbi ignores unreachable states") {
+  // left-to-right: only the labelled state is reachable at each position,
+  // the others keep unused backpointers to state 0
+  const int n_states = 4;
+  const int length = 4000;
+  std::vector<int> online(length, -1), path(length);
+  bool early = false;
+
+  std::vector<std::vector<int> > targets(n_states);
+  std::vector<EmissionFunction*> funcs;
+  std::vector<double> init_probs(n_states, 0);
+  for (int k = 0; k < n_states; ++k) {
+    targets[k].push_back(k);
+    if (k + 1 < n_states)
+      targets[k].push_back(k + 1);
+    funcs.push_back(new LabelEmission(k, &online[0], length - 100, length - 1, &early));
+  }
+  init_probs[0] = 1;
+  TestTopologyModel model(targets, funcs, init_probs);
+
+  std::vector<double> data(length);
+  for (int i = 0; i < length; ++i)
+    data[i] = i * n_states / length;
+  int dim = 1;
+  Iter iter(length, 1, &dim, &data[0], 0, NULL, NULL);
+
+  model.hmm->viterbi_online(iter, &online[0], 16);
+  CHECK( early );
+
+  model.hmm->viterbi(iter, &path[0]);
+  for (int i = 0; i < length; ++i)
+    REQUIRE( online[i] == path[i] );
+}